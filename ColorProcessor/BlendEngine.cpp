@@ -0,0 +1,99 @@
+#include "BlendEngine.h"
+#include "PixelKernels.h"
+
+// Rows per thread below which a blend stays on the calling thread.
+static const size_t MIN_ROWS_PER_THREAD = 64;
+
+// The Blend kernel reads every source of a pixel before writing it, so dst may be one of the sources.
+void BlendXYZ(XYZImage& dst, const std::vector<const XYZImage*>& sources, const std::vector<float>& weights)
+{
+    const size_t height = dst.height();
+    const BlendF32Fn blend = SelectBlend(sources.size());
+    ParallelRows(height, MIN_ROWS_PER_THREAD, [&](size_t first, size_t last) {
+        std::vector<const float*> src(sources.size());
+        for (int xyz_index = 0; xyz_index < 3; ++xyz_index) {
+            for (size_t y = first; y < last; ++y) {
+                for (size_t s = 0; s < sources.size(); ++s) {
+                    src[s] = sources[s]->filterData(xyz_index) + (y * sources[s]->stride());
+                }
+                blend(dst.filterData(xyz_index) + (y * dst.stride()), src.data(), weights.data(), src.size(), dst.width());
+            }
+        }
+    });
+}
+
+BlendEngine::BlendEngine() : reblend_interval_(DEFAULT_REBLEND_INTERVAL), updates_(0), blended_(false)
+{ }
+
+void BlendEngine::setLights(const std::vector<std::shared_ptr<XYZImage>>& lights)
+{
+    lights_ = lights;
+    blended_ = false;
+    if (lights_.empty()) {
+        master_.reset();
+        return;
+    }
+    const size_t width = lights_[0]->width();
+    const size_t height = lights_[0]->height();
+    if (!master_ || master_->width() != width || master_->height() != height) {
+        master_ = std::shared_ptr<XYZImage>(new XYZImage((int)width, (int)height));
+    }
+}
+
+std::shared_ptr<XYZImage> BlendEngine::Writable() const
+{
+    if (master_.use_count() > 1) {
+        return std::shared_ptr<XYZImage>(new XYZImage((int)master_->width(), (int)master_->height()));
+    }
+    return master_;
+}
+
+void BlendEngine::Reblend()
+{
+    if (!master_ || weights_.size() != lights_.size()) {
+        return;
+    }
+    std::vector<const XYZImage*> sources(lights_.size());
+    for (size_t light = 0; light < lights_.size(); ++light) {
+        sources[light] = lights_[light].get();
+    }
+    std::shared_ptr<XYZImage> master = Writable();
+    BlendXYZ(*master, sources, weights_);
+    master_ = master;
+    updates_ = 0;
+    blended_ = true;
+}
+
+void BlendEngine::setWeights(const std::vector<float>& weights)
+{
+    if (!master_ || weights.size() != lights_.size()) {
+        return;
+    }
+    if (!blended_ || updates_ + 1 >= reblend_interval_) {
+        weights_ = weights;
+        Reblend();
+        return;
+    }
+    // Delta update: the master itself (weight 1) plus every light whose weight changed
+    std::vector<const XYZImage*> sources(1, master_.get());
+    std::vector<float> deltas(1, 1.0f);
+    for (size_t light = 0; light < lights_.size(); ++light) {
+        if (weights[light] != weights_[light]) {
+            sources.push_back(lights_[light].get());
+            deltas.push_back(weights[light] - weights_[light]);
+        }
+    }
+    weights_ = weights;
+    if (sources.size() == 1) {
+        return;
+    }
+    if (sources.size() >= lights_.size()) {
+        Reblend();
+        return;
+    }
+    // A new master is the old one plus the deltas, so the delta update still applies
+    std::shared_ptr<XYZImage> master = Writable();
+    BlendXYZ(*master, sources, deltas);
+    master_ = master;
+    ++updates_;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "ConversionFunctions.h"
+
+// dst = sum over s of sources[s] * weights[s], channel by channel, with the rows split between threads.
+// Every source has the size of dst; dst may be one of the sources.
+void BlendXYZ(XYZImage& dst, const std::vector<const XYZImage*>& sources, const std::vector<float>& weights);
+
+// BlendEngine: weighted sum of the per-light XYZ images of a capture, kept up to date as light weights change.
+//
+// The master image is allocated once. When only some weights change, the master is updated in place,
+// master += (w_new - w_old) * light for every changed light, which reads changed + 1 planes per channel instead
+// of nlights. An update that would touch as many planes as a full blend does a full blend instead. Rounding
+// errors of in-place updates add up, so every reblendInterval() updates the master is blended from scratch.
+// Rows are split between threads; the row kernel is Blend (PixelKernels).
+//
+// Images handed out by master() never change while they are held elsewhere: if anyone but the engine holds the
+// master when it is updated, the update (full or delta) is written to a new image, which becomes the master.
+// Holders that drop their reference before the next setWeights keep the in-place updates.
+//
+// Not thread safe: use one engine from one thread at a time.
+class BlendEngine
+{
+public:
+    static const int DEFAULT_REBLEND_INTERVAL = 16;
+
+    BlendEngine();
+
+    // Per-light XYZ images, all of the same size. The engine keeps a reference to them.
+    // The next setWeights blends from scratch.
+    void setLights(const std::vector<std::shared_ptr<XYZImage>>& lights);
+    // One weight per light.
+    void setWeights(const std::vector<float>& weights);
+    const std::vector<float>& weights() const { return weights_; }
+
+    // Blends every light again with the current weights.
+    void Reblend();
+    void setReblendInterval(int updates) { reblend_interval_ = (updates > 0) ? updates : 1; }
+    int reblendInterval() const { return reblend_interval_; }
+    int updatesSinceReblend() const { return updates_; }
+
+    // Current blend, NULL before the first setWeights. Later calls update it in place only while nobody else holds it.
+    std::shared_ptr<XYZImage> master() const { return master_; }
+
+private:
+    // The master, or a new image of its size while the master is held elsewhere.
+    std::shared_ptr<XYZImage> Writable() const;
+
+    std::vector<std::shared_ptr<XYZImage>> lights_;
+    std::vector<float> weights_;
+    std::shared_ptr<XYZImage> master_;
+    int reblend_interval_;
+    int updates_;
+    bool blended_;
+};
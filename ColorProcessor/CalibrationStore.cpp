@@ -0,0 +1,307 @@
+#include "CalibrationStore.h"
+#include "PixelKernels.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Open stores by path. Entries expire with the last shared_ptr to the store.
+static std::mutex registry_mutex;
+static std::map<std::string, std::weak_ptr<CalibrationStore>> registry;
+
+static size_t PlaneBytes(const CalibrationStoreHeader& header, size_t element_size)
+{
+    return RoundUpToAlignment((size_t)header.width * header.height * element_size, CALSTORE_SECTION_ALIGNMENT);
+}
+
+size_t CalibrationStore::BiasOffset()
+{
+    return RoundUpToAlignment(sizeof(CalibrationStoreHeader), CALSTORE_SECTION_ALIGNMENT);
+}
+
+size_t CalibrationStore::GainOffset(const CalibrationStoreHeader& header, int light, int filter)
+{
+    const size_t gain_bytes = PlaneBytes(header, (header.flags & CALSTORE_FP16) ? sizeof(unsigned short) : sizeof(float));
+    const size_t pair_bytes = gain_bytes + PlaneBytes(header, sizeof(unsigned char));
+    const size_t bias_bytes = header.has_bias ? PlaneBytes(header, sizeof(unsigned short)) : 0;
+    return BiasOffset() + bias_bytes + ((size_t)filter * header.nlights + light) * pair_bytes;
+}
+
+size_t CalibrationStore::MaskOffset(const CalibrationStoreHeader& header, int light, int filter)
+{
+    return GainOffset(header, light, filter) + PlaneBytes(header, (header.flags & CALSTORE_FP16) ? sizeof(unsigned short) : sizeof(float));
+}
+
+size_t CalibrationStore::FileSize(const CalibrationStoreHeader& header)
+{
+    return GainOffset(header, 0, header.nfilters);
+}
+
+std::shared_ptr<CalibrationStore> CalibrationStore::Open(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    std::shared_ptr<CalibrationStore> store = registry[path].lock();
+    if (store) {
+        return store;
+    }
+    store = std::shared_ptr<CalibrationStore>(new CalibrationStore());
+    if (!store->Map(path)) {
+        registry.erase(path);
+        return std::shared_ptr<CalibrationStore>();
+    }
+    registry[path] = store;
+    return store;
+}
+
+CalibrationStore::CalibrationStore() : base_(NULL), size_(0)
+#ifdef _WIN32
+    , file_(INVALID_HANDLE_VALUE), mapping_(NULL)
+#else
+    , fd_(-1)
+#endif
+{
+    memset(&header_, 0, sizeof(header_));
+}
+
+CalibrationStore::~CalibrationStore()
+{
+    Unmap();
+}
+
+bool CalibrationStore::Map(const std::string& path)
+{
+#ifdef _WIN32
+    file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file_ == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_, &file_size) || file_size.QuadPart < (LONGLONG)sizeof(CalibrationStoreHeader)) {
+        Unmap();
+        return false;
+    }
+    size_ = (size_t)file_size.QuadPart;
+    mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping_) {
+        Unmap();
+        return false;
+    }
+    base_ = (const unsigned char*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+#else
+    fd_ = open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd_, &st) != 0 || st.st_size < (off_t)sizeof(CalibrationStoreHeader)) {
+        Unmap();
+        return false;
+    }
+    size_ = (size_t)st.st_size;
+    void* base = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd_, 0);
+    base_ = (base == MAP_FAILED) ? NULL : (const unsigned char*)base;
+#endif
+    if (!base_) {
+        Unmap();
+        return false;
+    }
+    memcpy(&header_, base_, sizeof(header_));
+    if (memcmp(header_.magic, CALSTORE_MAGIC, sizeof(CALSTORE_MAGIC)) != 0 || header_.version != CALSTORE_VERSION || size_ < FileSize(header_)) {
+        Unmap();
+        return false;
+    }
+    return true;
+}
+
+void CalibrationStore::Unmap()
+{
+#ifdef _WIN32
+    if (base_) {
+        UnmapViewOfFile(base_);
+    }
+    if (mapping_) {
+        CloseHandle(mapping_);
+    }
+    if (file_ != INVALID_HANDLE_VALUE) {
+        CloseHandle(file_);
+    }
+    mapping_ = NULL;
+    file_ = INVALID_HANDLE_VALUE;
+#else
+    if (base_) {
+        munmap((void*)base_, size_);
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+    fd_ = -1;
+#endif
+    base_ = NULL;
+    size_ = 0;
+}
+
+const unsigned short* CalibrationStore::bias() const
+{
+    return hasBias() ? (const unsigned short*)(base_ + BiasOffset()) : NULL;
+}
+
+const float* CalibrationStore::gain(int light, int filter) const
+{
+    return isFp16() ? NULL : (const float*)(base_ + GainOffset(header_, light, filter));
+}
+
+const unsigned short* CalibrationStore::gainFp16(int light, int filter) const
+{
+    return isFp16() ? (const unsigned short*)(base_ + GainOffset(header_, light, filter)) : NULL;
+}
+
+const unsigned char* CalibrationStore::mask(int light, int filter) const
+{
+    return base_ + MaskOffset(header_, light, filter);
+}
+
+void CalibrationStore::Prefetch(int filter) const
+{
+    if (filter < 0 || filter >= nfilters()) {
+        return;
+    }
+    const size_t offset = GainOffset(header_, 0, filter);
+    const size_t bytes = GainOffset(header_, 0, filter + 1) - offset;
+#ifdef _WIN32
+#if _WIN32_WINNT >= 0x0602
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = (PVOID)(base_ + offset);
+    range.NumberOfBytes = bytes;
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+#else
+    madvise((void*)(base_ + offset), bytes, MADV_WILLNEED);
+#endif
+}
+
+void CalibrationStore::Release(int filter) const
+{
+    if (filter < 0 || filter >= nfilters()) {
+        return;
+    }
+    const size_t offset = GainOffset(header_, 0, filter);
+    const size_t bytes = GainOffset(header_, 0, filter + 1) - offset;
+#ifdef _WIN32
+    // Unlocking pages that are not locked removes them from the working set.
+    VirtualUnlock((LPVOID)(base_ + offset), bytes);
+#else
+    // The mapping is read-only and file backed, so dropped pages are simply faulted in again from the page cache.
+    madvise((void*)(base_ + offset), bytes, MADV_DONTNEED);
+#endif
+}
+
+// Writes zeros from position up to offset. position tracks the write position (ftell is 32 bit on Windows).
+static bool PadTo(FILE* file, size_t& position, size_t offset)
+{
+    static const char zeros[CALSTORE_SECTION_ALIGNMENT] = { 0 };
+    while (position < offset) {
+        size_t count = offset - position;
+        if (count > sizeof(zeros)) {
+            count = sizeof(zeros);
+        }
+        if (fwrite(zeros, 1, count, file) != count) {
+            return false;
+        }
+        position += count;
+    }
+    return true;
+}
+
+// Writes count elements and advances position.
+template<typename T>
+static bool WriteRow(FILE* file, size_t& position, const T* data, size_t count)
+{
+    position += count * sizeof(T);
+    return fwrite(data, sizeof(T), count, file) == count;
+}
+
+bool CalibrationStore::Write(const std::string& path, const unsigned short* bias, const std::vector<std::shared_ptr<FlatFieldImage>>& flats, int flags, float defect_threshold)
+{
+    if (flats.empty() || !flats[0]) {
+        return false;
+    }
+    CalibrationStoreHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CALSTORE_MAGIC, sizeof(CALSTORE_MAGIC));
+    header.version = CALSTORE_VERSION;
+    header.flags = flags;
+    header.width = (uint32_t)flats[0]->width();
+    header.height = (uint32_t)flats[0]->height();
+    header.nlights = (uint32_t)flats.size();
+    header.nfilters = (uint32_t)flats[0]->num();
+    header.has_bias = bias ? 1 : 0;
+    for (size_t light = 0; light < flats.size(); ++light) {
+        if (!flats[light] || flats[light]->width() != header.width || flats[light]->height() != header.height || flats[light]->num() != header.nfilters) {
+            return false;
+        }
+    }
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    const size_t width = header.width;
+    size_t position = 0;
+    bool ok = WriteRow(file, position, &header, 1);
+    if (ok && bias) {
+        ok = PadTo(file, position, BiasOffset()) && WriteRow(file, position, bias, width * header.height);
+    }
+
+    std::vector<float> gain_row(width);
+    std::vector<unsigned short> gain_row_fp16(width);
+    std::vector<unsigned char> mask_row(width);
+    for (uint32_t filter = 0; ok && filter < header.nfilters; ++filter) {
+        for (uint32_t light = 0; ok && light < header.nlights; ++light) {
+            const FlatFieldImage& flat = *flats[light];
+            ok = PadTo(file, position, GainOffset(header, light, filter));
+            for (size_t y = 0; ok && y < header.height; ++y) {
+                const auto* flat_row = &flat.filterData(filter)[y * flat.stride()];
+                for (size_t x = 0; x < width; ++x) {
+                    const float value = (float)flat_row[x];
+                    gain_row[x] = (value > defect_threshold && std::isfinite(value)) ? 1.0f / value : 0.0f;
+                }
+                if (flags & CALSTORE_FP16) {
+                    for (size_t x = 0; x < width; ++x) {
+                        gain_row_fp16[x] = FloatToHalf(gain_row[x]);
+                    }
+                    ok = WriteRow(file, position, gain_row_fp16.data(), width);
+                } else {
+                    ok = WriteRow(file, position, gain_row.data(), width);
+                }
+            }
+            ok = ok && PadTo(file, position, MaskOffset(header, light, filter));
+            for (size_t y = 0; ok && y < header.height; ++y) {
+                const auto* flat_row = &flat.filterData(filter)[y * flat.stride()];
+                for (size_t x = 0; x < width; ++x) {
+                    const float value = (float)flat_row[x];
+                    mask_row[x] = (value > defect_threshold && std::isfinite(value)) ? 0 : 1;
+                }
+                ok = WriteRow(file, position, mask_row.data(), width);
+            }
+        }
+    }
+    ok = ok && PadTo(file, position, FileSize(header));
+    if (fclose(file) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        remove(path.c_str());
+    }
+    return ok;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Image.h"
+#include "FlatFieldImage.h"
+
+// CalibrationStore: read-only, memory-mapped calibration data for a capture setup.
+//
+// A store file holds an optional bias frame and, for every filter and light, the reciprocal flat-field
+// gain map (0 where the flat field is 0 or defective) and a defect mask. Gain maps are float or,
+// with CALSTORE_FP16, IEEE half floats. Nothing is read up front: pages are faulted in as planes are
+// touched, and Prefetch/Release let the engine page filters in and out as the capture advances.
+// Stores opened from the same path share one mapping.
+//
+// File layout (little-endian). Every section starts on a CALSTORE_SECTION_ALIGNMENT boundary:
+//   CalibrationStoreHeader
+//   bias frame                      uint16, width * height (if has_bias)
+//   for each filter, for each light:
+//       reciprocal gain map         float or half, width * height
+//       defect mask                 uint8, width * height, 1 = defective
+// Filters are the outer loop so that the planes needed for one filter position are contiguous.
+
+static const char CALSTORE_MAGIC[8] = { 'C', 'A', 'L', 'S', 'T', 'O', 'R', 'E' };
+static const uint32_t CALSTORE_VERSION = 1;
+static const size_t CALSTORE_SECTION_ALIGNMENT = 4096;
+
+enum CalibrationStoreFlags {
+    CALSTORE_FP16 = 1       // gain maps stored as half floats
+};
+
+struct CalibrationStoreHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t width;
+    uint32_t height;
+    uint32_t nlights;
+    uint32_t nfilters;
+    uint32_t has_bias;
+    uint32_t reserved[7];
+};
+
+class CalibrationStore
+{
+public:
+    // Maps the store at path, or returns the store already mapped for path. Returns NULL if the file
+    // cannot be mapped or is not a valid store.
+    static std::shared_ptr<CalibrationStore> Open(const std::string& path);
+    // Writes a store from a bias frame (may be NULL) and one flat field per light, each with one plane per filter.
+    // Flat-field values at or below defect_threshold (and non-finite values) are marked defective.
+    static bool Write(const std::string& path, const unsigned short* bias, const std::vector<std::shared_ptr<FlatFieldImage>>& flats, int flags, float defect_threshold = 0);
+
+    ~CalibrationStore();
+
+    size_t width() const { return header_.width; }
+    size_t height() const { return header_.height; }
+    size_t stride() const { return header_.width; }
+    int nlights() const { return header_.nlights; }
+    int nfilters() const { return header_.nfilters; }
+    int flags() const { return header_.flags; }
+    bool isFp16() const { return (header_.flags & CALSTORE_FP16) != 0; }
+    bool hasBias() const { return header_.has_bias != 0; }
+
+    // Bias frame, or NULL if the store has none.
+    const unsigned short* bias() const;
+    // Reciprocal gain map; gain() is NULL for fp16 stores and gainFp16() is NULL otherwise.
+    const float* gain(int light, int filter) const;
+    const unsigned short* gainFp16(int light, int filter) const;
+    const unsigned char* mask(int light, int filter) const;
+
+    // Asks the OS to read in / drop the pages of every light at filter. Both are hints; the data stays valid.
+    void Prefetch(int filter) const;
+    void Release(int filter) const;
+
+    // Offsets of the sections of a store with the given header, in bytes from the start of the file.
+    static size_t BiasOffset();
+    static size_t GainOffset(const CalibrationStoreHeader& header, int light, int filter);
+    static size_t MaskOffset(const CalibrationStoreHeader& header, int light, int filter);
+    static size_t FileSize(const CalibrationStoreHeader& header);
+
+private:
+    CalibrationStore();
+    CalibrationStore(const CalibrationStore&);
+    CalibrationStore& operator=(const CalibrationStore&);
+
+    bool Map(const std::string& path);
+    void Unmap();
+
+    CalibrationStoreHeader header_;
+    const unsigned char* base_;
+    size_t size_;
+#ifdef _WIN32
+    void* file_;
+    void* mapping_;
+#else
+    int fd_;
+#endif
+};
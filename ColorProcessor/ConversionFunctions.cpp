@@ -1,53 +1,64 @@
 #include <fstream>
 #include <sstream>
+#include <cstring>
 
 #include "Image.h"
 #include "ConversionFunctions.h"
+#include "SpectralProjection.h"
+#include "PixelKernels.h"
 #include <iostream>
 #include <memory>
+#include <stdexcept>
+#include <utility>
+
+// Projection reads one plane per filter; with fewer the XYZ planes would be left as they were
+static void RequireFilterPlanes(size_t planes, const filterconfig* filter)
+{
+    if (filter == NULL || planes < (size_t)filter->nfilters()) {
+        throw std::invalid_argument("XYZImage: spectral image has fewer planes than the filter configuration");
+    }
+}
 
 // XYZImage constructor.
-XYZImage::XYZImage(const NormalizedImage& input_img, filterconfig* filter) : RawImage<float>(3, input_img.width_, input_img.height_, NULL), filter_(filter)
+XYZImage::XYZImage(const NormalizedImage& input_img, filterconfig* filter) : XYZImage(ImageView<const float>(input_img), filter)
+{ }
+
+// XYZImage constructor from a view of the spectral planes (one plane per filter, in filterconfig order).
+XYZImage::XYZImage(const ImageView<const float>& input_img, filterconfig* filter) : RawImage<float>(3, input_img.width(), input_img.height(), NULL), filter_(filter)
 {
+    RequireFilterPlanes(input_img.num(), filter);
     AllocateImgData();
-
-    std::map<int, std::vector<float>>::iterator it;
-
-    float scalar_constant[3] = {0, 0, 0};
-    for (auto filter_index = 0; filter_index < filter_->nfilters(); ++filter_index) {
-        int wavelength = filter_->wavelengthAtPos(filter_index);
-        std::vector<float> cmf_v = filter_->cmfValues(wavelength);
-        float* cmf = &cmf_v[0];
-        float illuminant = filter_->illuminantValue(wavelength);
-        //calculate the XYZ values without whitepoint scaling
-        for (size_t y = 0; y < height_; ++y) {
-            for (size_t x = 0; x < width_; ++x) {
-                for (size_t xyz_index = 0; xyz_index < 3; ++xyz_index) {
-                    img_data_[xyz_index][(y * width_) + x] += input_img.img_data_[filter_index][(y * input_img.width_)+x] * cmf[xyz_index] * illuminant;
-                }
-            }
-        }
-        // calculate the white point for the specified illuminant
-        for (size_t xyz_index = 0; xyz_index < 3; ++xyz_index) {
-            scalar_constant[xyz_index] += cmf[xyz_index] * illuminant;
-        }
-        ++filter_index;
+    SpectralProjection(filter_).Project(input_img, ImageView<float>(*this));
+}
+// XYZImage consuming constructor.
+// Each pixel's XYZ only depends on the same pixel of every filter plane, so the result can be written
+// into the first three planes of the input once all bands of that pixel have been read.
+XYZImage::XYZImage(NormalizedImage&& input_img, filterconfig* filter)
+    : RawImage<float>((RequireFilterPlanes(input_img.num(), filter), std::move(input_img))), filter_(filter)
+{
+    SpectralProjection(filter_).Project(ImageView<const float>(*this), ImageView<float>(*this));
+    TruncatePlanes(3);
+}
+std::vector<XYZImage> XYZImage::Project(const ImageView<const float>& input_img, const std::vector<filterconfig*>& filters)
+{
+    std::vector<XYZImage> images;
+    const SpectralProjection projection(std::vector<const filterconfig*>(filters.begin(), filters.end()));
+    if (projection.nfilters() == 0 || input_img.num() < projection.nfilters()) {
+        return images;
     }
-    for (size_t y = 0; y < height_; ++y) {
-        for (size_t x = 0; x < width_; ++x) {
-            for (size_t xyz_index = 0; xyz_index < 3; ++xyz_index) {
-                img_data_[xyz_index][(y * width_) + x] /= scalar_constant[xyz_index];
-            }
-        }
+    std::vector<ImageView<float>> views;
+    images.reserve(filters.size());
+    for (size_t k = 0; k < filters.size(); ++k) {
+        images.push_back(XYZImage((int)input_img.width(), (int)input_img.height()));
+        images.back().filter_ = filters[k];
+        views.push_back(ImageView<float>(images.back()));
     }
+    projection.Project(input_img, views);
+    return images;
 }
-XYZImage::XYZImage(const int width, const int height) : RawImage<float>(3, width, height, false, NULL)
+XYZImage::XYZImage(const int width, const int height, int storage) : RawImage<float>(3, width, height, false, NULL, storage)
 {
-    img_data_ = new float*[num_];
-    const size_t img_size = width_ * height_;
-    for (size_t n = 0; n < num_; ++n) {
-        img_data_[n] = new float[img_size]();
-    }
+    AllocateImgData();
 }
 
 XYZImage::XYZImage(const NormalizedImage& input_img, const char* const illuminant_path, const char* const cmf_path) : RawImage<float>(3, input_img.width_, input_img.height_, NULL)
@@ -86,7 +97,7 @@ XYZImage::XYZImage(const NormalizedImage& input_img, const char* const illuminan
 		for (size_t y = 0; y < height_; ++y) {
 			for (size_t x = 0; x < width_; ++x) {
 				for (size_t xyz_index = 0; xyz_index < 3; ++xyz_index) {
-					img_data_[xyz_index][(y * width_) + x] += input_img.img_data_[filter_index][(y * input_img.width_)+x] * cmf_values[xyz_index][filter_index] * illuminant[filter_index];
+					img_data_[xyz_index][(y * stride_) + x] += input_img.img_data_[filter_index][(y * input_img.stride_)+x] * cmf_values[xyz_index][filter_index] * illuminant[filter_index];
 				}
 			}
 		}
@@ -98,13 +109,29 @@ XYZImage::XYZImage(const NormalizedImage& input_img, const char* const illuminan
 	for (size_t y = 0; y < height_; ++y) {
 		for (size_t x = 0; x < width_; ++x) {
 			for (size_t xyz_index = 0; xyz_index < 3; ++xyz_index) {
-				img_data_[xyz_index][(y * width_) + x] /= scalar_constant[xyz_index];
+				img_data_[xyz_index][(y * stride_) + x] /= scalar_constant[xyz_index];
 			}
 		}
 	}
 }
+// dst = weighted sum of the XYZ planes of lights, one Blend row kernel call per output row.
+// The light count picks the kernel (2 to 4 lights have specialized ones).
+static void BlendLights(RawImage<float>& dst, const std::vector<const RawImage<float>*>& lights, const float* weights)
+{
+    const BlendF32Fn blend = SelectBlend(lights.size());
+    std::vector<const float*> src(lights.size());
+    for (size_t xyz_index = 0; xyz_index < 3; ++xyz_index) {
+        for (size_t y = 0; y < dst.height(); ++y) {
+            for (size_t light_index = 0; light_index < lights.size(); ++light_index) {
+                src[light_index] = lights[light_index]->filterData(xyz_index) + (y * lights[light_index]->stride());
+            }
+            blend(dst.filterData(xyz_index) + (y * dst.stride()), src.data(), weights, src.size(), dst.width());
+        }
+    }
+}
+
 // XYZImage weighted average constructor
-XYZImage::XYZImage(std::vector<XYZImage*> images, size_t n_lights, float* weights) : RawImage<float>(3, images[0]->width_, images[0]->height_, NULL)
+XYZImage::XYZImage(const std::vector<XYZImage*>& images, size_t n_lights, float* weights) : RawImage<float>(3, images[0]->width_, images[0]->height_, false, NULL, images[0]->storage_)
 {
 	AllocateImgData();
 	// TODO: CHECK THAT WIDTH AND HEIGHT ARE THE SAME ACROSS XYZIMAGES
@@ -119,35 +146,19 @@ XYZImage::XYZImage(std::vector<XYZImage*> images, size_t n_lights, float* weight
 		}
 	}
 
-	for (size_t xyz_index = 0; xyz_index < 3; ++xyz_index) {
-		for (size_t y = 0; y < height_; ++y) {
-			for (size_t x = 0; x < width_; ++x) {
-				for (size_t light_index = 0; light_index < n_lights; ++light_index) {
-                    img_data_[xyz_index][(y * width_) + x] += images[light_index]->img_data_[xyz_index][(y * width_) + x] * weights[light_index];
-				}
-			}
-		}
-	}
+	BlendLights(*this, std::vector<const RawImage<float>*>(images.begin(), images.begin() + n_lights), weights);
 	if (weights_is_null) {
 		delete [] weights;
 	}
 }
-XYZImage::XYZImage(std::vector<XYZImage *> images, size_t n_lights, std::vector<float> weights) : RawImage<float>(3, images[0]->width_, images[0]->height_, NULL)
+XYZImage::XYZImage(const std::vector<XYZImage *>& images, size_t n_lights, const std::vector<float>& weights) : RawImage<float>(3, images[0]->width_, images[0]->height_, false, NULL, images[0]->storage_)
 {
     AllocateImgData();
     // TODO: CHECK THAT WIDTH AND HEIGHT ARE THE SAME ACROSS XYZIMAGES
 
-    for (size_t xyz_index = 0; xyz_index < 3; ++xyz_index) {
-        for (size_t y = 0; y < height_; ++y) {
-            for (size_t x = 0; x < width_; ++x) {
-                for (size_t light_index = 0; light_index < n_lights; ++light_index) {
-                    img_data_[xyz_index][(y * width_) + x] += images[light_index]->img_data_[xyz_index][(y * width_) + x] * weights[light_index];
-                }
-            }
-        }
-    }
+    BlendLights(*this, std::vector<const RawImage<float>*>(images.begin(), images.begin() + n_lights), weights.data());
 }
-XYZImage::XYZImage(std::vector<XYZImage *> images, size_t n_lights, std::vector<float> weights, const cv::Size& dest_size) : RawImage<float>(3, 0, 0, NULL)
+XYZImage::XYZImage(const std::vector<XYZImage *>& images, size_t n_lights, const std::vector<float>& weights, const cv::Size& dest_size) : RawImage<float>(3, 0, 0, false, NULL, images[0]->storage_)
 {
     float scale = (float)dest_size.width / (float)images[0]->width();
 
@@ -161,36 +172,33 @@ XYZImage::XYZImage(std::vector<XYZImage *> images, size_t n_lights, std::vector<
 
     // Resize source data to supplied cv::size and weight the data
 
+    // One scratch plane, reused for every resize
+    std::unique_ptr<float[]> scaled_data(new float[render_size.width*render_size.height]);
+    cv::Mat dst(height_, width_, CV_32F, scaled_data.get());
     for (size_t xyz_index = 0; xyz_index < 3; ++xyz_index) {
         for (size_t light_index = 0; light_index < images.size(); ++light_index) {
-            std::unique_ptr<float> scaled_data(new float[render_size.width*render_size.height]);
-            cv::Mat dst(height_, width_, CV_32F, scaled_data.get());
-            cv::Mat src(images[light_index]->height(), images[light_index]->width(), CV_32F, images[light_index]->filterData(xyz_index));
+            cv::Mat src(images[light_index]->height(), images[light_index]->width(), CV_32F, images[light_index]->filterData(xyz_index), images[light_index]->stride() * sizeof(float));
             cv::resize(src, dst, render_size);
 
             for (auto y = 0; y < height_; ++y) {
                 for (auto x = 0; x < width_; ++x) {
-                    img_data_[xyz_index][(y * width_) + x] += scaled_data.get()[(y*width_)+x] * weights[light_index];
+                    img_data_[xyz_index][(y * stride_) + x] += scaled_data[(y*width_)+x] * weights[light_index];
                 }
             }
         }
     }
 }
 
-XYZImage::XYZImage(std::vector<XYZImage> images, size_t n_lights, std::vector<float> weights) : RawImage<float>(3, images[0].width_, images[0].height_, NULL)
+XYZImage::XYZImage(const std::vector<XYZImage>& images, size_t n_lights, const std::vector<float>& weights) : RawImage<float>(3, images[0].width_, images[0].height_, false, NULL, images[0].storage_)
 {
     AllocateImgData();
     // TODO: CHECK THAT WIDTH AND HEIGHT ARE THE SAME ACROSS XYZIMAGES
 
-    for (size_t xyz_index = 0; xyz_index < 3; ++xyz_index) {
-        for (size_t y = 0; y < height_; ++y) {
-            for (size_t x = 0; x < width_; ++x) {
-                for (size_t light_index = 0; light_index < n_lights; ++light_index) {
-                    img_data_[xyz_index][(y * width_) + x] += images[light_index].img_data_[xyz_index][(y * width_) + x] * weights[light_index];
-                }
-            }
-        }
+    std::vector<const RawImage<float>*> lights(n_lights);
+    for (size_t light_index = 0; light_index < n_lights; ++light_index) {
+        lights[light_index] = &images[light_index];
     }
+    BlendLights(*this, lights, weights.data());
 }
 
 // XYZImage copy constructor.
@@ -206,6 +214,20 @@ XYZImage& XYZImage::operator=(const XYZImage& img)
 	return *this;
 }
 
+// XYZImage move constructor.
+XYZImage::XYZImage(XYZImage&& img) : RawImage<float>(std::move(img)), filter_(img.filter_)
+{ }
+
+// XYZImage move assignment operator.
+XYZImage& XYZImage::operator=(XYZImage&& img)
+{
+	if (this != &img) {
+		RawImage::operator=(std::move(img));
+		filter_ = img.filter_;
+	}
+	return *this;
+}
+
 // XYZImage destructor.
 // NOTE: the base class's (RawImage) destructor is automatically called,
 // so there is no need to call it again in this destructor.
@@ -215,66 +237,59 @@ XYZImage::~XYZImage()
 // XYZImage helper functon to allocate image data array, and set the initial values to 0.
 void XYZImage::AllocateImgData()
 {
-	img_data_ = new float*[num_];
-	const size_t img_size = width_ * height_;
-	for (size_t n = 0; n < num_; ++n) {
-		img_data_[n] = new float[img_size]();
-		// Note the extra "()"!           ^^ This initializes their values to their default value (0).
-		// This is (I think) more efficient than looping through the array and manually setting them equal to 0.
+	RawImage<float>::AllocateImgData();
+	if (block_) {
+		memset(block_, 0, block_bytes_);
 	}
 }
 
-// LabImage constructor.
-LabImage::LabImage(const XYZImage& input_img) : RawImage<float>(3, input_img.width_, input_img.height_)
+// X, Y and Z planes of xyz to L*a*b* in the first three planes of lab, rows split between threads. lab may be xyz.
+static void ConvertXyzToLab(const ImageView<const float>& xyz, const ImageView<float>& lab, int accuracy)
 {
-	float f_xyz[3];
-	for (size_t y = 0; y < input_img.height_; ++y) {
-		for (size_t x = 0; x < input_img.width_; ++x) {
-			for (size_t xyz_index = 0; xyz_index < 3; ++xyz_index) {
-				//calculate the unscaled L*ab values
-				if (input_img.img_data_[xyz_index][(y * input_img.width_) + x] > 216.0/24389.0) {
-					f_xyz[xyz_index] = pow(input_img.img_data_[xyz_index][(y * input_img.width_) + x], (1.0/3.0));
-				} else {
-					f_xyz[xyz_index] = ((input_img.img_data_[xyz_index][(y * input_img.width_) + x] * (24389.0 / 27.0)) + 16) / 116.0;
-				}
-			}
-			
-			img_data_[0][(y * width_) + x] = ((116.0 * f_xyz[1]) - 16.0);
-			img_data_[1][(y * width_) + x] = (500.0 * (f_xyz[0] - f_xyz[1]));
-			img_data_[2][(y * width_) + x] = (200.0 * (f_xyz[1] - f_xyz[2]));
-		}
-	}
-}
-
-LabImage::LabImage(const XYZImage &input_img, const cv::Rect& crop) : RawImage<float>(3, crop.width, crop.height)
-{
-    float f_xyz[3];
-    int img_x = 0;
-    int img_y = 0;
-    for (auto y = crop.y; y < crop.height + crop.y; ++y) {
-        for (auto x = crop.x; x < crop.width + crop.x; ++x) {
+    void (*convert)(float* const*, const float* const*, size_t) = (accuracy == LAB_EXACT) ? XyzToLabExact : XyzToLab;
+    const size_t width = lab.width();
+    ParallelRows(lab.height(), 64, [&](size_t first, size_t last) {
+        // Decimated views are gathered into contiguous rows for the kernel
+        std::vector<float> gathered(xyz.contiguousRows() ? 0 : 3 * width);
+        const float* src[3];
+        float* dst[3];
+        for (size_t y = first; y < last; ++y) {
             for (size_t xyz_index = 0; xyz_index < 3; ++xyz_index) {
-                //calculate the unscaled L*ab values
-                if (input_img.img_data_[xyz_index][(y * input_img.width_) + x] > 216.0/24389.0) {
-                    f_xyz[xyz_index] = pow(input_img.img_data_[xyz_index][(y * input_img.width_) + x], (1.0/3.0));
-                } else {
-                    f_xyz[xyz_index] = ((input_img.img_data_[xyz_index][(y * input_img.width_) + x] * (24389.0 / 27.0)) + 16) / 116.0;
+                const float* row = xyz.row(xyz_index, y);
+                if (!xyz.contiguousRows()) {
+                    float* packed = &gathered[xyz_index * width];
+                    for (size_t x = 0; x < width; ++x) {
+                        packed[x] = row[x * xyz.step()];
+                    }
+                    row = packed;
                 }
+                src[xyz_index] = row;
+                dst[xyz_index] = lab.row(xyz_index, y);
             }
+            convert(dst, src, width);
+        }
+    });
+}
 
-            img_data_[0][(img_y * width_) + img_x] = ((116.0 * f_xyz[1]) - 16.0);
-            img_data_[1][(img_y * width_) + img_x] = (500.0 * (f_xyz[0] - f_xyz[1]));
-            img_data_[2][(img_y * width_) + img_x] = (200.0 * (f_xyz[1] - f_xyz[2]));
+// LabImage constructor.
+LabImage::LabImage(const XYZImage& input_img, int accuracy) : LabImage(ImageView<const float>(input_img), accuracy)
+{ }
 
+// LabImage constructor from a view of X, Y and Z planes. Crops and decimated views convert without copying the source.
+LabImage::LabImage(const ImageView<const float>& input_img, int accuracy) : RawImage<float>(3, input_img.width(), input_img.height())
+{
+    ConvertXyzToLab(input_img, ImageView<float>(*this), accuracy);
+}
 
-            //img_data_[2][(img_y * width_) + img_x] += abs(img_data_[2][(img_y* width_) +img_x]) * 0.05;
-            ++img_x;
-        }
-        ++img_y;
-        img_x = 0;
-    }
+// LabImage consuming constructor. Converts each pixel in place.
+LabImage::LabImage(XYZImage&& input_img, int accuracy) : RawImage<float>(std::move(input_img))
+{
+    ConvertXyzToLab(ImageView<const float>(*this), ImageView<float>(*this), accuracy);
 }
 
+LabImage::LabImage(const XYZImage &input_img, const cv::Rect& crop, int accuracy) : LabImage(ImageView<const float>(input_img).crop(crop.x, crop.y, crop.width, crop.height), accuracy)
+{ }
+
 // LabImage copy constructor.
 LabImage::LabImage(const LabImage& img) : RawImage<float>(img)
 { }
@@ -288,146 +303,90 @@ LabImage& LabImage::operator=(const LabImage& img)
 	return *this;
 }
 
+// LabImage move constructor.
+LabImage::LabImage(LabImage&& img) : RawImage<float>(std::move(img))
+{ }
+
+// LabImage move assignment operator.
+LabImage& LabImage::operator=(LabImage&& img)
+{
+	if (this != &img) {
+		RawImage::operator=(std::move(img));
+	}
+	return *this;
+}
+
 // LabImage destructor.
 // NOTE: the base class's (RawImage) destructor is automatically called,
 // so there is no need to call it again in this destructor.
 LabImage::~LabImage()
 { }
 
-RGBImage::RGBImage(const XYZImage& InputImage) : RawImage<uint8_t>(3, InputImage.width_, InputImage.height_)
+// Preview transform (1.8 gamma) shared by the RGBImage constructors that take none, built on first use.
+static const OutputTransform& DefaultOutputTransform()
 {
-	float xyz_to_rgb_m[3][3];
-
-	//this is sRGB (D50 bradford-adapted) conversion matrix
-	xyz_to_rgb_m[0][0] = 3.1338561f		;
-	xyz_to_rgb_m[1][0] = -1.6168667f	;
-	xyz_to_rgb_m[2][0] = -0.4906146f	;
-	xyz_to_rgb_m[0][1] = -0.9787684f	;
-	xyz_to_rgb_m[1][1] = 1.9161415f		;
-	xyz_to_rgb_m[2][1] = 0.0334540f		;
-	xyz_to_rgb_m[0][2] = 0.0719453f		;
-	xyz_to_rgb_m[1][2] = -0.2289914f	;
-	xyz_to_rgb_m[2][2] =  1.4052427f	;
-
-	int img_x = 0;
-
-	for (int y = 0; y < height_; y++) {
-		for (int x = 0; x < width_; x++) {
-			float rf, gf, bf;
-            // The values 0.96422 and 0.82521 are hardcoded illuminant values, in this case for D50. 96422 82521
-            rf = ( (xyz_to_rgb_m[0][0] * InputImage.img_data_[XYZImage::XINDEX][(y*width_)+x] * 0.96422) + (xyz_to_rgb_m[1][0] * InputImage.img_data_[XYZImage::YINDEX][(y*width_)+x]) + (xyz_to_rgb_m[2][0] * InputImage.img_data_[XYZImage::ZINDEX][(y*width_)+x] * 0.82521));
-            gf = ( (xyz_to_rgb_m[0][1] * InputImage.img_data_[XYZImage::XINDEX][(y*width_)+x] * 0.96422) + (xyz_to_rgb_m[1][1] * InputImage.img_data_[XYZImage::YINDEX][(y*width_)+x]) + (xyz_to_rgb_m[2][1] * InputImage.img_data_[XYZImage::ZINDEX][(y*width_)+x] * 0.82521));
-            bf = ( (xyz_to_rgb_m[0][2] * InputImage.img_data_[XYZImage::XINDEX][(y*width_)+x] * 0.96422) + (xyz_to_rgb_m[1][2] * InputImage.img_data_[XYZImage::YINDEX][(y*width_)+x]) + (xyz_to_rgb_m[2][2] * InputImage.img_data_[XYZImage::ZINDEX][(y*width_)+x] * 0.82521));
-
-			// Gamma scaling
-			rf = pow(rf, (1.0/1.8));
-			gf = pow(gf, (1.0/1.8));
-			bf = pow(bf, (1.0/1.8));
-
-			// Scale from 0-1 to 0-255 (8-bit)
-			rf *= 255;
-			gf *= 255;
-			bf *= 255;
-
-			// Clipping
-			if (rf > 255)
-				rf = 255;
-			if (bf > 255)
-				bf = 255;
-            if (gf > 255)
-				gf = 255;
-
-            uint8_t r, g, b;
-			r = floor(rf + 0.5);
-			g = floor(gf + 0.5);
-			b = floor(bf + 0.5);
-
-			img_data_[0][(y * width_) + x] = r;
-			img_data_[1][(y * width_) + x] = g;
-			img_data_[2][(y * width_) + x] = b;
-			img_x++;
-        }
-        img_x = 0;
-	}
+    static const OutputTransform transform(OUTPUT_PREVIEW_GAMMA_18);
+    return transform;
 }
-RGBImage::RGBImage(const XYZImage& InputImage, const cv::Rect& crop) : RawImage<uint8_t>(3, crop.width, crop.height)
+
+RGBImage::RGBImage(const XYZImage& InputImage) : RGBImage(ImageView<const float>(InputImage))
+{ }
+RGBImage::RGBImage(const XYZImage& InputImage, const cv::Rect& crop) : RGBImage(ImageView<const float>(InputImage).crop(crop.x, crop.y, crop.width, crop.height))
+{ }
+// RGBImage constructor from a view of X, Y and Z planes.
+RGBImage::RGBImage(const ImageView<const float>& InputImage) : RGBImage(InputImage, DefaultOutputTransform())
+{ }
+RGBImage::RGBImage(const ImageView<const float>& InputImage, const OutputTransform& transform) : RawImage<uint8_t>(3, InputImage.width(), InputImage.height())
 {
-    float xyz_to_rgb_m[3][3];
-
-    //this is sRGB (D50 bradford-adapted)
-    xyz_to_rgb_m[0][0] = 3.1338561f		;
-    xyz_to_rgb_m[1][0] = -1.6168667f	;
-    xyz_to_rgb_m[2][0] = -0.4906146f	;
-    xyz_to_rgb_m[0][1] = -0.9787684f	;
-    xyz_to_rgb_m[1][1] = 1.9161415f		;
-    xyz_to_rgb_m[2][1] = 0.0334540f		;
-    xyz_to_rgb_m[0][2] = 0.0719453f		;
-    xyz_to_rgb_m[1][2] = -0.2289914f	;
-    xyz_to_rgb_m[2][2] =  1.4052427f	;
-
-    int img_x = 0;
-    int img_y = 0;
-
-    for (int y = crop.y; y < crop.height + crop.y; y++) {
-        for (int x = crop.x; x < crop.width + crop.x; x++) {
-            float rf, gf, bf;
-
-            // The values 0.96422 and 0.82521 are hardcoded illuminant values, in this case for D50. 96422 82521
-            rf = ( (xyz_to_rgb_m[0][0] * InputImage.img_data_[XYZImage::XINDEX][(y*InputImage.width_)+x] * 0.96422) + (xyz_to_rgb_m[1][0] * InputImage.img_data_[XYZImage::YINDEX][(y*InputImage.width_)+x]) + (xyz_to_rgb_m[2][0] * InputImage.img_data_[XYZImage::ZINDEX][(y*InputImage.width_)+x] * 0.82521));
-            gf = ( (xyz_to_rgb_m[0][1] * InputImage.img_data_[XYZImage::XINDEX][(y*InputImage.width_)+x] * 0.96422) + (xyz_to_rgb_m[1][1] * InputImage.img_data_[XYZImage::YINDEX][(y*InputImage.width_)+x]) + (xyz_to_rgb_m[2][1] * InputImage.img_data_[XYZImage::ZINDEX][(y*InputImage.width_)+x] * 0.82521));
-            bf = ( (xyz_to_rgb_m[0][2] * InputImage.img_data_[XYZImage::XINDEX][(y*InputImage.width_)+x] * 0.96422) + (xyz_to_rgb_m[1][2] * InputImage.img_data_[XYZImage::YINDEX][(y*InputImage.width_)+x]) + (xyz_to_rgb_m[2][2] * InputImage.img_data_[XYZImage::ZINDEX][(y*InputImage.width_)+x] * 0.82521));
-
-            // Gamma scaling
-            rf = pow(rf, (1.0/1.8));
-            gf = pow(gf, (1.0/1.8));
-            bf = pow(bf, (1.0/1.8));
-
-            // Scale from 0-1 to 0-255 (8-bit)
-            rf *= 255;
-            gf *= 255;
-            bf *= 255;
-
-            // Clipping
-            if (rf > 255)
-                rf = 255;
-            if (bf > 255)
-                bf = 255;
-            if (gf > 255)
-                gf = 255;
-
-            uint8_t r, g, b;
-            r = floor(rf + 0.5);
-            g = floor(gf + 0.5);
-            b = floor(bf + 0.5);
-
-            img_data_[0][(img_y * width_) + img_x] = r;
-            img_data_[1][(img_y * width_) + img_x] = g;
-            img_data_[2][(img_y * width_) + img_x] = b;
-
-            ++img_x;
-        }
-        ++img_y;
-        img_x = 0;
-    }
+    transform.Apply(InputImage, ImageView<uint8_t>(*this));
 }
 
+// Interleaves the planes into the scanlines of a QImage; lines are padded to 4 bytes, so they are addressed
+// through scanLine rather than packed.
 QPixmap RGBImage::getQPixmap()
 {
-    size_t scanline_size = width_ * 3;
-
-    while (scanline_size % 4) ++scanline_size;
-    std::shared_ptr<uint8_t> rgbdata(new uint8_t[scanline_size * height_]);
-    int img_x = 0;
+    QImage img(width_, height_, QImage::Format_RGB888);
     for (int y = 0; y < height_; ++y) {
-        for (int x = 0; x < scanline_size; x+=3) {
+        uchar* line = img.scanLine(y);
+        for (int x = 0; x < width_; ++x) {
             for (int rgb_index = 0; rgb_index < 3; ++rgb_index) {
-                rgbdata.get()[(y * scanline_size) + x + rgb_index] = img_data_[rgb_index][(y*width_)+img_x];
+                line[(x * 3) + rgb_index] = img_data_[rgb_index][(y * stride_) + x];
             }
-            ++img_x;
         }
-        img_x = 0;
     }
-    QImage img(rgbdata.get(), width_, height_, QImage::Format_RGB888);
-    QPixmap answer = QPixmap::fromImage(img);
-    return answer;
+    return QPixmap::fromImage(img);
+}
+
+bool RenderQImage(const ImageView<const float>& xyz, QImage& image, const OutputTransform& transform)
+{
+    size_t channels;
+    switch (image.format()) {
+    case QImage::Format_RGB888:
+        channels = 3;
+        break;
+    case QImage::Format_RGBX8888:
+        channels = 4;
+        break;
+    default:
+        return false;
+    }
+    if ((size_t)image.width() != xyz.width() || (size_t)image.height() != xyz.height()) {
+        return false;
+    }
+    transform.Render(xyz, image.bits(), image.bytesPerLine(), channels);
+    return true;
+}
+
+QImage RenderQImage(const ImageView<const float>& xyz, const OutputTransform& transform, QImage::Format format)
+{
+    QImage image((int)xyz.width(), (int)xyz.height(), format);
+    if (!RenderQImage(xyz, image, transform)) {
+        return QImage();
+    }
+    return image;
+}
+
+QImage RenderQImage(const ImageView<const float>& xyz, QImage::Format format)
+{
+    return RenderQImage(xyz, DefaultOutputTransform(), format);
 }
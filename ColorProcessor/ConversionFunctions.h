@@ -1,7 +1,9 @@
 #pragma once
 
 #include "Image.h"
+#include "ImageView.h"
 #include "NormalizedImage.h"
+#include "OutputTransform.h"
 #include <QPixmap>
 #include <QBitmap>
 #include <QImage>
@@ -13,6 +15,12 @@
 #ifndef XYZIMAGE_H
 #define XYZIMAGE_H
 
+// Wraps plane n of a view in a cv::Mat header without copying. The view must have contiguous rows (step() == 1).
+inline cv::Mat PlaneMat(const ImageView<float>& view, size_t n)
+{
+    return cv::Mat(view.height(), view.width(), CV_32F, view.plane(n), view.stride() * sizeof(float));
+}
+
 /* Todo:
  * Standardize and document data file formats
  * test other filter bands
@@ -23,16 +31,27 @@ class XYZImage : public RawImage<float> {
 public:
 	// Constructors:
 	XYZImage(const NormalizedImage& input_img, const char* const illuminant_path, const char* const cmf_path);
+    // These throw std::invalid_argument if input_img has fewer planes than filter has filters.
     XYZImage(const NormalizedImage& input_img, filterconfig* filter);
-    XYZImage(const int width, const int height);
-	// Weighted average constructor
-    XYZImage(std::vector<XYZImage*> images, size_t n_lights, float* weights);
-    XYZImage(std::vector<XYZImage *> images, size_t n_lights, std::vector<float> weights);
-    XYZImage::XYZImage(std::vector<XYZImage *> images, size_t n_lights, std::vector<float> weights, const cv::Size& dest_size);
-    XYZImage(std::vector<XYZImage> images, size_t n_lights, std::vector<float> weights);
+    XYZImage(const ImageView<const float>& input_img, filterconfig* filter);
+    // Consuming constructor: writes XYZ into the first three planes of input_img and takes them over, input_img is
+    // left empty. On a plane count mismatch input_img is left untouched.
+    XYZImage(NormalizedImage&& input_img, filterconfig* filter);
+    XYZImage(const int width, const int height, int storage = DefaultPlaneStorage());
+	// Weighted average constructor. The result uses the same plane storage as images[0].
+    XYZImage(const std::vector<XYZImage*>& images, size_t n_lights, float* weights);
+    XYZImage(const std::vector<XYZImage *>& images, size_t n_lights, const std::vector<float>& weights);
+    XYZImage::XYZImage(const std::vector<XYZImage *>& images, size_t n_lights, const std::vector<float>& weights, const cv::Size& dest_size);
+    XYZImage(const std::vector<XYZImage>& images, size_t n_lights, const std::vector<float>& weights);
+    // One image per filterconfig (illuminant and color matching functions), all from a single pass over the
+    // spectral planes. The configurations must have the same filters, and input_img at least that many planes;
+    // otherwise the result is empty.
+    static std::vector<XYZImage> Project(const ImageView<const float>& input_img, const std::vector<filterconfig*>& filters);
 	// Rule of 3 (Copy Constructor, Copy Assignment Operator, and Destructor):
 	XYZImage(const XYZImage& img);
 	XYZImage& operator=(const XYZImage& img);
+	XYZImage(XYZImage&& img);
+	XYZImage& operator=(XYZImage&& img);
 	~XYZImage();
 
 protected:
@@ -45,16 +64,27 @@ private:
 
     filterconfig *filter_;
 };
+// Cube root used for L*a*b* conversion (see XyzToLab in PixelKernels.h).
+enum LabAccuracy {
+    LAB_FAST = 0,       // vectorized approximation, relative error below 2^-21
+    LAB_EXACT = 1       // cbrt
+};
+
 class LabImage : public RawImage<float> {
 public:
 	// Constructors:
-	LabImage(const XYZImage& input_img);
+	LabImage(const XYZImage& input_img, int accuracy = LAB_FAST);
+	LabImage(const ImageView<const float>& input_img, int accuracy = LAB_FAST);
+    // Consuming constructor: converts input_img to L*a*b* in place and takes over its planes.
+    LabImage(XYZImage&& input_img, int accuracy = LAB_FAST);
     // Lab Image crop constructor
-    LabImage(const XYZImage &input_img, const cv::Rect& crop);
+    LabImage(const XYZImage &input_img, const cv::Rect& crop, int accuracy = LAB_FAST);
 
 	// Rule of 3 (Copy Constructor, Copy Assignment Operator, and Destructor):
 	LabImage(const LabImage& img);
     LabImage& operator=(const LabImage& img);
+    LabImage(LabImage&& img);
+    LabImage& operator=(LabImage&& img);
     void enhanceContrastAndSaturation();
 	~LabImage();
 private:
@@ -64,6 +94,9 @@ public:
 	// Class Constructor
 	RGBImage(const XYZImage& InputImage);
     RGBImage(const XYZImage& InputImage, const cv::Rect& crop);
+    // 8-bit sRGB primaries with the 1.8 preview gamma (OUTPUT_PREVIEW_GAMMA_18), or the space of transform.
+    RGBImage(const ImageView<const float>& InputImage);
+    RGBImage(const ImageView<const float>& InputImage, const OutputTransform& transform);
     QPixmap getQPixmap();
 	// Copy Constructor
 	//RGBImage(const RGBImage& img);
@@ -73,4 +106,11 @@ public:
 	//~RGBImage();
 private:
 };
+
+// Preview rendering straight from XYZ planes into interleaved 8-bit QImage scanlines, in one row-parallel pass.
+// Format_RGB888 and Format_RGBX8888 are supported. The first form renders into the caller's image, which must
+// have the size of xyz (returns false otherwise); the others return an image that owns its pixels.
+bool RenderQImage(const ImageView<const float>& xyz, QImage& image, const OutputTransform& transform);
+QImage RenderQImage(const ImageView<const float>& xyz, const OutputTransform& transform, QImage::Format format = QImage::Format_RGB888);
+QImage RenderQImage(const ImageView<const float>& xyz, QImage::Format format = QImage::Format_RGB888);
 #endif
@@ -0,0 +1,114 @@
+#include "DeltaEEngine.h"
+#include "PixelKernels.h"
+
+#include <algorithm>
+
+// Rows per thread below which Map stays on the calling thread.
+static const size_t MIN_ROWS_PER_THREAD = 64;
+// Pairs handed to the kernel at a time, and blocks per thread below which Pairs stays on the calling thread.
+static const size_t PAIRS_BLOCK = 4096;
+static const size_t MIN_BLOCKS_PER_THREAD = 4;
+
+static DeltaEF32Fn SelectDeltaE(int formula)
+{
+    PixelKernelRegistry& registry = PixelKernels();
+    switch (formula) {
+    case DELTA_E_76: return registry.delta_e76_f32.select();
+    case DELTA_E_94: return registry.delta_e94_f32.select();
+    default: return registry.delta_e2000_f32.select();
+    }
+}
+
+// Row y of the L*, a* and b* planes of view; decimated views are gathered into scratch (3 * width floats).
+static void LabRows(const ImageView<const float>& view, size_t y, float* scratch, const float* rows[3])
+{
+    const size_t width = view.width();
+    for (size_t lab_index = 0; lab_index < 3; ++lab_index) {
+        const float* row = view.row(lab_index, y);
+        if (!view.contiguousRows()) {
+            float* packed = scratch + (lab_index * width);
+            for (size_t x = 0; x < width; ++x) {
+                packed[x] = row[x * view.step()];
+            }
+            row = packed;
+        }
+        rows[lab_index] = row;
+    }
+}
+
+// Runs kernel on row y of sample against ref_rows and stores the result in row y of de.
+static void MapRow(DeltaEF32Fn kernel, const ImageView<const float>& sample, const float* const* ref_rows, const ImageView<float>& de, size_t y, float* scratch, float* out)
+{
+    const size_t width = de.width();
+    const float* sample_rows[3];
+    LabRows(sample, y, scratch, sample_rows);
+    float* row = de.row(0, y);
+    kernel(de.contiguousRows() ? row : out, sample_rows, ref_rows, width);
+    if (!de.contiguousRows()) {
+        for (size_t x = 0; x < width; ++x) {
+            row[x * de.step()] = out[x];
+        }
+    }
+}
+
+void DeltaEEngine::Map(const ImageView<const float>& sample, const ImageView<const float>& reference, const ImageView<float>& de) const
+{
+    const DeltaEF32Fn kernel = SelectDeltaE(formula_);
+    const size_t width = de.width();
+    ParallelRows(de.height(), MIN_ROWS_PER_THREAD, [&](size_t first, size_t last) {
+        std::vector<float> sample_scratch(sample.contiguousRows() ? 0 : 3 * width);
+        std::vector<float> ref_scratch(reference.contiguousRows() ? 0 : 3 * width);
+        std::vector<float> out(de.contiguousRows() ? 0 : width);
+        const float* ref_rows[3];
+        for (size_t y = first; y < last; ++y) {
+            LabRows(reference, y, ref_scratch.data(), ref_rows);
+            MapRow(kernel, sample, ref_rows, de, y, sample_scratch.data(), out.data());
+        }
+    });
+}
+
+void DeltaEEngine::Map(const ImageView<const float>& sample, const cv::Vec3f& reference, const ImageView<float>& de) const
+{
+    const DeltaEF32Fn kernel = SelectDeltaE(formula_);
+    const size_t width = de.width();
+    ParallelRows(de.height(), MIN_ROWS_PER_THREAD, [&](size_t first, size_t last) {
+        std::vector<float> sample_scratch(sample.contiguousRows() ? 0 : 3 * width);
+        std::vector<float> out(de.contiguousRows() ? 0 : width);
+        // The reference color as one row per plane, shared by every row of the band
+        std::vector<float> ref(3 * width);
+        const float* ref_rows[3];
+        for (size_t lab_index = 0; lab_index < 3; ++lab_index) {
+            std::fill(ref.begin() + (lab_index * width), ref.begin() + ((lab_index + 1) * width), reference[(int)lab_index]);
+            ref_rows[lab_index] = &ref[lab_index * width];
+        }
+        for (size_t y = first; y < last; ++y) {
+            MapRow(kernel, sample, ref_rows, de, y, sample_scratch.data(), out.data());
+        }
+    });
+}
+
+void DeltaEEngine::Pairs(const float* const* samples, const float* const* references, float* de, size_t n) const
+{
+    const DeltaEF32Fn kernel = SelectDeltaE(formula_);
+    const size_t nblocks = (n + PAIRS_BLOCK - 1) / PAIRS_BLOCK;
+    ParallelRows(nblocks, MIN_BLOCKS_PER_THREAD, [&](size_t first, size_t last) {
+        for (size_t block = first; block < last; ++block) {
+            const size_t begin = block * PAIRS_BLOCK;
+            const float* sample_rows[3] = { samples[0] + begin, samples[1] + begin, samples[2] + begin };
+            const float* ref_rows[3] = { references[0] + begin, references[1] + begin, references[2] + begin };
+            kernel(de + begin, sample_rows, ref_rows, std::min(PAIRS_BLOCK, n - begin));
+        }
+    });
+}
+
+void DeltaEEngine::Statistics(const ImageView<const float>& de, const std::vector<cv::Rect>& regions, std::vector<RoiStatistics>& stats)
+{
+    stats.resize(regions.size());
+    const cv::Rect bounds(0, 0, (int)de.width(), (int)de.height());
+    ParallelRows(regions.size(), 1, [&](size_t first, size_t last) {
+        for (size_t r = first; r < last; ++r) {
+            const cv::Rect region = regions[r] & bounds;
+            stats[r].Compute(de.crop(region.x, region.y, region.width, region.height));
+        }
+    });
+}
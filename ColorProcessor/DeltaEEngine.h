@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "ImageView.h"
+#include "RoiStatistics.h"
+#include <opencv2/core/core.hpp>
+
+// DeltaEEngine: color difference maps and batches between L*a*b* samples and references.
+//
+// Planes are L*, a* and b*, as in LabImage. Every formula is a row kernel (DeltaE76, DeltaE94 and DeltaE2000 in
+// PixelKernels) run over bands of rows, one band per thread; a constant reference is expanded into one row per
+// thread. Batches of (sample, reference) pairs are split into blocks the same way. Summary statistics of a map
+// come from RoiStatistics, per region.
+
+enum DeltaEFormula {
+    DELTA_E_76 = 0,     // Euclidean distance in L*a*b*
+    DELTA_E_94,         // CIE94, graphic arts weights
+    DELTA_E_2000        // CIEDE2000
+};
+
+class DeltaEEngine
+{
+public:
+    explicit DeltaEEngine(int formula = DELTA_E_2000) : formula_(formula) { }
+
+    int formula() const { return formula_; }
+    void setFormula(int formula) { formula_ = formula; }
+
+    // Delta E of every pixel of sample against the same pixel of reference, into plane 0 of de.
+    // All three are the same size.
+    void Map(const ImageView<const float>& sample, const ImageView<const float>& reference, const ImageView<float>& de) const;
+    // Delta E of every pixel of sample against one reference color (L*, a*, b*).
+    void Map(const ImageView<const float>& sample, const cv::Vec3f& reference, const ImageView<float>& de) const;
+    // n pairs: de[i] = delta E of (samples[0][i], samples[1][i], samples[2][i]) against the same entry of references.
+    void Pairs(const float* const* samples, const float* const* references, float* de, size_t n) const;
+
+    // Statistics of plane 0 of de over each region (clipped to de); stats is resized to regions.size().
+    static void Statistics(const ImageView<const float>& de, const std::vector<cv::Rect>& regions, std::vector<RoiStatistics>& stats);
+
+private:
+    int formula_;
+};
@@ -1,10 +1,14 @@
 #pragma once
 
+#include <algorithm>
 #include <functional>
 #include <vector>
+#include "PlaneMemory.h"
+#include "PixelKernels.h"
 
 template<typename img_type, typename fn_type = std::function<void(img_type*)>> class Image;
 template<typename img_type> class RawImage;
+class FlatFieldImage;
 
 template<typename img_type, typename fn_type>
 class Image
@@ -18,6 +22,8 @@ public:
     // Rule of 3 (Copy Constructor, Copy Assignment Operator, and Destructor):
     Image(const Image<img_type, fn_type>& img); // Copy constructor.mm
     Image<img_type, fn_type>& operator=(const Image<img_type, fn_type>& img); // Assignment operator.
+    Image(Image<img_type, fn_type>&& img); // Move constructor. Leaves img empty.
+    Image<img_type, fn_type>& operator=(Image<img_type, fn_type>&& img); // Move assignment operator.
     virtual ~Image(); // Destructor. NOTE: If you plan on using this class polymorphically, make this function virtual!
 
     void ReadData();
@@ -51,19 +57,27 @@ class RawImage : public Image<img_type*, std::function<void(img_type**, size_t,
     friend class FlatFieldImage;
 public:
     // Constructors:
-    RawImage(size_t num, size_t width, size_t height, bool allocate_mem = true, img_type** img_data = NULL);
-    RawImage(size_t num, size_t width, size_t height, const std::function<void(img_type**, size_t, char*)>& read_function, const std::function<void(img_type**, size_t, char*)>& write_function, bool allocate_mem = false, img_type** img_data = NULL);
+    // When allocate_mem is set, all planes are placed in one PLANE_ALIGNMENT-aligned block laid out according to storage (see PlaneMemory.h).
+    // Planes passed in through img_data are owned by the image and must have been allocated with new[], one per plane, with stride == width.
+    RawImage(size_t num, size_t width, size_t height, bool allocate_mem = true, img_type** img_data = NULL, int storage = DefaultPlaneStorage());
+    RawImage(size_t num, size_t width, size_t height, const std::function<void(img_type**, size_t, char*)>& read_function, const std::function<void(img_type**, size_t, char*)>& write_function, bool allocate_mem = false, img_type** img_data = NULL, int storage = DefaultPlaneStorage());
 
     // Rule of 3 (Copy Constructor, Copy Assignment Operator, and Destructor):
     RawImage(const RawImage<img_type>& img); // Copy constructor.
     RawImage<img_type>& operator=(const RawImage<img_type>& img); // Assignment operator.
+    RawImage(RawImage<img_type>&& img); // Move constructor. Takes over img's planes and leaves img empty.
+    RawImage<img_type>& operator=(RawImage<img_type>&& img); // Move assignment operator.
     img_type* filterData(int filter);
+    const img_type* filterData(int filter) const;
     virtual ~RawImage(); // Destructor. (NOTE: If you plan on using this class polymorphically, make this function virtual! ???)
 
     void ReadData(size_t n, char* path = NULL); // See the NOTE for ReadData. // Change this so that path is passed in through the lambda function instead.
     void WriteData(char* path);
     void WriteData(char* path, size_t n);
     size_t num() const { return num_; }
+    // Row stride of every plane, in elements. Index pixels as filterData(n)[(y * stride()) + x].
+    size_t stride() const { return stride_; }
+    int storage() const { return storage_; }
     RawImage<img_type>& operator-=(const Image<img_type>& amb_img);
     RawImage<img_type>& operator-=(const std::vector<unsigned short>& sub_img);
     RawImage<img_type>& operator/(FlatFieldImage& flat_img);
@@ -72,13 +86,21 @@ public:
 
 
 protected:
-    const size_t num_;
+    size_t num_;
+    size_t stride_;             // row stride in elements
+    size_t plane_stride_;       // distance between the starts of two planes in block_, in elements
+    int storage_;               // PlaneStorage flags
+    void* block_;               // storage for all planes, NULL when the planes were supplied by the caller
+    size_t block_bytes_;
 
     typedef std::function<void(img_type**, size_t, char*)> fn_type;
 
     // Helper functions to prevent some code duplication.
     virtual void AllocateImgData();
+    void ReleaseImgData();
     void CopyImageDataFrom(const RawImage<img_type>& img);
+    void TakeImgDataFrom(RawImage<img_type>& img);
+    void TruncatePlanes(size_t num);
 };
 
 template<typename img_type>
@@ -86,10 +108,15 @@ img_type* RawImage<img_type>::filterData(int filter)
 {
     return img_data_[filter];
 }
+template<typename img_type>
+const img_type* RawImage<img_type>::filterData(int filter) const
+{
+    return img_data_[filter];
+}
 
 // Image constructor. NOTE: Only use this constructor when allocating an Image object (i.e. do NOT use it when allocating a RawImage object).
 template<typename img_type, typename fn_type>
-Image<img_type, fn_type>::Image(size_t width, size_t height, bool allocate_mem) : width_(width), height_(height)
+Image<img_type, fn_type>::Image(size_t width, size_t height, bool allocate_mem) : img_data_(NULL), width_(width), height_(height)
 {
     if (allocate_mem) {
         AllocateImgData();
@@ -100,7 +127,7 @@ Image<img_type, fn_type>::Image(size_t width, size_t height, bool allocate_mem)
 
 // Image constructor.
 template<typename img_type, typename fn_type>
-Image<img_type, fn_type>::Image(size_t width, size_t height, const fn_type& read_function, const fn_type& write_function, bool allocate_mem) : width_(width), height_(height), read_function_(read_function), write_function_(write_function)
+Image<img_type, fn_type>::Image(size_t width, size_t height, const fn_type& read_function, const fn_type& write_function, bool allocate_mem) : img_data_(NULL), width_(width), height_(height), read_function_(read_function), write_function_(write_function)
 {
     if (allocate_mem) {
         AllocateImgData();
@@ -120,17 +147,46 @@ template<typename img_type, typename fn_type>
 Image<img_type, fn_type>& Image<img_type, fn_type>::operator=(const Image<img_type, fn_type>& img)
 {
     if (this != &img) {
-        this->~Image();
+        delete [] img_data_;
         this->width_ = img.width_;
         this->height_ = img.height_;
         this->read_function_ = img.read_function_;
         this->write_function_ = img.write_function_;
 
+        AllocateImgData();
         CopyImageDataFrom(img); // Copy image data.
     }
     return *this;
 }
 
+// Image move constructor.
+template<typename img_type, typename fn_type>
+Image<img_type, fn_type>::Image(Image<img_type, fn_type>&& img) : img_data_(img.img_data_), width_(img.width_), height_(img.height_), read_function_(img.read_function_), write_function_(img.write_function_)
+{
+    img.img_data_ = NULL;
+    img.width_ = 0;
+    img.height_ = 0;
+}
+
+// Image move assignment operator.
+template<typename img_type, typename fn_type>
+Image<img_type, fn_type>& Image<img_type, fn_type>::operator=(Image<img_type, fn_type>&& img)
+{
+    if (this != &img) {
+        delete [] img_data_;
+        this->img_data_ = img.img_data_;
+        this->width_ = img.width_;
+        this->height_ = img.height_;
+        this->read_function_ = img.read_function_;
+        this->write_function_ = img.write_function_;
+
+        img.img_data_ = NULL;
+        img.width_ = 0;
+        img.height_ = 0;
+    }
+    return *this;
+}
+
 // Image destructor.
 template<typename img_type, typename fn_type>
 Image<img_type, fn_type>::~Image()
@@ -175,7 +231,7 @@ void Image<img_type, fn_type>::CopyImageDataFrom(const Image<img_type, fn_type>&
 
 // RawImage constructor.
 template<typename img_type>
-RawImage<img_type>::RawImage(size_t num, size_t width, size_t height, bool allocate_mem, img_type** img_data) : num_(num), Image<img_type*, std::function<void(img_type**, size_t, char*)>>(width, height, [](img_type** img_data, size_t n, char* path)->void {}, [](img_type** img_data, size_t n, char* path)->void {}, false)
+RawImage<img_type>::RawImage(size_t num, size_t width, size_t height, bool allocate_mem, img_type** img_data, int storage) : num_(num), stride_(width), plane_stride_(width * height), storage_(storage), block_(NULL), block_bytes_(0), Image<img_type*, std::function<void(img_type**, size_t, char*)>>(width, height, [](img_type** img_data, size_t n, char* path)->void {}, [](img_type** img_data, size_t n, char* path)->void {}, false)
 {
     if (allocate_mem) {
         AllocateImgData();
@@ -188,7 +244,7 @@ RawImage<img_type>::RawImage(size_t num, size_t width, size_t height, bool alloc
 
 // RawImage constructor.
 template<typename img_type>
-RawImage<img_type>::RawImage(size_t num, size_t width, size_t height, const std::function<void(img_type**, size_t, char*)>& read_function, const std::function<void(img_type**, size_t, char*)>& write_function, bool allocate_mem, img_type** img_data) : num_(num), Image<img_type*, std::function<void(img_type**, size_t, char*)>>(width, height, read_function, write_function, false)
+RawImage<img_type>::RawImage(size_t num, size_t width, size_t height, const std::function<void(img_type**, size_t, char*)>& read_function, const std::function<void(img_type**, size_t, char*)>& write_function, bool allocate_mem, img_type** img_data, int storage) : num_(num), stride_(width), plane_stride_(width * height), storage_(storage), block_(NULL), block_bytes_(0), Image<img_type*, std::function<void(img_type**, size_t, char*)>>(width, height, read_function, write_function, false)
 {
     if (allocate_mem) {
         AllocateImgData();
@@ -199,7 +255,7 @@ RawImage<img_type>::RawImage(size_t num, size_t width, size_t height, const std:
 
 // RawImage copy constructor.
 template<typename img_type>
-RawImage<img_type>::RawImage(const RawImage<img_type>& img) : num_(img.num_), Image<img_type*, std::function<void(img_type**, size_t, char*)>>(img.width_, img.height_, [](img_type** img_data, size_t n, char* path)->void {}, [](img_type** img_data, size_t n, char* path)->void {}, false)
+RawImage<img_type>::RawImage(const RawImage<img_type>& img) : num_(img.num_), stride_(img.width_), plane_stride_(img.width_ * img.height_), storage_(img.storage_), block_(NULL), block_bytes_(0), Image<img_type*, std::function<void(img_type**, size_t, char*)>>(img.width_, img.height_, [](img_type** img_data, size_t n, char* path)->void {}, [](img_type** img_data, size_t n, char* path)->void {}, false)
 {
     AllocateImgData();
     CopyImageDataFrom(img);
@@ -210,25 +266,46 @@ template<typename img_type>
 RawImage<img_type>& RawImage<img_type>::operator=(const RawImage<img_type>& img)
 {
     if (this != &img) {
-        this->~RawImage();
+        ReleaseImgData();
+        this->num_ = img.num_;
         this->width_ = img.width_;
         this->height_ = img.height_;
+        this->storage_ = img.storage_;
         this->read_function_ = img.read_function_;
         this->write_function_ = img.write_function_;
 
+        AllocateImgData();
         CopyImageDataFrom(img); // Copy image data.
     }
     return *this;
 }
+
+// RawImage move constructor.
+template<typename img_type>
+RawImage<img_type>::RawImage(RawImage<img_type>&& img) : num_(0), stride_(0), plane_stride_(0), storage_(img.storage_), block_(NULL), block_bytes_(0), Image<img_type*, std::function<void(img_type**, size_t, char*)>>(0, 0, img.read_function_, img.write_function_, false)
+{
+    TakeImgDataFrom(img);
+}
+
+// RawImage move assignment operator.
+template<typename img_type>
+RawImage<img_type>& RawImage<img_type>::operator=(RawImage<img_type>&& img)
+{
+    if (this != &img) {
+        ReleaseImgData();
+        this->read_function_ = img.read_function_;
+        this->write_function_ = img.write_function_;
+
+        TakeImgDataFrom(img);
+    }
+    return *this;
+}
                            #include <iostream>
 // RawImage destructor.
 template<typename img_type>
 RawImage<img_type>::~RawImage()
 {
-    for (size_t n = 0; n < num_; ++n) {
-        delete [] img_data_[n];
-    }
-    // NOTE: delete [] img_data_ is called by the Image destructor, and is therefore not needed here.
+    ReleaseImgData();
 }
 
 // RawImage read data function.
@@ -262,14 +339,9 @@ void RawImage<img_type>::WriteData(char* path, size_t n)
 template<typename img_type>
 RawImage<img_type>& RawImage<img_type>::operator-=(const Image<img_type>& amb_img)
 {
-    const size_t img_size = this->width_ * this->height_;
     for (size_t n = 0; n < this->num_; ++n) {
-        for (size_t i = 0; i < img_size; ++i) { // use min() to use the smallest image instead
-            if (this->img_data_[n][i] > amb_img.img_data_[i]) {
-                this->img_data_[n][i] -= amb_img.img_data_[i];
-            } else {
-                this->img_data_[n][i] = 0;
-            }
+        for (size_t y = 0; y < this->height_; ++y) { // use min() to use the smallest image instead
+            SubtractClamped(&this->img_data_[n][y * stride_], &amb_img.img_data_[y * this->width_], this->width_);
         }
     }
     return *this;
@@ -277,14 +349,11 @@ RawImage<img_type>& RawImage<img_type>::operator-=(const Image<img_type>& amb_im
 template<typename img_type>
 RawImage<img_type>& RawImage<img_type>::operator-=(const std::vector<unsigned short>& sub_img)
 {
-    const size_t img_size = this->width_ * this->height_;
+    const size_t img_size = std::min(sub_img.size(), this->width_ * this->height_);
     for (size_t n = 0; n < this->num_; ++n) {
-        for (size_t i = 0; i < sub_img.size(); ++i) { // use min() to use the smallest image instead
-            if (this->img_data_[n][i] > sub_img[i]) {
-                this->img_data_[n][i] -= (float)sub_img[i];
-            } else {
-                this->img_data_[n][i] = 0;
-            }
+        for (size_t y = 0; y * this->width_ < img_size; ++y) { // sub_img is packed (stride == width)
+            const size_t count = std::min(this->width_, img_size - (y * this->width_));
+            SubtractClamped(&this->img_data_[n][y * stride_], &sub_img[y * this->width_], count);
         }
     }
     return *this;
@@ -292,14 +361,10 @@ RawImage<img_type>& RawImage<img_type>::operator-=(const std::vector<unsigned sh
 template<typename img_type>
 RawImage<img_type>& RawImage<img_type>::operator/(FlatFieldImage& flat_img)
 {
-    const size_t img_size = this->width_ * this->height_;
     for (size_t n = 0; n < this->num_; ++n) {
-        for (size_t i = 0; i < img_size; ++i) {
-            if (flat_img.filterData(n)[i] == 0) {
-                this->img_data_[n][i] = 0;
-            } else {
-                this->img_data_[n][i] /= flat_img.filterData(n)[i];
-            }
+        const float* flat_plane = flat_img.filterData(n);
+        for (size_t y = 0; y < this->height_; ++y) {
+            DivideGuarded(&this->img_data_[n][y * stride_], &flat_plane[y * flat_img.stride()], this->width_);
         }
     }
     return *this;
@@ -308,24 +373,103 @@ RawImage<img_type>& RawImage<img_type>::operator/(FlatFieldImage& flat_img)
 
 
 // RawImage helper functon to allocate image data array.
+// All planes share one aligned block; img_data_[n] points at the start of plane n inside it.
 template<typename img_type>
 void RawImage<img_type>::AllocateImgData()
 {
+    if (storage_ & STORAGE_PADDED_ROWS) {
+        stride_ = RoundUpToAlignment(width_ * sizeof(img_type)) / sizeof(img_type);
+    } else {
+        stride_ = width_;
+    }
+    plane_stride_ = RoundUpToAlignment(stride_ * height_ * sizeof(img_type)) / sizeof(img_type);
+    block_bytes_ = PlaneBlockSize(plane_stride_ * num_ * sizeof(img_type), storage_);
+    block_ = AllocatePlaneMemory(block_bytes_, storage_);
+
     img_data_ = new img_type*[num_];
-    const size_t img_size = width_ * height_;
     for (size_t n = 0; n < num_; ++n) {
-        img_data_[n] = new img_type[img_size];
+        img_data_[n] = static_cast<img_type*>(block_) + (n * plane_stride_);
+    }
+}
+
+// RawImage helper function to free image data array.
+template<typename img_type>
+void RawImage<img_type>::ReleaseImgData()
+{
+    if (block_) {
+        FreePlaneMemory(block_, block_bytes_, storage_);
+        block_ = NULL;
+    } else if (img_data_) {
+        for (size_t n = 0; n < num_; ++n) { // planes supplied by the caller
+            delete [] img_data_[n];
+        }
+    }
+    delete [] img_data_;
+    img_data_ = NULL;
+}
+
+// RawImage helper function to take over the planes of img, leaving img empty.
+// NOTE: The current planes must already have been released.
+template<typename img_type>
+void RawImage<img_type>::TakeImgDataFrom(RawImage<img_type>& img)
+{
+    num_ = img.num_;
+    this->width_ = img.width_;
+    this->height_ = img.height_;
+    stride_ = img.stride_;
+    plane_stride_ = img.plane_stride_;
+    storage_ = img.storage_;
+    block_ = img.block_;
+    block_bytes_ = img.block_bytes_;
+    img_data_ = img.img_data_;
+
+    img.num_ = 0;
+    img.width_ = 0;
+    img.height_ = 0;
+    img.block_ = NULL;
+    img.block_bytes_ = 0;
+    img.img_data_ = NULL;
+}
+
+// RawImage helper function to drop every plane past the first num.
+// Used by the consuming conversions, which write their results into the leading planes of their input.
+// Planes in a block are moved into a block of num planes, so the memory of the dropped ones is returned.
+template<typename img_type>
+void RawImage<img_type>::TruncatePlanes(size_t num)
+{
+    if (num >= num_) {
+        return;
+    }
+    if (block_) {
+        void* old_block = block_;
+        const size_t old_block_bytes = block_bytes_;
+        img_type** old_data = img_data_;
+        num_ = num;
+        RawImage<img_type>::AllocateImgData();
+        for (size_t n = 0; n < num_; ++n) {
+            std::copy(old_data[n], old_data[n] + (stride_ * this->height_), img_data_[n]);
+        }
+        FreePlaneMemory(old_block, old_block_bytes, storage_);
+        delete [] old_data;
+        return;
+    }
+    if (img_data_) {
+        for (size_t n = num; n < num_; ++n) { // planes supplied by the caller are freed individually
+            delete [] img_data_[n];
+            img_data_[n] = NULL;
+        }
     }
+    num_ = num;
 }
 
 // RawImage helper function to copy image data array.
 template<typename img_type>
 void RawImage<img_type>::CopyImageDataFrom(const RawImage<img_type>& img)
 {
-    const size_t img_size = this->width_ * this->height_;
     for (size_t n = 0; n < this->num_; ++n) {
-        for (size_t i = 0; i < img_size; ++i) {
-            this->img_data_[n][i] = img.img_data_[n][i];
+        for (size_t y = 0; y < this->height_; ++y) {
+            const img_type* src = &img.img_data_[n][y * img.stride_];
+            std::copy(src, src + this->width_, &this->img_data_[n][y * stride_]);
         }
     }
 }
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+#include "Image.h"
+
+// ImageView: non-owning, strided view over one or more image planes.
+// A view never allocates or copies pixel data; cropping, selecting planes and decimating only adjust
+// the plane pointers, size and strides. The viewed image must outlive the view.
+//
+// Use ImageView<const T> for read-only access. Pixel (x, y) of plane n is row(n, y)[x * step()].
+
+// Rectangle of a view, in pixels (see ImageView::crop).
+struct ViewRect
+{
+    size_t x;
+    size_t y;
+    size_t width;
+    size_t height;
+};
+
+template<typename T>
+class ImageView
+{
+public:
+    static const size_t MAX_PLANES = 32;
+    typedef typename std::remove_const<T>::type value_type;
+
+    ImageView() : num_(0), width_(0), height_(0), stride_(0), step_(1) { }
+    // View of every plane of img, which must have at most MAX_PLANES planes.
+    ImageView(RawImage<value_type>& img);
+    ImageView(const RawImage<value_type>& img);
+    // View of a single plane stored at data, with a row stride of stride elements.
+    ImageView(T* data, size_t width, size_t height, size_t stride);
+    // Converts a writable view to a read-only view.
+    template<typename U>
+    ImageView(const ImageView<U>& view);
+
+    size_t num() const { return num_; }
+    size_t width() const { return width_; }
+    size_t height() const { return height_; }
+    size_t stride() const { return stride_; }   // elements between the starts of two rows
+    size_t step() const { return step_; }       // elements between two pixels of a row
+    bool empty() const { return num_ == 0 || width_ == 0 || height_ == 0; }
+    bool contiguousRows() const { return step_ == 1; }
+
+    T* plane(size_t n) const { return planes_[n]; }
+    T* row(size_t n, size_t y) const { return planes_[n] + (y * stride_); }
+    T& at(size_t n, size_t x, size_t y) const { return planes_[n][(y * stride_) + (x * step_)]; }
+
+    // Sub-rectangle of this view. The rectangle is clipped to the view; clipped, if given, receives the
+    // rectangle actually viewed, so callers that keep the rectangle can check it against the view.
+    ImageView<T> crop(size_t x, size_t y, size_t width, size_t height, ViewRect* clipped = NULL) const;
+    // count consecutive planes starting at first.
+    ImageView<T> planes(size_t first, size_t count) const;
+    // Arbitrary plane subset, in the given order.
+    ImageView<T> planes(const size_t* indices, size_t count) const;
+    // Every factor-th pixel in x and y.
+    ImageView<T> decimate(size_t factor) const;
+
+private:
+    template<typename U> friend class ImageView;
+
+    T* planes_[MAX_PLANES];
+    size_t num_;
+    size_t width_;
+    size_t height_;
+    size_t stride_;
+    size_t step_;
+};
+
+template<typename T>
+ImageView<T>::ImageView(RawImage<value_type>& img) : num_(img.num() < MAX_PLANES ? img.num() : MAX_PLANES), width_(img.width()), height_(img.height()), stride_(img.stride()), step_(1)
+{
+    assert(img.num() <= MAX_PLANES);
+    for (size_t n = 0; n < num_; ++n) {
+        planes_[n] = img.filterData(n);
+    }
+}
+
+template<typename T>
+ImageView<T>::ImageView(const RawImage<value_type>& img) : num_(img.num() < MAX_PLANES ? img.num() : MAX_PLANES), width_(img.width()), height_(img.height()), stride_(img.stride()), step_(1)
+{
+    assert(img.num() <= MAX_PLANES);
+    for (size_t n = 0; n < num_; ++n) {
+        planes_[n] = img.filterData(n);
+    }
+}
+
+template<typename T>
+ImageView<T>::ImageView(T* data, size_t width, size_t height, size_t stride) : num_(1), width_(width), height_(height), stride_(stride), step_(1)
+{
+    planes_[0] = data;
+}
+
+template<typename T>
+template<typename U>
+ImageView<T>::ImageView(const ImageView<U>& view) : num_(view.num_), width_(view.width_), height_(view.height_), stride_(view.stride_), step_(view.step_)
+{
+    for (size_t n = 0; n < num_; ++n) {
+        planes_[n] = view.planes_[n];
+    }
+}
+
+template<typename T>
+ImageView<T> ImageView<T>::crop(size_t x, size_t y, size_t width, size_t height, ViewRect* clipped) const
+{
+    ImageView<T> view(*this);
+    if (x > width_) x = width_;
+    if (y > height_) y = height_;
+    view.width_ = (x + width > width_) ? width_ - x : width;
+    view.height_ = (y + height > height_) ? height_ - y : height;
+    for (size_t n = 0; n < num_; ++n) {
+        view.planes_[n] = planes_[n] + (y * stride_) + (x * step_);
+    }
+    if (clipped) {
+        clipped->x = x;
+        clipped->y = y;
+        clipped->width = view.width_;
+        clipped->height = view.height_;
+    }
+    return view;
+}
+
+template<typename T>
+ImageView<T> ImageView<T>::planes(size_t first, size_t count) const
+{
+    ImageView<T> view(*this);
+    view.num_ = (first >= num_) ? 0 : ((first + count > num_) ? num_ - first : count);
+    for (size_t n = 0; n < view.num_; ++n) {
+        view.planes_[n] = planes_[first + n];
+    }
+    return view;
+}
+
+template<typename T>
+ImageView<T> ImageView<T>::planes(const size_t* indices, size_t count) const
+{
+    ImageView<T> view(*this);
+    view.num_ = 0;
+    for (size_t i = 0; i < count && view.num_ < MAX_PLANES; ++i) {
+        if (indices[i] < num_) {
+            view.planes_[view.num_++] = planes_[indices[i]];
+        }
+    }
+    return view;
+}
+
+template<typename T>
+ImageView<T> ImageView<T>::decimate(size_t factor) const
+{
+    ImageView<T> view(*this);
+    if (factor > 1) {
+        view.width_ = (width_ + factor - 1) / factor;
+        view.height_ = (height_ + factor - 1) / factor;
+        view.stride_ = stride_ * factor;
+        view.step_ = step_ * factor;
+    }
+    return view;
+}
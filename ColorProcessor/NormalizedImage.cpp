@@ -2,209 +2,161 @@
 #include <algorithm>
 
 #include "NormalizedImage.h"
+#include "RoiStatistics.h"
 #include <iostream>
 #include <algorithm>
+#include <utility>
 #include <opencv2/core/core.hpp>
 
 // NormalizedImage constructor.
 NormalizedImage::NormalizedImage(const RawImage<float>& input_img, int wtpt_ulx, int wtpt_uly, int wtpt_lrx, int wtpt_lry, std::vector<float> reference_white) : RawImage<float>(input_img.num_, input_img.width_, input_img.height_)
 {
-    std::vector<float> measured_values;
-    std::vector<float> area_values;
+    std::vector<RoiStatistics> wtpt_stats;
+    ComputeRoiStatistics(ImageView<const float>(input_img).crop(wtpt_ulx, wtpt_uly, wtpt_lrx - wtpt_ulx, wtpt_lry - wtpt_uly), wtpt_stats);
+    std::vector<float> measured_values(num_);
     for (auto filter_index = 0; filter_index < num_; ++filter_index) {
-        for (auto y = wtpt_uly; y < wtpt_lry; ++y) {
-            for (auto x = wtpt_ulx; x < wtpt_lrx; ++x) {
-                area_values.push_back(input_img.img_data_[filter_index][(y * width_) + x]);
-            }
-        }
-        std::nth_element(area_values.begin(), area_values.begin() + area_values.size()/2, area_values.end());
-        measured_values.push_back(area_values[area_values.size()/2]);
-    }
-    for (size_t filter_index = 0; filter_index < num_; ++filter_index) {
-        //normalize the data
-        for (size_t y = 0; y < height_; ++y) {
-            for (size_t x = 0; x < width_; ++x) {
-            //divide by the median and multiply by wtpt_value
-            img_data_[filter_index][(y * width_) + x] = input_img.img_data_[filter_index][(y * width_) + x] / (measured_values[filter_index] / reference_white[filter_index]);
-            }
-        }
+        measured_values[filter_index] = wtpt_stats[filter_index].median();
     }
+    NormalizeToWhite(input_img, reference_white, measured_values);
 }
 NormalizedImage::NormalizedImage(const RawImage<float>& input_img) : RawImage<float>(input_img.num_, input_img.width_, input_img.height_)
 {
-    for (auto filter_index = 0; filter_index < num_; ++filter_index) {
-        cv::Mat src(height_, width_, CV_32F, input_img.img_data_[filter_index]);
-        cv::Mat blurred;
-        cv::medianBlur(src, blurred, 3);
-
-        double min, max;
-        cv::Point minLoc, maxLoc;
-
-        cv::minMaxLoc(blurred, &min, &max, &minLoc, &maxLoc);
-        for (auto y = 0; y < height_; ++y) {
-            for (auto x = 0; x < width_; ++x) {
-                img_data_[filter_index][(y * width_) + x] = input_img.img_data_[filter_index][(y* width_) + x] * (1.0 / max);
-            }
-        }
-    }
+    NormalizeToMax(input_img);
+}
+NormalizedImage::NormalizedImage(RawImage<float>&& input_img) : RawImage<float>(std::move(input_img))
+{
+    NormalizeToMax(*this);
 }
 NormalizedImage::NormalizedImage(const RawImage<float>& input_img, std::vector<cv::Point2d> regtargets) : RawImage<float>(input_img.num_, input_img.width_, input_img.height_)
 {
-    for (auto filter_index = 0; filter_index < num_; ++filter_index) {
-        cv::Mat src(height_, width_, CV_32F, input_img.img_data_[filter_index]);
-        cv::Mat blurred;
-        cv::medianBlur(src, blurred, 3);
-
-        double min, max;
-        cv::Point minLoc, maxLoc;
+    NormalizeToMax(input_img);
+    RegisterPlanes(regtargets);
+}
+NormalizedImage::NormalizedImage(RawImage<float>&& input_img, std::vector<cv::Point2d> regtargets) : RawImage<float>(std::move(input_img))
+{
+    NormalizeToMax(*this);
+    RegisterPlanes(regtargets);
+}
 
-        cv::minMaxLoc(blurred, &min, &max, &minLoc, &maxLoc);
-        for (auto y = 0; y < height_; ++y) {
-            for (auto x = 0; x < width_; ++x) {
-                img_data_[filter_index][(y * width_) + x] = input_img.img_data_[filter_index][(y* width_) + x] * (1.0 / max);
-            }
-        }
-        delete input_img.img_data_[filter_index];
-    }
+// Registers every plane to the middle filter using two targets of fixed size centered on regtargets.
+void NormalizedImage::RegisterPlanes(const std::vector<cv::Point2d>& regtargets)
+{
     if (regtargets.size() != 2) {
         std::cout << "Registration only supports 2 targets.  Please construct a vector<Point2d> with 2 points." << std::endl;
         return;
     }
 
-    for (auto filter_index = 0; filter_index < num_; ++filter_index) {
-        cv::Mat source(height_, width_, CV_32F, img_data_[filter_index]);
-        cv::Mat target(height_, width_, CV_32F, img_data_[num_/2]);      // Target filter is num_/2 for now, most likely want to change this to the filter with the most information content
-
-        int reg_size = 50;
-
-        cv::Mat reg0_source, reg0_target, reg1_source, reg1_target;
-
-        reg0_source = source(cv::Range(regtargets[0].y - (reg_size/2), regtargets[0].y + (reg_size/2)), cv::Range(regtargets[0].x - (reg_size/2), regtargets[0].x + (reg_size/2)));
-        reg0_target = target(cv::Range(regtargets[0].y - (reg_size/2), regtargets[0].y + (reg_size/2)), cv::Range(regtargets[0].x - (reg_size/2), regtargets[0].x + (reg_size/2)));
-        reg1_source = source(cv::Range(regtargets[1].y - (reg_size/2), regtargets[1].y + (reg_size/2)), cv::Range(regtargets[1].x - (reg_size/2), regtargets[1].x + (reg_size/2)));
-        reg1_target = target(cv::Range(regtargets[1].y - (reg_size/2), regtargets[1].y + (reg_size/2)), cv::Range(regtargets[1].x - (reg_size/2), regtargets[1].x + (reg_size/2)));
-
-        cv::Point2d offset_center = cv::phaseCorrelate(reg0_source, reg0_target);
-        cv::Point2d offset_corner = cv::phaseCorrelate(reg1_source, reg1_target);
-
-        float r, r_prime, deltaX, deltaY;
+    int reg_size = 50;
+    const size_t target_filter = num_/2;      // Target filter is num_/2 for now, most likely want to change this to the filter with the most information content
 
-        deltaX = offset_corner.x - offset_center.x;
-        deltaY = offset_corner.y - offset_center.y;
+    ImageView<float> planes(*this);
+    RegistrationEngine registration(REG_PREPROCESS_NONE);
+    registration.setReference(planes.planes(target_filter, 1),
+                              cv::Rect(regtargets[0].x - (reg_size/2), regtargets[0].y - (reg_size/2), reg_size, reg_size),
+                              cv::Rect(regtargets[1].x - (reg_size/2), regtargets[1].y - (reg_size/2), reg_size, reg_size));
+    if (!registration.ready()) {
+        return;
+    }
 
-        r = pow((regtargets[1].x - regtargets[0].x), 2) + pow((regtargets[1].y - regtargets[0].y), 2);
-        r = sqrt(r);
+    cv::Mat registered;
+    for (auto filter_index = 0; filter_index < num_; ++filter_index) {
+        if (filter_index == target_filter) {
+            continue;
+        }
+        cv::Mat source = PlaneMat(planes, filter_index);
+        ImageView<const float> plane = planes.planes(filter_index, 1);
 
-        r_prime = pow((regtargets[1].x - regtargets[0].x + deltaX), 2) + pow((regtargets[1].y - regtargets[0].y + deltaY), 2);
-        r_prime = sqrt(r_prime);
+        // One resample per plane with the composed scale + translation
+        registration.apply(source, registered, registration.estimate(plane));
+        registered.copyTo(source);
+    }
+}
 
-        float scale = r_prime / r;
-        float trans_x = (source.size().width  / 2) * (1-scale);
-        float trans_y = (source.size().height / 2) * (1-scale);
+NormalizedImage::NormalizedImage(const RawImage<float>& input_img, std::vector<float> wtpt_values, std::vector<float> measured_white) : RawImage<float>(input_img.num_, input_img.width_, input_img.height_)
+{
+    NormalizeToWhite(input_img, wtpt_values, measured_white);
+}
+NormalizedImage::NormalizedImage(RawImage<float>&& input_img, std::vector<float> wtpt_values, std::vector<float> measured_white) : RawImage<float>(std::move(input_img))
+{
+    NormalizeToWhite(*this, wtpt_values, measured_white);
+}
+NormalizedImage::NormalizedImage(const RawImage<float>& input_img, std::vector<float> wtpt_values, std::vector<float> measured_white, std::vector<QRect> regtargets) : RawImage<float>(input_img.num_, input_img.width_, input_img.height_)
+{
+    NormalizeToWhite(input_img, wtpt_values, measured_white);
+    std::cout << "Normalization complete" << std::endl;
+    RegisterPlanes(regtargets);
+}
+NormalizedImage::NormalizedImage(RawImage<float>&& input_img, std::vector<float> wtpt_values, std::vector<float> measured_white, std::vector<QRect> regtargets) : RawImage<float>(std::move(input_img))
+{
+    NormalizeToWhite(*this, wtpt_values, measured_white);
+    std::cout << "Normalization complete" << std::endl;
+    RegisterPlanes(regtargets);
+}
 
-        std::vector<float> matrix_data(6);
-        matrix_data[0] = scale;
-        matrix_data[1] = 0;
-        matrix_data[2] = trans_x;
-        matrix_data[3] = 0;
-        matrix_data[4] = scale;
-        matrix_data[5] = trans_y;
+// Registers every plane to the middle filter using the two user-selected target rectangles.
+void NormalizedImage::RegisterPlanes(const std::vector<QRect>& regtargets)
+{
+    if (regtargets.size() != 2) {
+        std::cout << "Registration only supports 2 targets.  Please construct a vector<Point2d> with 2 points." << std::endl;
+        return;
+    }
 
-        cv::Mat affine(2, 3, CV_32F, matrix_data.data());
-        cv::Mat scaled;
-        cv::warpAffine(source, scaled, affine, source.size());
+    const size_t target_filter = num_/2;      // Target filter is num_/2 for now, most likely want to change this to the filter with the most information content
 
-        cv::Mat scaled_target = scaled(cv::Range(regtargets[0].y - (reg_size/2), regtargets[0].y + (reg_size/2)), cv::Range(regtargets[0].x - (reg_size/2), regtargets[0].x + (reg_size/2)));
-        cv::Point2d translation_offset = cv::phaseCorrelate(scaled_target, reg0_target);
+    ImageView<float> planes(*this);
+    RegistrationEngine registration(REG_PREPROCESS_NONE);
+    registration.setReference(planes.planes(target_filter, 1),
+                              cv::Rect(regtargets[0].x(), regtargets[0].y(), regtargets[0].width(), regtargets[0].height()),
+                              cv::Rect(regtargets[1].x(), regtargets[1].y(), regtargets[1].width(), regtargets[1].height()));
+    if (!registration.ready()) {
+        return;
+    }
 
-        matrix_data[2] += translation_offset.x;
-        matrix_data[5] += translation_offset.y;
+    cv::Mat registered;
+    for (auto filter_index = 0; filter_index < num_; ++filter_index) {
+        if (filter_index == target_filter) {
+            continue;
+        }
+        cv::Mat source = PlaneMat(planes, filter_index);
+        ImageView<const float> plane = planes.planes(filter_index, 1);
 
-        cv::warpAffine(source, source, affine, source.size());
+        // One resample per plane with the composed scale + translation
+        registration.apply(source, registered, registration.estimate(plane));
+        registered.copyTo(source);
     }
 }
 
-NormalizedImage::NormalizedImage(const RawImage<float>& input_img, std::vector<float> wtpt_values, std::vector<float> measured_white) : RawImage<float>(input_img.num_, input_img.width_, input_img.height_)
+// Writes input_img divided by (measured_white / wtpt_values) for each filter. input_img may be *this.
+void NormalizedImage::NormalizeToWhite(const RawImage<float>& input_img, const std::vector<float>& wtpt_values, const std::vector<float>& measured_white)
 {
     for (size_t filter_index = 0; filter_index < num_; ++filter_index) {
         //normalize the data
         for (size_t y = 0; y < height_; ++y) {
             for (size_t x = 0; x < width_; ++x) {
             //divide by the median and multiply by wtpt_value
-            img_data_[filter_index][(y * width_) + x] = input_img.img_data_[filter_index][(y * width_) + x] / (measured_white[filter_index] / wtpt_values[filter_index]);
+            img_data_[filter_index][(y * stride_) + x] = input_img.img_data_[filter_index][(y * input_img.stride_) + x] / (measured_white[filter_index] / wtpt_values[filter_index]);
             }
         }
     }
 }
-NormalizedImage::NormalizedImage(const RawImage<float>& input_img, std::vector<float> wtpt_values, std::vector<float> measured_white, std::vector<QRect> regtargets) : RawImage<float>(input_img.num_, input_img.width_, input_img.height_)
-{
-    for (size_t filter_index = 0; filter_index < num_; ++filter_index) {
-        //normalize the data
-        for (size_t y = 0; y < height_; ++y) {
-            for (size_t x = 0; x < width_; ++x) {
-            //divide by the median and multiply by wtpt_value
-            img_data_[filter_index][(y * width_) + x] = input_img.img_data_[filter_index][(y * width_) + x] / (measured_white[filter_index] / wtpt_values[filter_index]);
-            }
-        }
-    }
-    std::cout << "Normalization complete" << std::endl;
-
-    if (regtargets.size() != 2) {
-        std::cout << "Registration only supports 2 targets.  Please construct a vector<Point2d> with 2 points." << std::endl;
-        return;
-    }
 
+// Scales every filter of input_img so that its (median filtered) maximum becomes 1. input_img may be *this.
+void NormalizedImage::NormalizeToMax(const RawImage<float>& input_img)
+{
     for (auto filter_index = 0; filter_index < num_; ++filter_index) {
-        cv::Mat source(height_, width_, CV_32F, img_data_[filter_index]);
-        cv::Mat target(height_, width_, CV_32F, img_data_[num_/2]);      // Target filter is num_/2 for now, most likely want to change this to the filter with the most information content
-
-        cv::Mat reg0_source, reg0_target, reg1_source, reg1_target;
-
-        reg0_source = source(cv::Range(regtargets[0].y(), regtargets[0].y() + regtargets[0].size().height()), cv::Range(regtargets[0].x(), regtargets[0].x() + regtargets[0].size().width()));
-        reg0_target = target(cv::Range(regtargets[0].y(), regtargets[0].y() + regtargets[0].size().height()), cv::Range(regtargets[0].x(), regtargets[0].x() + regtargets[0].size().width()));// - (reg_size/2), regtargets[0].y + (reg_size/2)), cv::Range(regtargets[0].x - (reg_size/2), regtargets[0].x + (reg_size/2)));
-        reg1_source = source(cv::Range(regtargets[1].y(), regtargets[1].y() + regtargets[1].size().height()), cv::Range(regtargets[1].x(), regtargets[1].x() + regtargets[1].size().width()));// - (reg_size/2), regtargets[1].y + (reg_size/2)), cv::Range(regtargets[1].x - (reg_size/2), regtargets[1].x + (reg_size/2)));
-        reg1_target = target(cv::Range(regtargets[1].y(), regtargets[1].y() + regtargets[1].size().height()), cv::Range(regtargets[1].x(), regtargets[1].x() + regtargets[1].size().width()));// - (reg_size/2), regtargets[1].y + (reg_size/2)), cv::Range(regtargets[1].x - (reg_size/2), regtargets[1].x + (reg_size/2)));
-
-
-        cv::Point2d offset_center = cv::phaseCorrelate(reg0_source, reg0_target);
-        cv::Point2d offset_corner = cv::phaseCorrelate(reg1_source, reg1_target);
-
-        float r, r_prime, deltaX, deltaY;
-
-        deltaX = offset_corner.x - offset_center.x;
-        deltaY = offset_corner.y - offset_center.y;
-
-        r = pow((regtargets[1].center().x() - regtargets[0].center().x()), 2) + pow((regtargets[1].center().y() - regtargets[0].center().y()), 2);
-        r = sqrt(r);
-
-        r_prime = pow((regtargets[1].center().x() - regtargets[0].center().x() + deltaX), 2) + pow((regtargets[1].center().y() - regtargets[0].center().y() + deltaY), 2);
-        r_prime = sqrt(r_prime);
-
-
-        float scale = r_prime / r;
-        float trans_x = (source.size().width  / 2) * (1-scale);
-        float trans_y = (source.size().height / 2) * (1-scale);
-
-        std::vector<float> matrix_data(6);
-        matrix_data[0] = scale;
-        matrix_data[1] = 0;
-        matrix_data[2] = trans_x;
-        matrix_data[3] = 0;
-        matrix_data[4] = scale;
-        matrix_data[5] = trans_y;
-
-        cv::Mat affine(2, 3, CV_32F, matrix_data.data());
-        cv::Mat scaled;
-        cv::warpAffine(source, scaled, affine, source.size());
-
-        cv::Mat scaled_target = scaled(cv::Range(regtargets[0].y(), regtargets[0].y() + regtargets[0].size().height()), cv::Range(regtargets[0].x(), regtargets[0].x() + regtargets[0].size().width()));
-        cv::Point2d translation_offset = cv::phaseCorrelate(scaled_target, reg0_target);
-
+        cv::Mat src(height_, width_, CV_32F, input_img.img_data_[filter_index], input_img.stride_ * sizeof(float));
+        cv::Mat blurred;
+        cv::medianBlur(src, blurred, 3);
 
-        matrix_data[2] += translation_offset.x;
-        matrix_data[5] += translation_offset.y;
+        double min, max;
+        cv::Point minLoc, maxLoc;
 
-        cv::warpAffine(source, source, affine, source.size());
+        cv::minMaxLoc(blurred, &min, &max, &minLoc, &maxLoc);
+        for (auto y = 0; y < height_; ++y) {
+            for (auto x = 0; x < width_; ++x) {
+                img_data_[filter_index][(y * stride_) + x] = input_img.img_data_[filter_index][(y* input_img.stride_) + x] * (1.0 / max);
+            }
+        }
     }
 }
 
@@ -222,6 +174,19 @@ NormalizedImage& NormalizedImage::operator=(const NormalizedImage& img)
     return *this;
 }
 
+// NormalizedImage move constructor.
+NormalizedImage::NormalizedImage(NormalizedImage&& img) : RawImage<float>(std::move(img))
+{ }
+
+// NormalizedImage move assignment operator.
+NormalizedImage& NormalizedImage::operator=(NormalizedImage&& img)
+{
+    if (this != &img) {
+        RawImage::operator=(std::move(img));
+    }
+    return *this;
+}
+
 // NormalizedImage destructor.
 // NOTE: the base class's (RawImage) destructor is automatically called,
 // so there is no need to call it again in this destructor.
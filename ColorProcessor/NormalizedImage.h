@@ -2,6 +2,7 @@
 
 #include "image.h"
 #include "ConversionFunctions.h"
+#include "RegistrationEngine.h"
 #include <vector>
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -20,8 +21,21 @@ public:
     NormalizedImage(const RawImage<float>& input_img, std::vector<float> wtpt_values, std::vector<float> measured_white, std::vector<QRect> regtargets);
     NormalizedImage(const RawImage<float>& input_img);
     NormalizedImage(const RawImage<float>& input_img, std::vector<cv::Point2d> regtargets);
+    // Consuming constructors: normalize input_img in place and take over its planes, input_img is left empty.
+    NormalizedImage(RawImage<float>&& input_img, std::vector<float> wtpt_values, std::vector<float> measured_white);
+    NormalizedImage(RawImage<float>&& input_img, std::vector<float> wtpt_values, std::vector<float> measured_white, std::vector<QRect> regtargets);
+    NormalizedImage(RawImage<float>&& input_img);
+    NormalizedImage(RawImage<float>&& input_img, std::vector<cv::Point2d> regtargets);
     // Rule of 3 (Copy Constructor, Copy Assignment Operator, and Destructor):
     NormalizedImage(const NormalizedImage& img);
     NormalizedImage& operator=(const NormalizedImage& img);
+    NormalizedImage(NormalizedImage&& img);
+    NormalizedImage& operator=(NormalizedImage&& img);
     virtual ~NormalizedImage();
+
+private:
+    void NormalizeToWhite(const RawImage<float>& input_img, const std::vector<float>& wtpt_values, const std::vector<float>& measured_white);
+    void NormalizeToMax(const RawImage<float>& input_img);
+    void RegisterPlanes(const std::vector<QRect>& regtargets);
+    void RegisterPlanes(const std::vector<cv::Point2d>& regtargets);
 };
@@ -0,0 +1,180 @@
+#include "OutputTransform.h"
+#include "PixelKernels.h"
+
+#include <cmath>
+
+// Rows per thread below which Apply stays on the calling thread.
+static const size_t MIN_ROWS_PER_THREAD = 64;
+
+static const cv::Vec3d WHITE_D50(0.96422, 1.0, 0.82521);
+static const cv::Vec3d WHITE_D65(0.95047, 1.0, 1.08883);
+
+// Chromaticities (x, y) of the red, green and blue primaries.
+static const double PRIMARIES_SRGB[3][2] = { { 0.64, 0.33 }, { 0.30, 0.60 }, { 0.15, 0.06 } };
+static const double PRIMARIES_ADOBE_RGB[3][2] = { { 0.64, 0.33 }, { 0.21, 0.71 }, { 0.15, 0.06 } };
+static const double PRIMARIES_PROPHOTO_RGB[3][2] = { { 0.7347, 0.2653 }, { 0.1596, 0.8404 }, { 0.0366, 0.0001 } };
+
+static const cv::Matx33d BRADFORD(0.8951, 0.2664, -0.1614,
+                                  -0.7502, 1.7135, 0.0367,
+                                  0.0389, -0.0685, 1.0296);
+
+// Linear RGB to XYZ for the given primaries, scaled so that RGB (1, 1, 1) is white.
+static cv::Matx33d RgbToXyz(const double primaries[3][2], const cv::Vec3d& white)
+{
+    cv::Matx33d m;
+    for (int c = 0; c < 3; ++c) {
+        const double x = primaries[c][0], y = primaries[c][1];
+        m(0, c) = x / y;
+        m(1, c) = 1;
+        m(2, c) = (1 - x - y) / y;
+    }
+    const cv::Vec3d scale = m.inv() * white;
+    for (int c = 0; c < 3; ++c) {
+        for (int r = 0; r < 3; ++r) {
+            m(r, c) *= scale[c];
+        }
+    }
+    return m;
+}
+
+// Bradford chromatic adaptation of XYZ from white from to white to.
+static cv::Matx33d Adaptation(const cv::Vec3d& from, const cv::Vec3d& to)
+{
+    const cv::Vec3d cone_from = BRADFORD * from;
+    const cv::Vec3d cone_to = BRADFORD * to;
+    const cv::Matx33d gain = cv::Matx33d::diag(cv::Vec3d(cone_to[0] / cone_from[0], cone_to[1] / cone_from[1], cone_to[2] / cone_from[2]));
+    return BRADFORD.inv() * gain * BRADFORD;
+}
+
+OutputTransform::OutputTransform(int space, const cv::Vec3d& source_white) : space_(space), curve_(CURVE_LUT_SIZE)
+{
+    const double (*primaries)[2] = PRIMARIES_SRGB;
+    cv::Vec3d white = WHITE_D65;
+    if (space_ == OUTPUT_ADOBE_RGB) {
+        primaries = PRIMARIES_ADOBE_RGB;
+    } else if (space_ == OUTPUT_PROPHOTO_RGB) {
+        primaries = PRIMARIES_PROPHOTO_RGB;
+        white = WHITE_D50;
+    }
+    matrix_ = RgbToXyz(primaries, white).inv() * Adaptation(source_white, white) * cv::Matx33d::diag(source_white);
+    for (int k = 0; k < 9; ++k) {
+        matrix_f_[k] = (float)matrix_.val[k];
+    }
+    BuildCurveLut(curve_.data(), [space](double linear) { return Encode(space, linear); });
+}
+
+double OutputTransform::Encode(int space, double linear)
+{
+    switch (space) {
+    case OUTPUT_SRGB:
+        return (linear <= 0.0031308) ? linear * 12.92 : (1.055 * std::pow(linear, 1 / 2.4)) - 0.055;
+    case OUTPUT_ADOBE_RGB:
+        return std::pow(linear, 256.0 / 563.0);
+    case OUTPUT_PROPHOTO_RGB:
+        return (linear < 1.0 / 512) ? linear * 16 : std::pow(linear, 1 / 1.8);
+    case OUTPUT_PREVIEW_GAMMA_18:
+        return std::pow(linear, 1 / 1.8);
+    default:
+        return linear;
+    }
+}
+
+void OutputTransform::EncodeRow(float* const* rgb, const float* const* xyz, size_t n) const
+{
+    EncodeRgb(rgb, xyz, matrix_f_, curve_.data(), n);
+}
+
+static inline void StoreRow(float* dst, size_t step, const float* src, size_t n)
+{
+    for (size_t x = 0; x < n; ++x) {
+        dst[x * step] = src[x];
+    }
+}
+
+// Encoded values are within [0, 1], so adding a half and truncating rounds to nearest.
+static inline void StoreRow(unsigned short* dst, size_t step, const float* src, size_t n)
+{
+    for (size_t x = 0; x < n; ++x) {
+        dst[x * step] = (unsigned short)((src[x] * 65535.0f) + 0.5f);
+    }
+}
+
+static inline void StoreRow(unsigned char* dst, size_t step, const float* src, size_t n)
+{
+    for (size_t x = 0; x < n; ++x) {
+        dst[x * step] = (unsigned char)((src[x] * 255.0f) + 0.5f);
+    }
+}
+
+static inline void StoreInterleaved(unsigned char* dst, size_t channels, const float* const* src, size_t n)
+{
+    for (size_t x = 0; x < n; ++x) {
+        unsigned char* pixel = dst + (x * channels);
+        pixel[0] = (unsigned char)((src[0][x] * 255.0f) + 0.5f);
+        pixel[1] = (unsigned char)((src[1][x] * 255.0f) + 0.5f);
+        pixel[2] = (unsigned char)((src[2][x] * 255.0f) + 0.5f);
+        if (channels == 4) {
+            pixel[3] = 255;
+        }
+    }
+}
+
+template<typename Store>
+void OutputTransform::EncodeRows(const ImageView<const float>& xyz, const Store& store) const
+{
+    const size_t width = xyz.width();
+    ParallelRows(xyz.height(), MIN_ROWS_PER_THREAD, [&](size_t first, size_t last) {
+        // Decimated views are gathered into contiguous rows for the kernel, which writes into scratch rows
+        std::vector<float> gathered(xyz.contiguousRows() ? 0 : 3 * width);
+        std::vector<float> encoded(3 * width);
+        const float* src[3];
+        float* dst[3] = { &encoded[0], &encoded[width], &encoded[2 * width] };
+        for (size_t y = first; y < last; ++y) {
+            for (size_t xyz_index = 0; xyz_index < 3; ++xyz_index) {
+                const float* row = xyz.row(xyz_index, y);
+                if (!xyz.contiguousRows()) {
+                    float* packed = &gathered[xyz_index * width];
+                    for (size_t x = 0; x < width; ++x) {
+                        packed[x] = row[x * xyz.step()];
+                    }
+                    row = packed;
+                }
+                src[xyz_index] = row;
+            }
+            EncodeRow(dst, src, width);
+            store(y, dst);
+        }
+    });
+}
+
+template<typename T>
+void OutputTransform::ApplyRows(const ImageView<const float>& xyz, const ImageView<T>& rgb) const
+{
+    EncodeRows(xyz, [&](size_t y, const float* const* encoded) {
+        for (size_t rgb_index = 0; rgb_index < 3; ++rgb_index) {
+            StoreRow(rgb.row(rgb_index, y), rgb.step(), encoded[rgb_index], xyz.width());
+        }
+    });
+}
+
+void OutputTransform::Apply(const ImageView<const float>& xyz, const ImageView<float>& rgb) const
+{
+    ApplyRows(xyz, rgb);
+}
+
+void OutputTransform::Apply(const ImageView<const float>& xyz, const ImageView<unsigned short>& rgb) const
+{
+    ApplyRows(xyz, rgb);
+}
+
+void OutputTransform::Apply(const ImageView<const float>& xyz, const ImageView<unsigned char>& rgb) const
+{
+    ApplyRows(xyz, rgb);
+}
+
+void OutputTransform::Render(const ImageView<const float>& xyz, unsigned char* dst, size_t bytes_per_line, size_t channels) const
+{
+    EncodeRows(xyz, [&](size_t y, const float* const* encoded) {
+        StoreInterleaved(dst + (y * bytes_per_line), channels, encoded, xyz.width());
+    });
+}
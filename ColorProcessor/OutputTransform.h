@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "ImageView.h"
+#include <opencv2/core/core.hpp>
+
+// OutputTransform: white point normalized XYZ to an encoded RGB output space.
+//
+// The XYZ planes hold 1 in every channel for the capture white, so the matrix first scales them by the source
+// white (D50 unless given), adapts that white to the white of the target space (Bradford) and converts to the
+// target's linear RGB: one 3x3 matrix built once per transform. The transfer curve is tabulated once as well
+// (see BuildCurveLut), so encoding a pixel is nine multiply-adds, a clamp and a table lookup per channel.
+// Values outside [0, 1] after the matrix, negative ones included, are clipped before the curve.
+
+enum OutputColorSpace {
+    OUTPUT_SRGB = 0,        // IEC 61966-2-1: D65, sRGB curve
+    OUTPUT_ADOBE_RGB,       // Adobe RGB (1998): D65, gamma 563/256
+    OUTPUT_PROPHOTO_RGB,    // ROMM RGB: D50, gamma 1.8 with a linear segment below 1/512
+    OUTPUT_LINEAR_SRGB,     // sRGB primaries and white, no curve
+    OUTPUT_PREVIEW_GAMMA_18 // sRGB primaries and white, plain 1.8 gamma: the legacy preview curve, and the default
+};
+
+class OutputTransform
+{
+public:
+    explicit OutputTransform(int space = OUTPUT_PREVIEW_GAMMA_18, const cv::Vec3d& source_white = cv::Vec3d(0.96422, 1.0, 0.82521));
+
+    int space() const { return space_; }
+    // Normalized XYZ to linear RGB of the target space.
+    const cv::Matx33d& matrix() const { return matrix_; }
+    // Transfer curve of the target space, linear [0, 1] to encoded [0, 1], evaluated exactly.
+    static double Encode(int space, double linear);
+
+    // One row of X, Y and Z into encoded R, G and B in [0, 1]. rgb[c] may be xyz[c].
+    void EncodeRow(float* const* rgb, const float* const* xyz, size_t n) const;
+
+    // First three planes of xyz into the three planes of rgb (same size), rounded to the output type:
+    // [0, 1] for float, 0..255 or 0..65535 otherwise.
+    void Apply(const ImageView<const float>& xyz, const ImageView<float>& rgb) const;
+    void Apply(const ImageView<const float>& xyz, const ImageView<unsigned short>& rgb) const;
+    void Apply(const ImageView<const float>& xyz, const ImageView<unsigned char>& rgb) const;
+    // Interleaved 8-bit output, e.g. QImage scanlines: pixel (x, y) is at dst + y * bytes_per_line + x * channels,
+    // R, G, B first. channels is 3 (RGB888) or 4 (RGBX8888, the fourth byte set to 255). Padding at the end of a
+    // line is left alone.
+    void Render(const ImageView<const float>& xyz, unsigned char* dst, size_t bytes_per_line, size_t channels) const;
+
+private:
+    template<typename T>
+    void ApplyRows(const ImageView<const float>& xyz, const ImageView<T>& rgb) const;
+    // Encodes xyz row by row, one band of rows per thread, and hands each row to store(y, rgb).
+    template<typename Store>
+    void EncodeRows(const ImageView<const float>& xyz, const Store& store) const;
+
+    int space_;
+    cv::Matx33d matrix_;
+    float matrix_f_[9];
+    std::vector<float> curve_;
+};
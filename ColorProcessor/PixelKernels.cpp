@@ -0,0 +1,1976 @@
+#include "PixelKernels.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PIXELKERNELS_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// GCC and Clang only emit instructions for the ISA a function is compiled for; MSVC accepts any intrinsic.
+#if defined(__GNUC__)
+#define KERNEL_TARGET(isa) __attribute__((target(isa)))
+#else
+#define KERNEL_TARGET(isa)
+#endif
+
+// GCC fuses a multiply followed by an add into an FMA whenever the target has one (any AVX-512 target, or a
+// build with -mfma), which changes the rounding. Kernels whose sums must match the scalar kernel switch it off.
+#if defined(__GNUC__) && !defined(__clang__)
+#define KERNEL_NO_CONTRACT __attribute__((optimize("fp-contract=off")))
+#else
+#define KERNEL_NO_CONTRACT
+#endif
+
+// Unrolls the band loops of the projection and blend kernels by four. MSVC has no unroll pragma and decides by itself.
+#if defined(__clang__)
+#define KERNEL_UNROLL _Pragma("unroll 4")
+#elif defined(__GNUC__)
+#define KERNEL_UNROLL _Pragma("GCC unroll 4")
+#else
+#define KERNEL_UNROLL
+#endif
+
+// ---------------------------------------------------------------------------
+// CPU feature detection
+
+#ifdef PIXELKERNELS_X86
+static void Cpuid(int leaf, int subleaf, unsigned int regs[4])
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuidex(info, leaf, subleaf);
+    for (int i = 0; i < 4; ++i) {
+        regs[i] = (unsigned int)info[i];
+    }
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static unsigned long long Xgetbv()
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+
+static KernelIsa DetectKernelIsa()
+{
+    unsigned int regs[4];
+    Cpuid(0, 0, regs);
+    const unsigned int max_leaf = regs[0];
+    if (max_leaf < 1) {
+        return ISA_SCALAR;
+    }
+    Cpuid(1, 0, regs);
+    const bool sse42 = (regs[2] & (1u << 20)) != 0;
+    const bool osxsave = (regs[2] & (1u << 27)) != 0;
+    const bool avx = (regs[2] & (1u << 28)) != 0;
+    const bool f16c = (regs[2] & (1u << 29)) != 0;
+    if (!sse42) {
+        return ISA_SCALAR;
+    }
+    if (!osxsave || !avx || max_leaf < 7) {
+        return ISA_SSE42;
+    }
+    const unsigned long long xcr0 = Xgetbv();
+    if ((xcr0 & 0x6) != 0x6) {          // XMM and YMM state enabled by the OS
+        return ISA_SSE42;
+    }
+    Cpuid(7, 0, regs);
+    const bool avx2 = (regs[1] & (1u << 5)) != 0;
+    const bool avx512f = (regs[1] & (1u << 16)) != 0;
+    const bool avx512bw = (regs[1] & (1u << 30)) != 0;
+    if (!avx2 || !f16c) {
+        return ISA_SSE42;
+    }
+    if (avx512f && avx512bw && (xcr0 & 0xE6) == 0xE6) {    // opmask and ZMM state enabled as well
+        return ISA_AVX512;
+    }
+    return ISA_AVX2;
+}
+#else
+static KernelIsa DetectKernelIsa()
+{
+    return ISA_SCALAR;
+}
+#endif
+
+static std::atomic<int> max_kernel_isa(ISA_COUNT - 1);
+
+KernelIsa ActiveKernelIsa()
+{
+    static const KernelIsa detected = DetectKernelIsa();
+    const int max_isa = max_kernel_isa.load();
+    return (detected < max_isa) ? detected : (KernelIsa)max_isa;
+}
+
+void SetMaxKernelIsa(KernelIsa isa)
+{
+    max_kernel_isa.store(isa);
+}
+
+const char* KernelIsaName(KernelIsa isa)
+{
+    switch (isa) {
+    case ISA_SSE42: return "SSE4.2";
+    case ISA_AVX2: return "AVX2";
+    case ISA_AVX512: return "AVX-512";
+    default: return "scalar";
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Half floats
+
+float HalfToFloat(unsigned short h)
+{
+    const unsigned int sign = (unsigned int)(h & 0x8000u) << 16;
+    unsigned int exponent = (h >> 10) & 0x1fu;
+    unsigned int mantissa = h & 0x3ffu;
+    unsigned int bits;
+    if (exponent == 0x1fu) {
+        bits = sign | 0x7f800000u | (mantissa << 13) | (mantissa ? 0x400000u : 0);    // NaNs come out quiet, as with F16C
+    } else if (exponent != 0) {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else if (mantissa == 0) {
+        bits = sign;
+    } else {                                // subnormal half, normal float
+        exponent = 113;
+        while (!(mantissa & 0x400u)) {
+            mantissa <<= 1;
+            --exponent;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13);
+    }
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+unsigned short FloatToHalf(float value)
+{
+    unsigned int bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const unsigned int sign = (bits >> 16) & 0x8000u;
+    const unsigned int magnitude = bits & 0x7fffffffu;
+    if (magnitude >= 0x7f800000u) {        // inf, NaN
+        return (unsigned short)(sign | 0x7c00u | ((magnitude > 0x7f800000u) ? (0x200u | ((magnitude >> 13) & 0x3ffu)) : 0));
+    }
+    if (magnitude >= 0x477ff000u) {         // rounds past 65504
+        return (unsigned short)(sign | 0x7c00u);
+    }
+    unsigned int h, rest, halfway;
+    if (magnitude < 0x38800000u) {          // below 2^-14: subnormal half or zero
+        if (magnitude < 0x33000000u) {
+            return (unsigned short)sign;
+        }
+        const unsigned int mantissa = (magnitude & 0x7fffffu) | 0x800000u;
+        const unsigned int shift = 126 - (magnitude >> 23);
+        h = mantissa >> shift;
+        rest = mantissa & ((1u << shift) - 1);
+        halfway = 1u << (shift - 1);
+    } else {
+        h = (magnitude - 0x38000000u) >> 13;
+        rest = magnitude & 0x1fffu;
+        halfway = 0x1000u;
+    }
+    if (rest > halfway || (rest == halfway && (h & 1))) {
+        ++h;
+    }
+    return (unsigned short)(sign | h);
+}
+
+// ---------------------------------------------------------------------------
+// Scalar reference kernels
+
+static void SubtractClampedU16Scalar(unsigned short* dst, const unsigned short* sub, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = (dst[i] > sub[i]) ? (unsigned short)(dst[i] - sub[i]) : 0;
+    }
+}
+
+static void SubtractClampedF32Scalar(float* dst, const float* sub, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = (dst[i] > sub[i]) ? dst[i] - sub[i] : 0.0f;
+    }
+}
+
+static void SubtractClampedF32U16Scalar(float* dst, const unsigned short* sub, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = (dst[i] > sub[i]) ? dst[i] - (float)sub[i] : 0.0f;
+    }
+}
+
+static void DivideGuardedF32Scalar(float* dst, const float* divisor, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = (divisor[i] == 0) ? 0.0f : dst[i] / divisor[i];
+    }
+}
+
+static void IngestU16Scalar(float* dst, const unsigned short* raw, const unsigned short* bias, const float* inv_flat, float gain, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        const float value = (raw[i] > bias[i]) ? (float)(raw[i] - bias[i]) : 0.0f;
+        dst[i] = (value * inv_flat[i]) * gain;
+    }
+}
+
+static void IngestU16F16Scalar(float* dst, const unsigned short* raw, const unsigned short* bias, const unsigned short* inv_flat_fp16, float gain, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        const float value = (raw[i] > bias[i]) ? (float)(raw[i] - bias[i]) : 0.0f;
+        dst[i] = (value * HalfToFloat(inv_flat_fp16[i])) * gain;
+    }
+}
+
+static void ConvertF32F16Scalar(unsigned short* dst, const float* src, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = FloatToHalf(src[i]);
+    }
+}
+
+static void ConvertF16F32Scalar(float* dst, const unsigned short* src, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = HalfToFloat(src[i]);
+    }
+}
+
+// Pixels [begin, n) of a row; the SIMD projections finish their rows here.
+// The projection and blend kernels are templates on the band (light) count: N > 0 fixes it at compile time (no
+// runtime bound, remainder of the unrolled loop known), N == 0 is the generic kernel for nsrc bands. Both compute the same sums.
+template<size_t N>
+KERNEL_NO_CONTRACT
+static void ProjectXyzF32Range(float* const* dst, const float* const* src, const float* weights, size_t nsrc, size_t begin, size_t n)
+{
+    const size_t bands = N ? N : nsrc;
+    for (size_t i = begin; i < n; ++i) {
+        float x = 0.0f, y = 0.0f, z = 0.0f;
+        KERNEL_UNROLL
+        for (size_t f = 0; f < bands; ++f) {
+            const float value = src[f][i];
+            x += value * weights[f * 3];
+            y += value * weights[f * 3 + 1];
+            z += value * weights[f * 3 + 2];
+        }
+        dst[0][i] = x;
+        dst[1][i] = y;
+        dst[2][i] = z;
+    }
+}
+
+template<size_t N>
+static void ProjectXyzF32Scalar(float* const* dst, const float* const* src, const float* weights, size_t nsrc, size_t n)
+{
+    ProjectXyzF32Range<N>(dst, src, weights, nsrc, 0, n);
+}
+
+KERNEL_NO_CONTRACT
+static void ProjectXyzSetsF32Range(float* const* dst, const float* const* src, const float* weights, size_t nsrc, size_t nsets, size_t begin, size_t n)
+{
+    const size_t stride = nsets * 3;
+    for (size_t i = begin; i < n; ++i) {
+        for (size_t set = 0; set < nsets; ++set) {
+            const float* w = weights + (set * 3);
+            float x = 0.0f, y = 0.0f, z = 0.0f;
+            for (size_t f = 0; f < nsrc; ++f) {
+                const float value = src[f][i];
+                x += value * w[f * stride];
+                y += value * w[f * stride + 1];
+                z += value * w[f * stride + 2];
+            }
+            dst[set * 3][i] = x;
+            dst[set * 3 + 1][i] = y;
+            dst[set * 3 + 2][i] = z;
+        }
+    }
+}
+
+static void ProjectXyzSetsF32Scalar(float* const* dst, const float* const* src, const float* weights, size_t nsrc, size_t nsets, size_t n)
+{
+    ProjectXyzSetsF32Range(dst, src, weights, nsrc, nsets, 0, n);
+}
+
+KERNEL_NO_CONTRACT
+static void AccumulateXyzF32Range(float* const* dst, const float* src, const float* weights, size_t begin, size_t n)
+{
+    for (size_t i = begin; i < n; ++i) {
+        const float value = src[i];
+        dst[0][i] += value * weights[0];
+        dst[1][i] += value * weights[1];
+        dst[2][i] += value * weights[2];
+    }
+}
+
+static void AccumulateXyzF32Scalar(float* const* dst, const float* src, const float* weights, size_t n)
+{
+    AccumulateXyzF32Range(dst, src, weights, 0, n);
+}
+
+template<size_t N>
+KERNEL_NO_CONTRACT
+static void BlendF32Range(float* dst, const float* const* src, const float* weights, size_t nsrc, size_t begin, size_t n)
+{
+    const size_t lights = N ? N : nsrc;
+    for (size_t i = begin; i < n; ++i) {
+        float value = 0.0f;
+        KERNEL_UNROLL
+        for (size_t l = 0; l < lights; ++l) {
+            value += src[l][i] * weights[l];
+        }
+        dst[i] = value;
+    }
+}
+
+template<size_t N>
+static void BlendF32Scalar(float* dst, const float* const* src, const float* weights, size_t nsrc, size_t n)
+{
+    BlendF32Range<N>(dst, src, weights, nsrc, 0, n);
+}
+
+// L*a*b* constants: f(t) = cbrt(t) above LAB_EPSILON, (LAB_KAPPA * t + 16) / 116 below.
+static const float LAB_EPSILON = 216.0f / 24389.0f;
+static const float LAB_KAPPA = 24389.0f / 27.0f;
+// First guess for the cube root: a third of the bit pattern plus this bias (Kahan), relative error below 3.5%.
+static const int LAB_CBRT_BIAS = 0x2a5137a0;
+
+// x must be a positive normal float. Two Halley steps y' = y * (y^3 + 2x) / (2y^3 + x) take the guess to rounding.
+KERNEL_NO_CONTRACT
+static inline float FastCbrt(float x)
+{
+    int bits;
+    memcpy(&bits, &x, sizeof(bits));
+    bits = (int)((float)bits * (1.0f / 3.0f)) + LAB_CBRT_BIAS;
+    float y;
+    memcpy(&y, &bits, sizeof(y));
+    for (int step = 0; step < 2; ++step) {
+        const float y3 = (y * y) * y;
+        y = (y * ((y3 + x) + x)) / ((y3 + y3) + x);
+    }
+    return y;
+}
+
+KERNEL_NO_CONTRACT
+static inline float LabF(float t)
+{
+    const float cube = FastCbrt((t > LAB_EPSILON) ? t : LAB_EPSILON);
+    const float linear = ((t * LAB_KAPPA) + 16.0f) * (1.0f / 116.0f);
+    return (t > LAB_EPSILON) ? cube : linear;
+}
+
+KERNEL_NO_CONTRACT
+static void XyzToLabF32Range(float* const* lab, const float* const* xyz, size_t begin, size_t n)
+{
+    for (size_t i = begin; i < n; ++i) {
+        const float fx = LabF(xyz[0][i]);
+        const float fy = LabF(xyz[1][i]);
+        const float fz = LabF(xyz[2][i]);
+        lab[0][i] = (116.0f * fy) - 16.0f;
+        lab[1][i] = 500.0f * (fx - fy);
+        lab[2][i] = 200.0f * (fy - fz);
+    }
+}
+
+static void XyzToLabF32Scalar(float* const* lab, const float* const* xyz, size_t n)
+{
+    XyzToLabF32Range(lab, xyz, 0, n);
+}
+
+static void XyzToLabF32Exact(float* const* lab, const float* const* xyz, size_t n)
+{
+    float f[3];
+    for (size_t i = 0; i < n; ++i) {
+        for (int c = 0; c < 3; ++c) {
+            const float t = xyz[c][i];
+            f[c] = (t > 216.0 / 24389.0) ? (float)std::cbrt((double)t) : (float)(((t * (24389.0 / 27.0)) + 16) / 116.0);
+        }
+        lab[0][i] = (float)((116.0 * f[1]) - 16.0);
+        lab[1][i] = (float)(500.0 * (f[0] - f[1]));
+        lab[2][i] = (float)(200.0 * (f[1] - f[2]));
+    }
+}
+
+// Curve table layout: OCTAVES * STEPS + 1 samples, the last one again so that v = 1 reads a pair, then the slope
+// below the first sample. A sample index is the float's bits above the first sample's, shifted past the mantissa
+// bits that are left (23 - log2(CURVE_LUT_STEPS)); those bits are the interpolation weight.
+static const unsigned int CURVE_LUT_MIN_BITS = (unsigned int)(127 - CURVE_LUT_OCTAVES) << 23;
+static const float CURVE_LUT_MIN = 1.0f / (float)(1 << CURVE_LUT_OCTAVES);
+static const int CURVE_LUT_FRACTION_BITS = 16;
+static const unsigned int CURVE_LUT_FRACTION_MASK = (1u << CURVE_LUT_FRACTION_BITS) - 1;
+static const float CURVE_LUT_FRACTION_SCALE = 1.0f / (float)(1 << CURVE_LUT_FRACTION_BITS);
+static const size_t CURVE_LUT_TOE = CURVE_LUT_SIZE - 1;
+
+KERNEL_NO_CONTRACT
+static inline float CurveLookup(float value, const float* curve)
+{
+    float v = (value > 0.0f) ? value : 0.0f;
+    v = (v < 1.0f) ? v : 1.0f;
+    const float x = (v > CURVE_LUT_MIN) ? v : CURVE_LUT_MIN;
+    unsigned int offset;
+    memcpy(&offset, &x, sizeof(offset));
+    offset -= CURVE_LUT_MIN_BITS;
+    const float* sample = curve + (offset >> CURVE_LUT_FRACTION_BITS);
+    const float t = (float)(int)(offset & CURVE_LUT_FRACTION_MASK) * CURVE_LUT_FRACTION_SCALE;
+    const float interpolated = sample[0] + ((sample[1] - sample[0]) * t);
+    return (v > CURVE_LUT_MIN) ? interpolated : v * curve[CURVE_LUT_TOE];
+}
+
+KERNEL_NO_CONTRACT
+static void EncodeRgbF32Range(float* const* rgb, const float* const* xyz, const float* matrix, const float* curve, size_t begin, size_t n)
+{
+    for (size_t i = begin; i < n; ++i) {
+        const float x = xyz[0][i], y = xyz[1][i], z = xyz[2][i];
+        for (int c = 0; c < 3; ++c) {
+            rgb[c][i] = CurveLookup(((matrix[c * 3] * x) + (matrix[c * 3 + 1] * y)) + (matrix[c * 3 + 2] * z), curve);
+        }
+    }
+}
+
+static void EncodeRgbF32Scalar(float* const* rgb, const float* const* xyz, const float* matrix, const float* curve, size_t n)
+{
+    EncodeRgbF32Range(rgb, xyz, matrix, curve, 0, n);
+}
+
+// Delta E constants. The trigonometric helpers use the Cephes single precision polynomials:
+// sin and cos on [-pi/4, pi/4], atan on [-tan(pi/8), tan(pi/8)].
+static const float DE_PI = 3.14159265f;
+static const float DE_DEG_TO_RAD = 3.14159265f / 180.0f;
+static const float DE_RAD_TO_DEG = 180.0f / 3.14159265f;
+static const float DE_TAN_PI_8 = 0.414213562f;
+static const float DE_POW7_25 = 6103515625.0f;      // 25^7
+static const float DE_COS_30 = 0.866025404f, DE_SIN_30 = 0.5f;
+static const float DE_COS_6 = 0.994521895f, DE_SIN_6 = 0.104528463f;
+static const float DE_COS_63 = 0.453990500f, DE_SIN_63 = 0.891006524f;
+
+KERNEL_NO_CONTRACT
+static inline float SinPoly(float r)
+{
+    const float z = r * r;
+    const float p = (((-1.9515295891e-4f * z) + 8.3321608736e-3f) * z) - 1.6666654611e-1f;
+    return ((p * z) * r) + r;
+}
+
+KERNEL_NO_CONTRACT
+static inline float CosPoly(float r)
+{
+    const float z = r * r;
+    const float p = (((2.443315711809948e-5f * z) - 1.388731625493765e-3f) * z) + 4.166664568298827e-2f;
+    return (((p * z) * z) - (0.5f * z)) + 1.0f;
+}
+
+// Sine and cosine of d degrees: d is reduced to the nearest multiple of 90 degrees, whose quadrant swaps and negates.
+KERNEL_NO_CONTRACT
+static inline void SinCosDeg(float d, float& s, float& c)
+{
+    const float k = std::floor((d * (1.0f / 90.0f)) + 0.5f);
+    const float r = (d - (k * 90.0f)) * DE_DEG_TO_RAD;
+    const float sp = SinPoly(r), cp = CosPoly(r);
+    const int q = (int)k;
+    s = (q & 1) ? cp : sp;
+    c = (q & 1) ? sp : cp;
+    s = (q & 2) ? -s : s;
+    c = ((q + 1) & 2) ? -c : c;
+}
+
+// atan2(y, x) in degrees, in [0, 360); 0 for x = y = 0.
+KERNEL_NO_CONTRACT
+static inline float Atan2Deg(float y, float x)
+{
+    const float ax = std::fabs(x), ay = std::fabs(y);
+    const float mx = (ax > ay) ? ax : ay;
+    const float mn = (ax < ay) ? ax : ay;
+    const float q = (mx > 0.0f) ? mn / mx : 0.0f;
+    // atan(q) = pi/4 + atan((q - 1) / (q + 1)) above tan(pi/8)
+    const bool big = q > DE_TAN_PI_8;
+    const float t = big ? (q - 1.0f) / (q + 1.0f) : q;
+    const float z = t * t;
+    const float p = (((((8.05374449538e-2f * z) - 1.38776856032e-1f) * z) + 1.99777106478e-1f) * z) - 3.33329491539e-1f;
+    float a = ((p * z) * t) + t;
+    a = big ? a + (DE_PI * 0.25f) : a;
+    a = (ay > ax) ? (DE_PI * 0.5f) - a : a;
+    a = (x < 0.0f) ? DE_PI - a : a;
+    a = a * DE_RAD_TO_DEG;
+    return (y < 0.0f) ? 360.0f - a : a;
+}
+
+// e^u for -87 < u <= 0, as 2^k times a degree 7 polynomial.
+KERNEL_NO_CONTRACT
+static inline float ExpNeg(float u)
+{
+    const float t = u * 1.44269504f;
+    const float k = std::floor(t + 0.5f);
+    const float f = (t - k) * 0.693147181f;
+    float p = 1.0f / 5040.0f;
+    p = (p * f) + (1.0f / 720.0f);
+    p = (p * f) + (1.0f / 120.0f);
+    p = (p * f) + (1.0f / 24.0f);
+    p = (p * f) + (1.0f / 6.0f);
+    p = (p * f) + 0.5f;
+    p = (p * f) + 1.0f;
+    p = (p * f) + 1.0f;
+    const int bits = ((int)k + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+KERNEL_NO_CONTRACT
+static inline float Pow7(float x)
+{
+    const float x2 = x * x;
+    const float x4 = x2 * x2;
+    return (x4 * x2) * x;
+}
+
+KERNEL_NO_CONTRACT
+static void DeltaE76F32Range(float* de, const float* const* lab, const float* const* ref, size_t begin, size_t n)
+{
+    for (size_t i = begin; i < n; ++i) {
+        const float dl = lab[0][i] - ref[0][i];
+        const float da = lab[1][i] - ref[1][i];
+        const float db = lab[2][i] - ref[2][i];
+        de[i] = std::sqrt(((dl * dl) + (da * da)) + (db * db));
+    }
+}
+
+KERNEL_NO_CONTRACT
+static void DeltaE94F32Range(float* de, const float* const* lab, const float* const* ref, size_t begin, size_t n)
+{
+    for (size_t i = begin; i < n; ++i) {
+        const float c1 = std::sqrt((ref[1][i] * ref[1][i]) + (ref[2][i] * ref[2][i]));
+        const float c2 = std::sqrt((lab[1][i] * lab[1][i]) + (lab[2][i] * lab[2][i]));
+        const float dl = lab[0][i] - ref[0][i];
+        const float da = lab[1][i] - ref[1][i];
+        const float db = lab[2][i] - ref[2][i];
+        const float dc = c2 - c1;
+        // dH^2 = da^2 + db^2 - dC^2, which rounding can take below 0
+        float dh2 = ((da * da) + (db * db)) - (dc * dc);
+        dh2 = (dh2 > 0.0f) ? dh2 : 0.0f;
+        const float sc = 1.0f + (0.045f * c1);
+        const float sh = 1.0f + (0.015f * c1);
+        const float dcs = dc / sc;
+        de[i] = std::sqrt(((dl * dl) + (dcs * dcs)) + (dh2 / (sh * sh)));
+    }
+}
+
+// Reference is color 1, sample color 2.
+KERNEL_NO_CONTRACT
+static inline float DeltaE2000Pixel(float l1, float a1, float b1, float l2, float a2, float b2)
+{
+    const float c1 = std::sqrt((a1 * a1) + (b1 * b1));
+    const float c2 = std::sqrt((a2 * a2) + (b2 * b2));
+    const float cm7 = Pow7((c1 + c2) * 0.5f);
+    const float g = 0.5f * (1.0f - std::sqrt(cm7 / (cm7 + DE_POW7_25)));
+    const float a1p = a1 * (1.0f + g);
+    const float a2p = a2 * (1.0f + g);
+    const float c1p = std::sqrt((a1p * a1p) + (b1 * b1));
+    const float c2p = std::sqrt((a2p * a2p) + (b2 * b2));
+    const float h1p = Atan2Deg(b1, a1p);
+    const float h2p = Atan2Deg(b2, a2p);
+    const float cprod = c1p * c2p;
+
+    // Hue difference and mean hue along the shorter arc; without a hue (zero chroma) the difference is 0
+    float dhp = h2p - h1p;
+    dhp = (dhp > 180.0f) ? dhp - 360.0f : dhp;
+    dhp = (dhp < -180.0f) ? dhp + 360.0f : dhp;
+    dhp = (cprod != 0.0f) ? dhp : 0.0f;
+    float sin_half, cos_half;
+    SinCosDeg(dhp * 0.5f, sin_half, cos_half);
+    const float dh = (2.0f * std::sqrt(cprod)) * sin_half;
+    const float hsum = h1p + h2p;
+    const float hwrap = (hsum < 360.0f) ? (hsum + 360.0f) * 0.5f : (hsum - 360.0f) * 0.5f;
+    float hm = (std::fabs(h1p - h2p) > 180.0f) ? hwrap : hsum * 0.5f;
+    hm = (cprod != 0.0f) ? hm : hsum;
+
+    // T from one sine and cosine of the mean hue with the double and triple angle formulas
+    float s, c;
+    SinCosDeg(hm, s, c);
+    const float c2h = ((2.0f * c) * c) - 1.0f;
+    const float s2h = (2.0f * s) * c;
+    const float c3h = (((4.0f * c) * c) - 3.0f) * c;
+    const float s3h = (3.0f - ((4.0f * s) * s)) * s;
+    const float c4h = ((2.0f * c2h) * c2h) - 1.0f;
+    const float s4h = (2.0f * s2h) * c2h;
+    const float t = (((1.0f - (0.17f * ((c * DE_COS_30) + (s * DE_SIN_30)))) + (0.24f * c2h)) + (0.32f * ((c3h * DE_COS_6) - (s3h * DE_SIN_6)))) - (0.20f * ((c4h * DE_COS_63) + (s4h * DE_SIN_63)));
+
+    // 30 exp(-x^2) is below 4e-6 degrees past x^2 = 16 (R_T below 3e-7) and is flushed to 0 there: the sine and
+    // cosine polynomials of 2 dtheta would otherwise underflow into denormals, which are very slow
+    const float x = (hm - 275.0f) * (1.0f / 25.0f);
+    const float x2 = x * x;
+    const float dtheta = (x2 < 16.0f) ? 30.0f * ExpNeg(-x2) : 0.0f;
+    const float cpm = (c1p + c2p) * 0.5f;
+    const float cpm7 = Pow7(cpm);
+    const float rc = 2.0f * std::sqrt(cpm7 / (cpm7 + DE_POW7_25));
+    float sin_2theta, cos_2theta;
+    SinCosDeg(2.0f * dtheta, sin_2theta, cos_2theta);
+    const float rt = -(sin_2theta * rc);
+
+    const float lm = ((l1 + l2) * 0.5f) - 50.0f;
+    const float lm2 = lm * lm;
+    const float sl = 1.0f + ((0.015f * lm2) / std::sqrt(20.0f + lm2));
+    const float sc = 1.0f + (0.045f * cpm);
+    const float sh = 1.0f + ((0.015f * cpm) * t);
+    const float dls = (l2 - l1) / sl;
+    const float dcs = (c2p - c1p) / sc;
+    const float dhs = dh / sh;
+    return std::sqrt((((dls * dls) + (dcs * dcs)) + (dhs * dhs)) + ((rt * dcs) * dhs));
+}
+
+KERNEL_NO_CONTRACT
+static void DeltaE2000F32Range(float* de, const float* const* lab, const float* const* ref, size_t begin, size_t n)
+{
+    for (size_t i = begin; i < n; ++i) {
+        de[i] = DeltaE2000Pixel(ref[0][i], ref[1][i], ref[2][i], lab[0][i], lab[1][i], lab[2][i]);
+    }
+}
+
+static void DeltaE76F32Scalar(float* de, const float* const* lab, const float* const* ref, size_t n)
+{
+    DeltaE76F32Range(de, lab, ref, 0, n);
+}
+
+static void DeltaE94F32Scalar(float* de, const float* const* lab, const float* const* ref, size_t n)
+{
+    DeltaE94F32Range(de, lab, ref, 0, n);
+}
+
+static void DeltaE2000F32Scalar(float* de, const float* const* lab, const float* const* ref, size_t n)
+{
+    DeltaE2000F32Range(de, lab, ref, 0, n);
+}
+
+#ifdef PIXELKERNELS_X86
+// ---------------------------------------------------------------------------
+// SSE4.2
+// The float kernels compute both branches and keep the valid one with a compare mask:
+// an ordered "greater than" is false for NaN, and "not equal" is true for NaN, just like the scalar compares.
+
+KERNEL_TARGET("sse4.2")
+static void SubtractClampedU16Sse42(unsigned short* dst, const unsigned short* sub, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(sub + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_subs_epu16(a, b));
+    }
+    SubtractClampedU16Scalar(dst + i, sub + i, n - i);
+}
+
+KERNEL_TARGET("sse4.2")
+static void SubtractClampedF32Sse42(float* dst, const float* sub, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 a = _mm_loadu_ps(dst + i);
+        __m128 b = _mm_loadu_ps(sub + i);
+        __m128 keep = _mm_cmpgt_ps(a, b);
+        _mm_storeu_ps(dst + i, _mm_and_ps(keep, _mm_sub_ps(a, b)));
+    }
+    SubtractClampedF32Scalar(dst + i, sub + i, n - i);
+}
+
+KERNEL_TARGET("sse4.2")
+static void SubtractClampedF32U16Sse42(float* dst, const unsigned short* sub, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 a = _mm_loadu_ps(dst + i);
+        __m128 b = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(sub + i))));
+        __m128 keep = _mm_cmpgt_ps(a, b);
+        _mm_storeu_ps(dst + i, _mm_and_ps(keep, _mm_sub_ps(a, b)));
+    }
+    SubtractClampedF32U16Scalar(dst + i, sub + i, n - i);
+}
+
+KERNEL_TARGET("sse4.2")
+static void DivideGuardedF32Sse42(float* dst, const float* divisor, size_t n)
+{
+    const __m128 zero = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 a = _mm_loadu_ps(dst + i);
+        __m128 d = _mm_loadu_ps(divisor + i);
+        __m128 keep = _mm_cmpneq_ps(d, zero);
+        _mm_storeu_ps(dst + i, _mm_and_ps(keep, _mm_div_ps(a, d)));
+    }
+    DivideGuardedF32Scalar(dst + i, divisor + i, n - i);
+}
+
+// Saturating u16 subtraction gives the clamped difference directly; it is then widened to float.
+KERNEL_TARGET("sse4.2")
+static void IngestU16Sse42(float* dst, const unsigned short* raw, const unsigned short* bias, const float* inv_flat, float gain, size_t n)
+{
+    const __m128 g = _mm_set1_ps(gain);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i r = _mm_loadu_si128((const __m128i*)(raw + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(bias + i));
+        __m128i d = _mm_subs_epu16(r, b);
+        __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(d, zero));
+        __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(d, zero));
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_mul_ps(lo, _mm_loadu_ps(inv_flat + i)), g));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_mul_ps(hi, _mm_loadu_ps(inv_flat + i + 4)), g));
+    }
+    IngestU16Scalar(dst + i, raw + i, bias + i, inv_flat + i, gain, n - i);
+}
+
+// The projections keep the three sums of a block of pixels in registers and walk the bands, so every band row
+// is read once and every XYZ row written once. Sums are formed with separate multiplies and adds in band order,
+// matching the scalar kernel exactly (no FMA).
+
+template<size_t N>
+KERNEL_TARGET("sse4.2") KERNEL_NO_CONTRACT
+static void ProjectXyzF32Sse42(float* const* dst, const float* const* src, const float* weights, size_t nsrc, size_t n)
+{
+    const size_t bands = N ? N : nsrc;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_setzero_ps(), y = _mm_setzero_ps(), z = _mm_setzero_ps();
+        KERNEL_UNROLL
+        for (size_t f = 0; f < bands; ++f) {
+            const __m128 v = _mm_loadu_ps(src[f] + i);
+            x = _mm_add_ps(x, _mm_mul_ps(v, _mm_set1_ps(weights[f * 3])));
+            y = _mm_add_ps(y, _mm_mul_ps(v, _mm_set1_ps(weights[f * 3 + 1])));
+            z = _mm_add_ps(z, _mm_mul_ps(v, _mm_set1_ps(weights[f * 3 + 2])));
+        }
+        _mm_storeu_ps(dst[0] + i, x);
+        _mm_storeu_ps(dst[1] + i, y);
+        _mm_storeu_ps(dst[2] + i, z);
+    }
+    ProjectXyzF32Range<N>(dst, src, weights, nsrc, i, n);
+}
+
+// The sets of a block are projected one after the other; the block's band rows stay in L1 between them.
+KERNEL_TARGET("sse4.2") KERNEL_NO_CONTRACT
+static void ProjectXyzSetsF32Sse42(float* const* dst, const float* const* src, const float* weights, size_t nsrc, size_t nsets, size_t n)
+{
+    const size_t stride = nsets * 3;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        for (size_t set = 0; set < nsets; ++set) {
+            const float* w = weights + (set * 3);
+            __m128 x = _mm_setzero_ps(), y = _mm_setzero_ps(), z = _mm_setzero_ps();
+            KERNEL_UNROLL
+            for (size_t f = 0; f < nsrc; ++f) {
+                const __m128 v = _mm_loadu_ps(src[f] + i);
+                x = _mm_add_ps(x, _mm_mul_ps(v, _mm_set1_ps(w[f * stride])));
+                y = _mm_add_ps(y, _mm_mul_ps(v, _mm_set1_ps(w[f * stride + 1])));
+                z = _mm_add_ps(z, _mm_mul_ps(v, _mm_set1_ps(w[f * stride + 2])));
+            }
+            _mm_storeu_ps(dst[set * 3] + i, x);
+            _mm_storeu_ps(dst[set * 3 + 1] + i, y);
+            _mm_storeu_ps(dst[set * 3 + 2] + i, z);
+        }
+    }
+    ProjectXyzSetsF32Range(dst, src, weights, nsrc, nsets, i, n);
+}
+
+KERNEL_TARGET("sse4.2") KERNEL_NO_CONTRACT
+static void AccumulateXyzF32Sse42(float* const* dst, const float* src, const float* weights, size_t n)
+{
+    const __m128 wx = _mm_set1_ps(weights[0]), wy = _mm_set1_ps(weights[1]), wz = _mm_set1_ps(weights[2]);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m128 v = _mm_loadu_ps(src + i);
+        _mm_storeu_ps(dst[0] + i, _mm_add_ps(_mm_loadu_ps(dst[0] + i), _mm_mul_ps(v, wx)));
+        _mm_storeu_ps(dst[1] + i, _mm_add_ps(_mm_loadu_ps(dst[1] + i), _mm_mul_ps(v, wy)));
+        _mm_storeu_ps(dst[2] + i, _mm_add_ps(_mm_loadu_ps(dst[2] + i), _mm_mul_ps(v, wz)));
+    }
+    AccumulateXyzF32Range(dst, src, weights, i, n);
+}
+
+template<size_t N>
+KERNEL_TARGET("sse4.2") KERNEL_NO_CONTRACT
+static void BlendF32Sse42(float* dst, const float* const* src, const float* weights, size_t nsrc, size_t n)
+{
+    const size_t lights = N ? N : nsrc;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 value = _mm_setzero_ps();
+        KERNEL_UNROLL
+        for (size_t l = 0; l < lights; ++l) {
+            value = _mm_add_ps(value, _mm_mul_ps(_mm_loadu_ps(src[l] + i), _mm_set1_ps(weights[l])));
+        }
+        _mm_storeu_ps(dst + i, value);
+    }
+    BlendF32Range<N>(dst, src, weights, nsrc, i, n);
+}
+
+// Same operations as LabF, lane-wise; the compare mask selects the linear segment.
+KERNEL_TARGET("sse4.2") KERNEL_NO_CONTRACT
+static inline __m128 LabFSse42(__m128 t)
+{
+    const __m128 epsilon = _mm_set1_ps(LAB_EPSILON);
+    const __m128 x = _mm_max_ps(t, epsilon);
+    __m128i bits = _mm_castps_si128(x);
+    bits = _mm_add_epi32(_mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(bits), _mm_set1_ps(1.0f / 3.0f))), _mm_set1_epi32(LAB_CBRT_BIAS));
+    __m128 y = _mm_castsi128_ps(bits);
+    for (int step = 0; step < 2; ++step) {
+        const __m128 y3 = _mm_mul_ps(_mm_mul_ps(y, y), y);
+        y = _mm_div_ps(_mm_mul_ps(y, _mm_add_ps(_mm_add_ps(y3, x), x)), _mm_add_ps(_mm_add_ps(y3, y3), x));
+    }
+    const __m128 linear = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(t, _mm_set1_ps(LAB_KAPPA)), _mm_set1_ps(16.0f)), _mm_set1_ps(1.0f / 116.0f));
+    return _mm_blendv_ps(linear, y, _mm_cmpgt_ps(t, epsilon));
+}
+
+KERNEL_TARGET("sse4.2") KERNEL_NO_CONTRACT
+static void XyzToLabF32Sse42(float* const* lab, const float* const* xyz, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m128 fx = LabFSse42(_mm_loadu_ps(xyz[0] + i));
+        const __m128 fy = LabFSse42(_mm_loadu_ps(xyz[1] + i));
+        const __m128 fz = LabFSse42(_mm_loadu_ps(xyz[2] + i));
+        _mm_storeu_ps(lab[0] + i, _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(116.0f), fy), _mm_set1_ps(16.0f)));
+        _mm_storeu_ps(lab[1] + i, _mm_mul_ps(_mm_set1_ps(500.0f), _mm_sub_ps(fx, fy)));
+        _mm_storeu_ps(lab[2] + i, _mm_mul_ps(_mm_set1_ps(200.0f), _mm_sub_ps(fy, fz)));
+    }
+    XyzToLabF32Range(lab, xyz, i, n);
+}
+
+// ---------------------------------------------------------------------------
+// AVX2
+
+KERNEL_TARGET("avx2")
+static void SubtractClampedU16Avx2(unsigned short* dst, const unsigned short* sub, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(sub + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_subs_epu16(a, b));
+    }
+    SubtractClampedU16Scalar(dst + i, sub + i, n - i);
+}
+
+KERNEL_TARGET("avx2")
+static void SubtractClampedF32Avx2(float* dst, const float* sub, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 a = _mm256_loadu_ps(dst + i);
+        __m256 b = _mm256_loadu_ps(sub + i);
+        __m256 keep = _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+        _mm256_storeu_ps(dst + i, _mm256_and_ps(keep, _mm256_sub_ps(a, b)));
+    }
+    SubtractClampedF32Scalar(dst + i, sub + i, n - i);
+}
+
+KERNEL_TARGET("avx2")
+static void SubtractClampedF32U16Avx2(float* dst, const unsigned short* sub, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 a = _mm256_loadu_ps(dst + i);
+        __m256 b = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(sub + i))));
+        __m256 keep = _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+        _mm256_storeu_ps(dst + i, _mm256_and_ps(keep, _mm256_sub_ps(a, b)));
+    }
+    SubtractClampedF32U16Scalar(dst + i, sub + i, n - i);
+}
+
+KERNEL_TARGET("avx2")
+static void DivideGuardedF32Avx2(float* dst, const float* divisor, size_t n)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 a = _mm256_loadu_ps(dst + i);
+        __m256 d = _mm256_loadu_ps(divisor + i);
+        __m256 keep = _mm256_cmp_ps(d, zero, _CMP_NEQ_UQ);
+        _mm256_storeu_ps(dst + i, _mm256_and_ps(keep, _mm256_div_ps(a, d)));
+    }
+    DivideGuardedF32Scalar(dst + i, divisor + i, n - i);
+}
+
+KERNEL_TARGET("avx2")
+static void IngestU16Avx2(float* dst, const unsigned short* raw, const unsigned short* bias, const float* inv_flat, float gain, size_t n)
+{
+    const __m256 g = _mm256_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i r = _mm256_loadu_si256((const __m256i*)(raw + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(bias + i));
+        __m256i d = _mm256_subs_epu16(r, b);
+        __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(d)));
+        __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(d, 1)));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_mul_ps(lo, _mm256_loadu_ps(inv_flat + i)), g));
+        _mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_mul_ps(hi, _mm256_loadu_ps(inv_flat + i + 8)), g));
+    }
+    IngestU16Scalar(dst + i, raw + i, bias + i, inv_flat + i, gain, n - i);
+}
+
+KERNEL_TARGET("avx2,f16c")
+static void IngestU16F16Avx2(float* dst, const unsigned short* raw, const unsigned short* bias, const unsigned short* inv_flat_fp16, float gain, size_t n)
+{
+    const __m256 g = _mm256_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i r = _mm256_loadu_si256((const __m256i*)(raw + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(bias + i));
+        __m256i d = _mm256_subs_epu16(r, b);
+        __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(d)));
+        __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(d, 1)));
+        __m256 flat_lo = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(inv_flat_fp16 + i)));
+        __m256 flat_hi = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(inv_flat_fp16 + i + 8)));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_mul_ps(lo, flat_lo), g));
+        _mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_mul_ps(hi, flat_hi), g));
+    }
+    IngestU16F16Scalar(dst + i, raw + i, bias + i, inv_flat_fp16 + i, gain, n - i);
+}
+
+KERNEL_TARGET("avx2,f16c")
+static void ConvertF32F16Avx2(unsigned short* dst, const float* src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm_storeu_si128((__m128i*)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+        _mm_storeu_si128((__m128i*)(dst + i + 8), _mm256_cvtps_ph(_mm256_loadu_ps(src + i + 8), _MM_FROUND_TO_NEAREST_INT));
+    }
+    ConvertF32F16Scalar(dst + i, src + i, n - i);
+}
+
+KERNEL_TARGET("avx2,f16c")
+static void ConvertF16F32Avx2(float* dst, const unsigned short* src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i))));
+        _mm256_storeu_ps(dst + i + 8, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i + 8))));
+    }
+    ConvertF16F32Scalar(dst + i, src + i, n - i);
+}
+
+// Two blocks per iteration: six independent sums hide the add latency over the band loop.
+template<size_t N>
+KERNEL_TARGET("avx2") KERNEL_NO_CONTRACT
+static void ProjectXyzF32Avx2(float* const* dst, const float* const* src, const float* weights, size_t nsrc, size_t n)
+{
+    const size_t bands = N ? N : nsrc;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256 x0 = _mm256_setzero_ps(), y0 = _mm256_setzero_ps(), z0 = _mm256_setzero_ps();
+        __m256 x1 = _mm256_setzero_ps(), y1 = _mm256_setzero_ps(), z1 = _mm256_setzero_ps();
+        KERNEL_UNROLL
+        for (size_t f = 0; f < bands; ++f) {
+            const __m256 wx = _mm256_set1_ps(weights[f * 3]);
+            const __m256 wy = _mm256_set1_ps(weights[f * 3 + 1]);
+            const __m256 wz = _mm256_set1_ps(weights[f * 3 + 2]);
+            const __m256 v0 = _mm256_loadu_ps(src[f] + i);
+            const __m256 v1 = _mm256_loadu_ps(src[f] + i + 8);
+            x0 = _mm256_add_ps(x0, _mm256_mul_ps(v0, wx));
+            y0 = _mm256_add_ps(y0, _mm256_mul_ps(v0, wy));
+            z0 = _mm256_add_ps(z0, _mm256_mul_ps(v0, wz));
+            x1 = _mm256_add_ps(x1, _mm256_mul_ps(v1, wx));
+            y1 = _mm256_add_ps(y1, _mm256_mul_ps(v1, wy));
+            z1 = _mm256_add_ps(z1, _mm256_mul_ps(v1, wz));
+        }
+        _mm256_storeu_ps(dst[0] + i, x0);
+        _mm256_storeu_ps(dst[1] + i, y0);
+        _mm256_storeu_ps(dst[2] + i, z0);
+        _mm256_storeu_ps(dst[0] + i + 8, x1);
+        _mm256_storeu_ps(dst[1] + i + 8, y1);
+        _mm256_storeu_ps(dst[2] + i + 8, z1);
+    }
+    ProjectXyzF32Range<N>(dst, src, weights, nsrc, i, n);
+}
+
+KERNEL_TARGET("avx2") KERNEL_NO_CONTRACT
+static void ProjectXyzSetsF32Avx2(float* const* dst, const float* const* src, const float* weights, size_t nsrc, size_t nsets, size_t n)
+{
+    const size_t stride = nsets * 3;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        for (size_t set = 0; set < nsets; ++set) {
+            const float* w = weights + (set * 3);
+            __m256 x0 = _mm256_setzero_ps(), y0 = _mm256_setzero_ps(), z0 = _mm256_setzero_ps();
+            __m256 x1 = _mm256_setzero_ps(), y1 = _mm256_setzero_ps(), z1 = _mm256_setzero_ps();
+            KERNEL_UNROLL
+            for (size_t f = 0; f < nsrc; ++f) {
+                const __m256 wx = _mm256_set1_ps(w[f * stride]);
+                const __m256 wy = _mm256_set1_ps(w[f * stride + 1]);
+                const __m256 wz = _mm256_set1_ps(w[f * stride + 2]);
+                const __m256 v0 = _mm256_loadu_ps(src[f] + i);
+                const __m256 v1 = _mm256_loadu_ps(src[f] + i + 8);
+                x0 = _mm256_add_ps(x0, _mm256_mul_ps(v0, wx));
+                y0 = _mm256_add_ps(y0, _mm256_mul_ps(v0, wy));
+                z0 = _mm256_add_ps(z0, _mm256_mul_ps(v0, wz));
+                x1 = _mm256_add_ps(x1, _mm256_mul_ps(v1, wx));
+                y1 = _mm256_add_ps(y1, _mm256_mul_ps(v1, wy));
+                z1 = _mm256_add_ps(z1, _mm256_mul_ps(v1, wz));
+            }
+            _mm256_storeu_ps(dst[set * 3] + i, x0);
+            _mm256_storeu_ps(dst[set * 3 + 1] + i, y0);
+            _mm256_storeu_ps(dst[set * 3 + 2] + i, z0);
+            _mm256_storeu_ps(dst[set * 3] + i + 8, x1);
+            _mm256_storeu_ps(dst[set * 3 + 1] + i + 8, y1);
+            _mm256_storeu_ps(dst[set * 3 + 2] + i + 8, z1);
+        }
+    }
+    ProjectXyzSetsF32Range(dst, src, weights, nsrc, nsets, i, n);
+}
+
+KERNEL_TARGET("avx2") KERNEL_NO_CONTRACT
+static void AccumulateXyzF32Avx2(float* const* dst, const float* src, const float* weights, size_t n)
+{
+    const __m256 wx = _mm256_set1_ps(weights[0]), wy = _mm256_set1_ps(weights[1]), wz = _mm256_set1_ps(weights[2]);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 v = _mm256_loadu_ps(src + i);
+        _mm256_storeu_ps(dst[0] + i, _mm256_add_ps(_mm256_loadu_ps(dst[0] + i), _mm256_mul_ps(v, wx)));
+        _mm256_storeu_ps(dst[1] + i, _mm256_add_ps(_mm256_loadu_ps(dst[1] + i), _mm256_mul_ps(v, wy)));
+        _mm256_storeu_ps(dst[2] + i, _mm256_add_ps(_mm256_loadu_ps(dst[2] + i), _mm256_mul_ps(v, wz)));
+    }
+    AccumulateXyzF32Range(dst, src, weights, i, n);
+}
+
+template<size_t N>
+KERNEL_TARGET("avx2") KERNEL_NO_CONTRACT
+static void BlendF32Avx2(float* dst, const float* const* src, const float* weights, size_t nsrc, size_t n)
+{
+    const size_t lights = N ? N : nsrc;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 value = _mm256_setzero_ps();
+        KERNEL_UNROLL
+        for (size_t l = 0; l < lights; ++l) {
+            value = _mm256_add_ps(value, _mm256_mul_ps(_mm256_loadu_ps(src[l] + i), _mm256_set1_ps(weights[l])));
+        }
+        _mm256_storeu_ps(dst + i, value);
+    }
+    BlendF32Range<N>(dst, src, weights, nsrc, i, n);
+}
+
+// Same operations as LabF, lane-wise; the compare mask selects the linear segment.
+KERNEL_TARGET("avx2") KERNEL_NO_CONTRACT
+static inline __m256 LabFAvx2(__m256 t)
+{
+    const __m256 epsilon = _mm256_set1_ps(LAB_EPSILON);
+    const __m256 x = _mm256_max_ps(t, epsilon);
+    __m256i bits = _mm256_castps_si256(x);
+    bits = _mm256_add_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(bits), _mm256_set1_ps(1.0f / 3.0f))), _mm256_set1_epi32(LAB_CBRT_BIAS));
+    __m256 y = _mm256_castsi256_ps(bits);
+    for (int step = 0; step < 2; ++step) {
+        const __m256 y3 = _mm256_mul_ps(_mm256_mul_ps(y, y), y);
+        y = _mm256_div_ps(_mm256_mul_ps(y, _mm256_add_ps(_mm256_add_ps(y3, x), x)), _mm256_add_ps(_mm256_add_ps(y3, y3), x));
+    }
+    const __m256 linear = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(t, _mm256_set1_ps(LAB_KAPPA)), _mm256_set1_ps(16.0f)), _mm256_set1_ps(1.0f / 116.0f));
+    return _mm256_blendv_ps(linear, y, _mm256_cmp_ps(t, epsilon, _CMP_GT_OQ));
+}
+
+KERNEL_TARGET("avx2") KERNEL_NO_CONTRACT
+static void XyzToLabF32Avx2(float* const* lab, const float* const* xyz, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 fx = LabFAvx2(_mm256_loadu_ps(xyz[0] + i));
+        const __m256 fy = LabFAvx2(_mm256_loadu_ps(xyz[1] + i));
+        const __m256 fz = LabFAvx2(_mm256_loadu_ps(xyz[2] + i));
+        _mm256_storeu_ps(lab[0] + i, _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(116.0f), fy), _mm256_set1_ps(16.0f)));
+        _mm256_storeu_ps(lab[1] + i, _mm256_mul_ps(_mm256_set1_ps(500.0f), _mm256_sub_ps(fx, fy)));
+        _mm256_storeu_ps(lab[2] + i, _mm256_mul_ps(_mm256_set1_ps(200.0f), _mm256_sub_ps(fy, fz)));
+    }
+    XyzToLabF32Range(lab, xyz, i, n);
+}
+
+// Same operations as CurveLookup, lane-wise; both samples of every lane are gathered from the table.
+KERNEL_TARGET("avx2") KERNEL_NO_CONTRACT
+static inline __m256 CurveLookupAvx2(__m256 value, const float* curve)
+{
+    const __m256 lowest = _mm256_set1_ps(CURVE_LUT_MIN);
+    const __m256 v = _mm256_min_ps(_mm256_max_ps(value, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+    const __m256i offset = _mm256_sub_epi32(_mm256_castps_si256(_mm256_max_ps(v, lowest)), _mm256_set1_epi32((int)CURVE_LUT_MIN_BITS));
+    const __m256i k = _mm256_srli_epi32(offset, CURVE_LUT_FRACTION_BITS);
+    const __m256 t = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(offset, _mm256_set1_epi32((int)CURVE_LUT_FRACTION_MASK))), _mm256_set1_ps(CURVE_LUT_FRACTION_SCALE));
+    const __m256 a = _mm256_i32gather_ps(curve, k, 4);
+    const __m256 b = _mm256_i32gather_ps(curve + 1, k, 4);
+    const __m256 interpolated = _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), t));
+    const __m256 toe = _mm256_mul_ps(v, _mm256_set1_ps(curve[CURVE_LUT_TOE]));
+    return _mm256_blendv_ps(toe, interpolated, _mm256_cmp_ps(v, lowest, _CMP_GT_OQ));
+}
+
+KERNEL_TARGET("avx2") KERNEL_NO_CONTRACT
+static void EncodeRgbF32Avx2(float* const* rgb, const float* const* xyz, const float* matrix, const float* curve, size_t n)
+{
+    __m256 m[9];
+    for (int k = 0; k < 9; ++k) {
+        m[k] = _mm256_set1_ps(matrix[k]);
+    }
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 x = _mm256_loadu_ps(xyz[0] + i);
+        const __m256 y = _mm256_loadu_ps(xyz[1] + i);
+        const __m256 z = _mm256_loadu_ps(xyz[2] + i);
+        for (int c = 0; c < 3; ++c) {
+            const __m256 linear = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[c * 3], x), _mm256_mul_ps(m[c * 3 + 1], y)), _mm256_mul_ps(m[c * 3 + 2], z));
+            _mm256_storeu_ps(rgb[c] + i, CurveLookupAvx2(linear, curve));
+        }
+    }
+    EncodeRgbF32Range(rgb, xyz, matrix, curve, i, n);
+}
+
+// Same operations as the scalar delta E helpers, lane-wise; the compare masks pick what the scalar code branches on.
+KERNEL_TARGET("avx2") KERNEL_NO_CONTRACT
+static inline __m256 SinPolyAvx2(__m256 r)
+{
+    const __m256 z = _mm256_mul_ps(r, r);
+    const __m256 p = _mm256_sub_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(-1.9515295891e-4f), z), _mm256_set1_ps(8.3321608736e-3f)), z), _mm256_set1_ps(1.6666654611e-1f));
+    return _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(p, z), r), r);
+}
+
+KERNEL_TARGET("avx2") KERNEL_NO_CONTRACT
+static inline __m256 CosPolyAvx2(__m256 r)
+{
+    const __m256 z = _mm256_mul_ps(r, r);
+    const __m256 p = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(2.443315711809948e-5f), z), _mm256_set1_ps(1.388731625493765e-3f)), z), _mm256_set1_ps(4.166664568298827e-2f));
+    return _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_mul_ps(p, z), z), _mm256_mul_ps(_mm256_set1_ps(0.5f), z)), _mm256_set1_ps(1.0f));
+}
+
+KERNEL_TARGET("avx2") KERNEL_NO_CONTRACT
+static inline void SinCosDegAvx2(__m256 d, __m256& s, __m256& c)
+{
+    const __m256i one = _mm256_set1_epi32(1), two = _mm256_set1_epi32(2);
+    const __m256 k = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(d, _mm256_set1_ps(1.0f / 90.0f)), _mm256_set1_ps(0.5f)));
+    const __m256 r = _mm256_mul_ps(_mm256_sub_ps(d, _mm256_mul_ps(k, _mm256_set1_ps(90.0f))), _mm256_set1_ps(DE_DEG_TO_RAD));
+    const __m256 sp = SinPolyAvx2(r), cp = CosPolyAvx2(r);
+    const __m256i q = _mm256_cvttps_epi32(k);
+    const __m256 odd = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(q, one), one));
+    s = _mm256_xor_ps(_mm256_blendv_ps(sp, cp, odd), _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(q, two), 30)));
+    c = _mm256_xor_ps(_mm256_blendv_ps(cp, sp, odd), _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(q, one), two), 30)));
+}
+
+KERNEL_TARGET("avx2") KERNEL_NO_CONTRACT
+static inline __m256 Atan2DegAvx2(__m256 y, __m256 x)
+{
+    const __m256 ax = _mm256_and_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff))), ay = _mm256_and_ps(y, _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff)));
+    const __m256 mx = _mm256_max_ps(ax, ay);
+    const __m256 mn = _mm256_min_ps(ax, ay);
+    const __m256 q = _mm256_and_ps(_mm256_cmp_ps(mx, _mm256_setzero_ps(), _CMP_GT_OQ), _mm256_div_ps(mn, mx));
+    const __m256 big = _mm256_cmp_ps(q, _mm256_set1_ps(DE_TAN_PI_8), _CMP_GT_OQ);
+    const __m256 t = _mm256_blendv_ps(q, _mm256_div_ps(_mm256_sub_ps(q, _mm256_set1_ps(1.0f)), _mm256_add_ps(q, _mm256_set1_ps(1.0f))), big);
+    const __m256 z = _mm256_mul_ps(t, t);
+    const __m256 p = _mm256_sub_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(8.05374449538e-2f), z), _mm256_set1_ps(1.38776856032e-1f)), z), _mm256_set1_ps(1.99777106478e-1f)), z), _mm256_set1_ps(3.33329491539e-1f));
+    __m256 a = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(p, z), t), t);
+    a = _mm256_blendv_ps(a, _mm256_add_ps(a, _mm256_set1_ps(DE_PI * 0.25f)), big);
+    a = _mm256_blendv_ps(a, _mm256_sub_ps(_mm256_set1_ps(DE_PI * 0.5f), a), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+    a = _mm256_blendv_ps(a, _mm256_sub_ps(_mm256_set1_ps(DE_PI), a), _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ));
+    a = _mm256_mul_ps(a, _mm256_set1_ps(DE_RAD_TO_DEG));
+    return _mm256_blendv_ps(a, _mm256_sub_ps(_mm256_set1_ps(360.0f), a), _mm256_cmp_ps(y, _mm256_setzero_ps(), _CMP_LT_OQ));
+}
+
+KERNEL_TARGET("avx2") KERNEL_NO_CONTRACT
+static inline __m256 ExpNegAvx2(__m256 u)
+{
+    const __m256 t = _mm256_mul_ps(u, _mm256_set1_ps(1.44269504f));
+    const __m256 k = _mm256_floor_ps(_mm256_add_ps(t, _mm256_set1_ps(0.5f)));
+    const __m256 f = _mm256_mul_ps(_mm256_sub_ps(t, k), _mm256_set1_ps(0.693147181f));
+    __m256 p = _mm256_set1_ps(1.0f / 5040.0f);
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.0f / 720.0f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.0f / 120.0f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.0f / 24.0f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.0f / 6.0f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(0.5f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.0f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.0f));
+    const __m256 scale = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(k), _mm256_set1_epi32(127)), 23));
+    return _mm256_mul_ps(p, scale);
+}
+
+KERNEL_TARGET("avx2") KERNEL_NO_CONTRACT
+static inline __m256 Pow7Avx2(__m256 x)
+{
+    const __m256 x2 = _mm256_mul_ps(x, x);
+    const __m256 x4 = _mm256_mul_ps(x2, x2);
+    return _mm256_mul_ps(_mm256_mul_ps(x4, x2), x);
+}
+
+KERNEL_TARGET("avx2") KERNEL_NO_CONTRACT
+static void DeltaE76F32Avx2(float* de, const float* const* lab, const float* const* ref, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 dl = _mm256_sub_ps(_mm256_loadu_ps(lab[0] + i), _mm256_loadu_ps(ref[0] + i));
+        const __m256 da = _mm256_sub_ps(_mm256_loadu_ps(lab[1] + i), _mm256_loadu_ps(ref[1] + i));
+        const __m256 db = _mm256_sub_ps(_mm256_loadu_ps(lab[2] + i), _mm256_loadu_ps(ref[2] + i));
+        _mm256_storeu_ps(de + i, _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dl, dl), _mm256_mul_ps(da, da)), _mm256_mul_ps(db, db))));
+    }
+    DeltaE76F32Range(de, lab, ref, i, n);
+}
+
+KERNEL_TARGET("avx2") KERNEL_NO_CONTRACT
+static void DeltaE94F32Avx2(float* de, const float* const* lab, const float* const* ref, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 l1 = _mm256_loadu_ps(ref[0] + i), a1 = _mm256_loadu_ps(ref[1] + i), b1 = _mm256_loadu_ps(ref[2] + i);
+        const __m256 l2 = _mm256_loadu_ps(lab[0] + i), a2 = _mm256_loadu_ps(lab[1] + i), b2 = _mm256_loadu_ps(lab[2] + i);
+        const __m256 c1 = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(a1, a1), _mm256_mul_ps(b1, b1)));
+        const __m256 c2 = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(a2, a2), _mm256_mul_ps(b2, b2)));
+        const __m256 dl = _mm256_sub_ps(l2, l1), da = _mm256_sub_ps(a2, a1), db = _mm256_sub_ps(b2, b1);
+        const __m256 dc = _mm256_sub_ps(c2, c1);
+        const __m256 dh2 = _mm256_max_ps(_mm256_sub_ps(_mm256_add_ps(_mm256_mul_ps(da, da), _mm256_mul_ps(db, db)), _mm256_mul_ps(dc, dc)), _mm256_setzero_ps());
+        const __m256 sc = _mm256_add_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(_mm256_set1_ps(0.045f), c1));
+        const __m256 sh = _mm256_add_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(_mm256_set1_ps(0.015f), c1));
+        const __m256 dcs = _mm256_div_ps(dc, sc);
+        _mm256_storeu_ps(de + i, _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dl, dl), _mm256_mul_ps(dcs, dcs)), _mm256_div_ps(dh2, _mm256_mul_ps(sh, sh)))));
+    }
+    DeltaE94F32Range(de, lab, ref, i, n);
+}
+
+KERNEL_TARGET("avx2") KERNEL_NO_CONTRACT
+static void DeltaE2000F32Avx2(float* de, const float* const* lab, const float* const* ref, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 l1 = _mm256_loadu_ps(ref[0] + i), a1 = _mm256_loadu_ps(ref[1] + i), b1 = _mm256_loadu_ps(ref[2] + i);
+        const __m256 l2 = _mm256_loadu_ps(lab[0] + i), a2 = _mm256_loadu_ps(lab[1] + i), b2 = _mm256_loadu_ps(lab[2] + i);
+        const __m256 c1 = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(a1, a1), _mm256_mul_ps(b1, b1)));
+        const __m256 c2 = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(a2, a2), _mm256_mul_ps(b2, b2)));
+        const __m256 cm7 = Pow7Avx2(_mm256_mul_ps(_mm256_add_ps(c1, c2), _mm256_set1_ps(0.5f)));
+        const __m256 g = _mm256_mul_ps(_mm256_set1_ps(0.5f), _mm256_sub_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(_mm256_div_ps(cm7, _mm256_add_ps(cm7, _mm256_set1_ps(DE_POW7_25))))));
+        const __m256 a1p = _mm256_mul_ps(a1, _mm256_add_ps(_mm256_set1_ps(1.0f), g));
+        const __m256 a2p = _mm256_mul_ps(a2, _mm256_add_ps(_mm256_set1_ps(1.0f), g));
+        const __m256 c1p = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(a1p, a1p), _mm256_mul_ps(b1, b1)));
+        const __m256 c2p = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(a2p, a2p), _mm256_mul_ps(b2, b2)));
+        const __m256 h1p = Atan2DegAvx2(b1, a1p);
+        const __m256 h2p = Atan2DegAvx2(b2, a2p);
+        const __m256 cprod = _mm256_mul_ps(c1p, c2p);
+        const __m256 chromatic = _mm256_cmp_ps(cprod, _mm256_setzero_ps(), _CMP_NEQ_UQ);
+
+        __m256 dhp = _mm256_sub_ps(h2p, h1p);
+        dhp = _mm256_blendv_ps(dhp, _mm256_sub_ps(dhp, _mm256_set1_ps(360.0f)), _mm256_cmp_ps(dhp, _mm256_set1_ps(180.0f), _CMP_GT_OQ));
+        dhp = _mm256_blendv_ps(dhp, _mm256_add_ps(dhp, _mm256_set1_ps(360.0f)), _mm256_cmp_ps(dhp, _mm256_set1_ps(-180.0f), _CMP_LT_OQ));
+        dhp = _mm256_and_ps(chromatic, dhp);
+        __m256 sin_half, cos_half;
+        SinCosDegAvx2(_mm256_mul_ps(dhp, _mm256_set1_ps(0.5f)), sin_half, cos_half);
+        const __m256 dh = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(2.0f), _mm256_sqrt_ps(cprod)), sin_half);
+        const __m256 hsum = _mm256_add_ps(h1p, h2p);
+        const __m256 hwrap = _mm256_blendv_ps(_mm256_mul_ps(_mm256_sub_ps(hsum, _mm256_set1_ps(360.0f)), _mm256_set1_ps(0.5f)), _mm256_mul_ps(_mm256_add_ps(hsum, _mm256_set1_ps(360.0f)), _mm256_set1_ps(0.5f)), _mm256_cmp_ps(hsum, _mm256_set1_ps(360.0f), _CMP_LT_OQ));
+        __m256 hm = _mm256_blendv_ps(_mm256_mul_ps(hsum, _mm256_set1_ps(0.5f)), hwrap, _mm256_cmp_ps(_mm256_and_ps(_mm256_sub_ps(h1p, h2p), _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff))), _mm256_set1_ps(180.0f), _CMP_GT_OQ));
+        hm = _mm256_blendv_ps(hsum, hm, chromatic);
+
+        __m256 s, c;
+        SinCosDegAvx2(hm, s, c);
+        const __m256 c2h = _mm256_sub_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(2.0f), c), c), _mm256_set1_ps(1.0f));
+        const __m256 s2h = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(2.0f), s), c);
+        const __m256 c3h = _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(4.0f), c), c), _mm256_set1_ps(3.0f)), c);
+        const __m256 s3h = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(3.0f), _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(4.0f), s), s)), s);
+        const __m256 c4h = _mm256_sub_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(2.0f), c2h), c2h), _mm256_set1_ps(1.0f));
+        const __m256 s4h = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(2.0f), s2h), c2h);
+        __m256 t = _mm256_sub_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(_mm256_set1_ps(0.17f), _mm256_add_ps(_mm256_mul_ps(c, _mm256_set1_ps(DE_COS_30)), _mm256_mul_ps(s, _mm256_set1_ps(DE_SIN_30)))));
+        t = _mm256_add_ps(t, _mm256_mul_ps(_mm256_set1_ps(0.24f), c2h));
+        t = _mm256_add_ps(t, _mm256_mul_ps(_mm256_set1_ps(0.32f), _mm256_sub_ps(_mm256_mul_ps(c3h, _mm256_set1_ps(DE_COS_6)), _mm256_mul_ps(s3h, _mm256_set1_ps(DE_SIN_6)))));
+        t = _mm256_sub_ps(t, _mm256_mul_ps(_mm256_set1_ps(0.20f), _mm256_add_ps(_mm256_mul_ps(c4h, _mm256_set1_ps(DE_COS_63)), _mm256_mul_ps(s4h, _mm256_set1_ps(DE_SIN_63)))));
+
+        const __m256 x = _mm256_mul_ps(_mm256_sub_ps(hm, _mm256_set1_ps(275.0f)), _mm256_set1_ps(1.0f / 25.0f));
+        const __m256 xx = _mm256_mul_ps(x, x);
+        const __m256 x2 = _mm256_min_ps(xx, _mm256_set1_ps(16.0f));
+        const __m256 dtheta = _mm256_and_ps(_mm256_cmp_ps(xx, _mm256_set1_ps(16.0f), _CMP_LT_OQ), _mm256_mul_ps(_mm256_set1_ps(30.0f), ExpNegAvx2(_mm256_xor_ps(x2, _mm256_set1_ps(-0.0f)))));
+        const __m256 cpm = _mm256_mul_ps(_mm256_add_ps(c1p, c2p), _mm256_set1_ps(0.5f));
+        const __m256 cpm7 = Pow7Avx2(cpm);
+        const __m256 rc = _mm256_mul_ps(_mm256_set1_ps(2.0f), _mm256_sqrt_ps(_mm256_div_ps(cpm7, _mm256_add_ps(cpm7, _mm256_set1_ps(DE_POW7_25)))));
+        __m256 sin_2theta, cos_2theta;
+        SinCosDegAvx2(_mm256_mul_ps(_mm256_set1_ps(2.0f), dtheta), sin_2theta, cos_2theta);
+        const __m256 rt = _mm256_xor_ps(_mm256_mul_ps(sin_2theta, rc), _mm256_set1_ps(-0.0f));
+
+        const __m256 lm = _mm256_sub_ps(_mm256_mul_ps(_mm256_add_ps(l1, l2), _mm256_set1_ps(0.5f)), _mm256_set1_ps(50.0f));
+        const __m256 lm2 = _mm256_mul_ps(lm, lm);
+        const __m256 sl = _mm256_add_ps(_mm256_set1_ps(1.0f), _mm256_div_ps(_mm256_mul_ps(_mm256_set1_ps(0.015f), lm2), _mm256_sqrt_ps(_mm256_add_ps(_mm256_set1_ps(20.0f), lm2))));
+        const __m256 sc = _mm256_add_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(_mm256_set1_ps(0.045f), cpm));
+        const __m256 sh = _mm256_add_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.015f), cpm), t));
+        const __m256 dls = _mm256_div_ps(_mm256_sub_ps(l2, l1), sl);
+        const __m256 dcs = _mm256_div_ps(_mm256_sub_ps(c2p, c1p), sc);
+        const __m256 dhs = _mm256_div_ps(dh, sh);
+        _mm256_storeu_ps(de + i, _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dls, dls), _mm256_mul_ps(dcs, dcs)), _mm256_mul_ps(dhs, dhs)), _mm256_mul_ps(_mm256_mul_ps(rt, dcs), dhs))));
+    }
+    DeltaE2000F32Range(de, lab, ref, i, n);
+}
+
+// ---------------------------------------------------------------------------
+// AVX-512 (F + BW). Masked operations zero the lanes that fail the compare.
+
+KERNEL_TARGET("avx512f,avx512bw")
+static void SubtractClampedU16Avx512(unsigned short* dst, const unsigned short* sub, size_t n)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m512i a = _mm512_loadu_si512((const void*)(dst + i));
+        __m512i b = _mm512_loadu_si512((const void*)(sub + i));
+        _mm512_storeu_si512((void*)(dst + i), _mm512_subs_epu16(a, b));
+    }
+    SubtractClampedU16Scalar(dst + i, sub + i, n - i);
+}
+
+KERNEL_TARGET("avx512f,avx512bw")
+static void SubtractClampedF32Avx512(float* dst, const float* sub, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 a = _mm512_loadu_ps(dst + i);
+        __m512 b = _mm512_loadu_ps(sub + i);
+        __mmask16 keep = _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ);
+        _mm512_storeu_ps(dst + i, _mm512_maskz_sub_ps(keep, a, b));
+    }
+    SubtractClampedF32Scalar(dst + i, sub + i, n - i);
+}
+
+KERNEL_TARGET("avx512f,avx512bw")
+static void SubtractClampedF32U16Avx512(float* dst, const unsigned short* sub, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 a = _mm512_loadu_ps(dst + i);
+        __m512 b = _mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(sub + i))));
+        __mmask16 keep = _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ);
+        _mm512_storeu_ps(dst + i, _mm512_maskz_sub_ps(keep, a, b));
+    }
+    SubtractClampedF32U16Scalar(dst + i, sub + i, n - i);
+}
+
+KERNEL_TARGET("avx512f,avx512bw")
+static void DivideGuardedF32Avx512(float* dst, const float* divisor, size_t n)
+{
+    const __m512 zero = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 a = _mm512_loadu_ps(dst + i);
+        __m512 d = _mm512_loadu_ps(divisor + i);
+        __mmask16 keep = _mm512_cmp_ps_mask(d, zero, _CMP_NEQ_UQ);
+        _mm512_storeu_ps(dst + i, _mm512_maskz_div_ps(keep, a, d));
+    }
+    DivideGuardedF32Scalar(dst + i, divisor + i, n - i);
+}
+
+KERNEL_TARGET("avx512f,avx512bw")
+static void IngestU16Avx512(float* dst, const unsigned short* raw, const unsigned short* bias, const float* inv_flat, float gain, size_t n)
+{
+    const __m512 g = _mm512_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m512i r = _mm512_loadu_si512((const void*)(raw + i));
+        __m512i b = _mm512_loadu_si512((const void*)(bias + i));
+        __m512i d = _mm512_subs_epu16(r, b);
+        __m512 lo = _mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(_mm512_castsi512_si256(d)));
+        __m512 hi = _mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(d, 1)));
+        _mm512_storeu_ps(dst + i, _mm512_mul_ps(_mm512_mul_ps(lo, _mm512_loadu_ps(inv_flat + i)), g));
+        _mm512_storeu_ps(dst + i + 16, _mm512_mul_ps(_mm512_mul_ps(hi, _mm512_loadu_ps(inv_flat + i + 16)), g));
+    }
+    IngestU16Scalar(dst + i, raw + i, bias + i, inv_flat + i, gain, n - i);
+}
+
+KERNEL_TARGET("avx512f,avx512bw")
+static void IngestU16F16Avx512(float* dst, const unsigned short* raw, const unsigned short* bias, const unsigned short* inv_flat_fp16, float gain, size_t n)
+{
+    const __m512 g = _mm512_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m512i r = _mm512_loadu_si512((const void*)(raw + i));
+        __m512i b = _mm512_loadu_si512((const void*)(bias + i));
+        __m512i d = _mm512_subs_epu16(r, b);
+        __m512 lo = _mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(_mm512_castsi512_si256(d)));
+        __m512 hi = _mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(d, 1)));
+        __m512 flat_lo = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(inv_flat_fp16 + i)));
+        __m512 flat_hi = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(inv_flat_fp16 + i + 16)));
+        _mm512_storeu_ps(dst + i, _mm512_mul_ps(_mm512_mul_ps(lo, flat_lo), g));
+        _mm512_storeu_ps(dst + i + 16, _mm512_mul_ps(_mm512_mul_ps(hi, flat_hi), g));
+    }
+    IngestU16F16Scalar(dst + i, raw + i, bias + i, inv_flat_fp16 + i, gain, n - i);
+}
+
+KERNEL_TARGET("avx512f,avx512bw")
+static void ConvertF32F16Avx512(unsigned short* dst, const float* src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm512_cvtps_ph(_mm512_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+        _mm256_storeu_si256((__m256i*)(dst + i + 16), _mm512_cvtps_ph(_mm512_loadu_ps(src + i + 16), _MM_FROUND_TO_NEAREST_INT));
+    }
+    ConvertF32F16Scalar(dst + i, src + i, n - i);
+}
+
+KERNEL_TARGET("avx512f,avx512bw")
+static void ConvertF16F32Avx512(float* dst, const unsigned short* src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        _mm512_storeu_ps(dst + i, _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(src + i))));
+        _mm512_storeu_ps(dst + i + 16, _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(src + i + 16))));
+    }
+    ConvertF16F32Scalar(dst + i, src + i, n - i);
+}
+
+template<size_t N>
+KERNEL_TARGET("avx512f,avx512bw") KERNEL_NO_CONTRACT
+static void ProjectXyzF32Avx512(float* const* dst, const float* const* src, const float* weights, size_t nsrc, size_t n)
+{
+    const size_t bands = N ? N : nsrc;
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m512 x0 = _mm512_setzero_ps(), y0 = _mm512_setzero_ps(), z0 = _mm512_setzero_ps();
+        __m512 x1 = _mm512_setzero_ps(), y1 = _mm512_setzero_ps(), z1 = _mm512_setzero_ps();
+        KERNEL_UNROLL
+        for (size_t f = 0; f < bands; ++f) {
+            const __m512 wx = _mm512_set1_ps(weights[f * 3]);
+            const __m512 wy = _mm512_set1_ps(weights[f * 3 + 1]);
+            const __m512 wz = _mm512_set1_ps(weights[f * 3 + 2]);
+            const __m512 v0 = _mm512_loadu_ps(src[f] + i);
+            const __m512 v1 = _mm512_loadu_ps(src[f] + i + 16);
+            x0 = _mm512_add_ps(x0, _mm512_mul_ps(v0, wx));
+            y0 = _mm512_add_ps(y0, _mm512_mul_ps(v0, wy));
+            z0 = _mm512_add_ps(z0, _mm512_mul_ps(v0, wz));
+            x1 = _mm512_add_ps(x1, _mm512_mul_ps(v1, wx));
+            y1 = _mm512_add_ps(y1, _mm512_mul_ps(v1, wy));
+            z1 = _mm512_add_ps(z1, _mm512_mul_ps(v1, wz));
+        }
+        _mm512_storeu_ps(dst[0] + i, x0);
+        _mm512_storeu_ps(dst[1] + i, y0);
+        _mm512_storeu_ps(dst[2] + i, z0);
+        _mm512_storeu_ps(dst[0] + i + 16, x1);
+        _mm512_storeu_ps(dst[1] + i + 16, y1);
+        _mm512_storeu_ps(dst[2] + i + 16, z1);
+    }
+    ProjectXyzF32Range<N>(dst, src, weights, nsrc, i, n);
+}
+
+KERNEL_TARGET("avx512f,avx512bw") KERNEL_NO_CONTRACT
+static void ProjectXyzSetsF32Avx512(float* const* dst, const float* const* src, const float* weights, size_t nsrc, size_t nsets, size_t n)
+{
+    const size_t stride = nsets * 3;
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        for (size_t set = 0; set < nsets; ++set) {
+            const float* w = weights + (set * 3);
+            __m512 x0 = _mm512_setzero_ps(), y0 = _mm512_setzero_ps(), z0 = _mm512_setzero_ps();
+            __m512 x1 = _mm512_setzero_ps(), y1 = _mm512_setzero_ps(), z1 = _mm512_setzero_ps();
+            KERNEL_UNROLL
+            for (size_t f = 0; f < nsrc; ++f) {
+                const __m512 wx = _mm512_set1_ps(w[f * stride]);
+                const __m512 wy = _mm512_set1_ps(w[f * stride + 1]);
+                const __m512 wz = _mm512_set1_ps(w[f * stride + 2]);
+                const __m512 v0 = _mm512_loadu_ps(src[f] + i);
+                const __m512 v1 = _mm512_loadu_ps(src[f] + i + 16);
+                x0 = _mm512_add_ps(x0, _mm512_mul_ps(v0, wx));
+                y0 = _mm512_add_ps(y0, _mm512_mul_ps(v0, wy));
+                z0 = _mm512_add_ps(z0, _mm512_mul_ps(v0, wz));
+                x1 = _mm512_add_ps(x1, _mm512_mul_ps(v1, wx));
+                y1 = _mm512_add_ps(y1, _mm512_mul_ps(v1, wy));
+                z1 = _mm512_add_ps(z1, _mm512_mul_ps(v1, wz));
+            }
+            _mm512_storeu_ps(dst[set * 3] + i, x0);
+            _mm512_storeu_ps(dst[set * 3 + 1] + i, y0);
+            _mm512_storeu_ps(dst[set * 3 + 2] + i, z0);
+            _mm512_storeu_ps(dst[set * 3] + i + 16, x1);
+            _mm512_storeu_ps(dst[set * 3 + 1] + i + 16, y1);
+            _mm512_storeu_ps(dst[set * 3 + 2] + i + 16, z1);
+        }
+    }
+    ProjectXyzSetsF32Range(dst, src, weights, nsrc, nsets, i, n);
+}
+
+KERNEL_TARGET("avx512f,avx512bw") KERNEL_NO_CONTRACT
+static void AccumulateXyzF32Avx512(float* const* dst, const float* src, const float* weights, size_t n)
+{
+    const __m512 wx = _mm512_set1_ps(weights[0]), wy = _mm512_set1_ps(weights[1]), wz = _mm512_set1_ps(weights[2]);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m512 v = _mm512_loadu_ps(src + i);
+        _mm512_storeu_ps(dst[0] + i, _mm512_add_ps(_mm512_loadu_ps(dst[0] + i), _mm512_mul_ps(v, wx)));
+        _mm512_storeu_ps(dst[1] + i, _mm512_add_ps(_mm512_loadu_ps(dst[1] + i), _mm512_mul_ps(v, wy)));
+        _mm512_storeu_ps(dst[2] + i, _mm512_add_ps(_mm512_loadu_ps(dst[2] + i), _mm512_mul_ps(v, wz)));
+    }
+    AccumulateXyzF32Range(dst, src, weights, i, n);
+}
+
+template<size_t N>
+KERNEL_TARGET("avx512f,avx512bw") KERNEL_NO_CONTRACT
+static void BlendF32Avx512(float* dst, const float* const* src, const float* weights, size_t nsrc, size_t n)
+{
+    const size_t lights = N ? N : nsrc;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 value = _mm512_setzero_ps();
+        KERNEL_UNROLL
+        for (size_t l = 0; l < lights; ++l) {
+            value = _mm512_add_ps(value, _mm512_mul_ps(_mm512_loadu_ps(src[l] + i), _mm512_set1_ps(weights[l])));
+        }
+        _mm512_storeu_ps(dst + i, value);
+    }
+    BlendF32Range<N>(dst, src, weights, nsrc, i, n);
+}
+
+// Same operations as LabF, lane-wise; the compare mask selects the linear segment.
+KERNEL_TARGET("avx512f,avx512bw") KERNEL_NO_CONTRACT
+static inline __m512 LabFAvx512(__m512 t)
+{
+    const __m512 epsilon = _mm512_set1_ps(LAB_EPSILON);
+    const __m512 x = _mm512_max_ps(t, epsilon);
+    __m512i bits = _mm512_castps_si512(x);
+    bits = _mm512_add_epi32(_mm512_cvttps_epi32(_mm512_mul_ps(_mm512_cvtepi32_ps(bits), _mm512_set1_ps(1.0f / 3.0f))), _mm512_set1_epi32(LAB_CBRT_BIAS));
+    __m512 y = _mm512_castsi512_ps(bits);
+    for (int step = 0; step < 2; ++step) {
+        const __m512 y3 = _mm512_mul_ps(_mm512_mul_ps(y, y), y);
+        y = _mm512_div_ps(_mm512_mul_ps(y, _mm512_add_ps(_mm512_add_ps(y3, x), x)), _mm512_add_ps(_mm512_add_ps(y3, y3), x));
+    }
+    const __m512 linear = _mm512_mul_ps(_mm512_add_ps(_mm512_mul_ps(t, _mm512_set1_ps(LAB_KAPPA)), _mm512_set1_ps(16.0f)), _mm512_set1_ps(1.0f / 116.0f));
+    return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(t, epsilon, _CMP_GT_OQ), linear, y);
+}
+
+KERNEL_TARGET("avx512f,avx512bw") KERNEL_NO_CONTRACT
+static void XyzToLabF32Avx512(float* const* lab, const float* const* xyz, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m512 fx = LabFAvx512(_mm512_loadu_ps(xyz[0] + i));
+        const __m512 fy = LabFAvx512(_mm512_loadu_ps(xyz[1] + i));
+        const __m512 fz = LabFAvx512(_mm512_loadu_ps(xyz[2] + i));
+        _mm512_storeu_ps(lab[0] + i, _mm512_sub_ps(_mm512_mul_ps(_mm512_set1_ps(116.0f), fy), _mm512_set1_ps(16.0f)));
+        _mm512_storeu_ps(lab[1] + i, _mm512_mul_ps(_mm512_set1_ps(500.0f), _mm512_sub_ps(fx, fy)));
+        _mm512_storeu_ps(lab[2] + i, _mm512_mul_ps(_mm512_set1_ps(200.0f), _mm512_sub_ps(fy, fz)));
+    }
+    XyzToLabF32Range(lab, xyz, i, n);
+}
+KERNEL_TARGET("avx512f,avx512bw") KERNEL_NO_CONTRACT
+static inline __m512 CurveLookupAvx512(__m512 value, const float* curve)
+{
+    const __m512 lowest = _mm512_set1_ps(CURVE_LUT_MIN);
+    const __m512 v = _mm512_min_ps(_mm512_max_ps(value, _mm512_setzero_ps()), _mm512_set1_ps(1.0f));
+    const __m512i offset = _mm512_sub_epi32(_mm512_castps_si512(_mm512_max_ps(v, lowest)), _mm512_set1_epi32((int)CURVE_LUT_MIN_BITS));
+    const __m512i k = _mm512_srli_epi32(offset, CURVE_LUT_FRACTION_BITS);
+    const __m512 t = _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_and_si512(offset, _mm512_set1_epi32((int)CURVE_LUT_FRACTION_MASK))), _mm512_set1_ps(CURVE_LUT_FRACTION_SCALE));
+    const __m512 a = _mm512_i32gather_ps(k, curve, 4);
+    const __m512 b = _mm512_i32gather_ps(k, curve + 1, 4);
+    const __m512 interpolated = _mm512_add_ps(a, _mm512_mul_ps(_mm512_sub_ps(b, a), t));
+    const __m512 toe = _mm512_mul_ps(v, _mm512_set1_ps(curve[CURVE_LUT_TOE]));
+    return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(v, lowest, _CMP_GT_OQ), toe, interpolated);
+}
+
+KERNEL_TARGET("avx512f,avx512bw") KERNEL_NO_CONTRACT
+static void EncodeRgbF32Avx512(float* const* rgb, const float* const* xyz, const float* matrix, const float* curve, size_t n)
+{
+    __m512 m[9];
+    for (int k = 0; k < 9; ++k) {
+        m[k] = _mm512_set1_ps(matrix[k]);
+    }
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m512 x = _mm512_loadu_ps(xyz[0] + i);
+        const __m512 y = _mm512_loadu_ps(xyz[1] + i);
+        const __m512 z = _mm512_loadu_ps(xyz[2] + i);
+        for (int c = 0; c < 3; ++c) {
+            const __m512 linear = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(m[c * 3], x), _mm512_mul_ps(m[c * 3 + 1], y)), _mm512_mul_ps(m[c * 3 + 2], z));
+            _mm512_storeu_ps(rgb[c] + i, CurveLookupAvx512(linear, curve));
+        }
+    }
+    EncodeRgbF32Range(rgb, xyz, matrix, curve, i, n);
+}
+KERNEL_TARGET("avx512f,avx512bw") KERNEL_NO_CONTRACT
+static inline __m512 SinPolyAvx512(__m512 r)
+{
+    const __m512 z = _mm512_mul_ps(r, r);
+    const __m512 p = _mm512_sub_ps(_mm512_mul_ps(_mm512_add_ps(_mm512_mul_ps(_mm512_set1_ps(-1.9515295891e-4f), z), _mm512_set1_ps(8.3321608736e-3f)), z), _mm512_set1_ps(1.6666654611e-1f));
+    return _mm512_add_ps(_mm512_mul_ps(_mm512_mul_ps(p, z), r), r);
+}
+
+KERNEL_TARGET("avx512f,avx512bw") KERNEL_NO_CONTRACT
+static inline __m512 CosPolyAvx512(__m512 r)
+{
+    const __m512 z = _mm512_mul_ps(r, r);
+    const __m512 p = _mm512_add_ps(_mm512_mul_ps(_mm512_sub_ps(_mm512_mul_ps(_mm512_set1_ps(2.443315711809948e-5f), z), _mm512_set1_ps(1.388731625493765e-3f)), z), _mm512_set1_ps(4.166664568298827e-2f));
+    return _mm512_add_ps(_mm512_sub_ps(_mm512_mul_ps(_mm512_mul_ps(p, z), z), _mm512_mul_ps(_mm512_set1_ps(0.5f), z)), _mm512_set1_ps(1.0f));
+}
+
+KERNEL_TARGET("avx512f,avx512bw") KERNEL_NO_CONTRACT
+static inline void SinCosDegAvx512(__m512 d, __m512& s, __m512& c)
+{
+    const __m512i one = _mm512_set1_epi32(1), two = _mm512_set1_epi32(2);
+    const __m512 k = _mm512_roundscale_ps(_mm512_add_ps(_mm512_mul_ps(d, _mm512_set1_ps(1.0f / 90.0f)), _mm512_set1_ps(0.5f)), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    const __m512 r = _mm512_mul_ps(_mm512_sub_ps(d, _mm512_mul_ps(k, _mm512_set1_ps(90.0f))), _mm512_set1_ps(DE_DEG_TO_RAD));
+    const __m512 sp = SinPolyAvx512(r), cp = CosPolyAvx512(r);
+    const __m512i q = _mm512_cvttps_epi32(k);
+    const __mmask16 odd = _mm512_cmpeq_epi32_mask(_mm512_and_si512(q, one), one);
+    s = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(_mm512_mask_blend_ps(odd, sp, cp)), _mm512_castps_si512(_mm512_castsi512_ps(_mm512_slli_epi32(_mm512_and_si512(q, two), 30)))));
+    c = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(_mm512_mask_blend_ps(odd, cp, sp)), _mm512_castps_si512(_mm512_castsi512_ps(_mm512_slli_epi32(_mm512_and_si512(_mm512_add_epi32(q, one), two), 30)))));
+}
+
+KERNEL_TARGET("avx512f,avx512bw") KERNEL_NO_CONTRACT
+static inline __m512 Atan2DegAvx512(__m512 y, __m512 x)
+{
+    const __m512 ax = _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(x), _mm512_set1_epi32(0x7fffffff))), ay = _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(y), _mm512_set1_epi32(0x7fffffff)));
+    const __m512 mx = _mm512_max_ps(ax, ay);
+    const __m512 mn = _mm512_min_ps(ax, ay);
+    const __m512 q = _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(mx, _mm512_setzero_ps(), _CMP_GT_OQ), _mm512_div_ps(mn, mx));
+    const __mmask16 big = _mm512_cmp_ps_mask(q, _mm512_set1_ps(DE_TAN_PI_8), _CMP_GT_OQ);
+    const __m512 t = _mm512_mask_blend_ps(big, q, _mm512_div_ps(_mm512_sub_ps(q, _mm512_set1_ps(1.0f)), _mm512_add_ps(q, _mm512_set1_ps(1.0f))));
+    const __m512 z = _mm512_mul_ps(t, t);
+    const __m512 p = _mm512_sub_ps(_mm512_mul_ps(_mm512_add_ps(_mm512_mul_ps(_mm512_sub_ps(_mm512_mul_ps(_mm512_set1_ps(8.05374449538e-2f), z), _mm512_set1_ps(1.38776856032e-1f)), z), _mm512_set1_ps(1.99777106478e-1f)), z), _mm512_set1_ps(3.33329491539e-1f));
+    __m512 a = _mm512_add_ps(_mm512_mul_ps(_mm512_mul_ps(p, z), t), t);
+    a = _mm512_mask_blend_ps(big, a, _mm512_add_ps(a, _mm512_set1_ps(DE_PI * 0.25f)));
+    a = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(ay, ax, _CMP_GT_OQ), a, _mm512_sub_ps(_mm512_set1_ps(DE_PI * 0.5f), a));
+    a = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_LT_OQ), a, _mm512_sub_ps(_mm512_set1_ps(DE_PI), a));
+    a = _mm512_mul_ps(a, _mm512_set1_ps(DE_RAD_TO_DEG));
+    return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(y, _mm512_setzero_ps(), _CMP_LT_OQ), a, _mm512_sub_ps(_mm512_set1_ps(360.0f), a));
+}
+
+KERNEL_TARGET("avx512f,avx512bw") KERNEL_NO_CONTRACT
+static inline __m512 ExpNegAvx512(__m512 u)
+{
+    const __m512 t = _mm512_mul_ps(u, _mm512_set1_ps(1.44269504f));
+    const __m512 k = _mm512_roundscale_ps(_mm512_add_ps(t, _mm512_set1_ps(0.5f)), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    const __m512 f = _mm512_mul_ps(_mm512_sub_ps(t, k), _mm512_set1_ps(0.693147181f));
+    __m512 p = _mm512_set1_ps(1.0f / 5040.0f);
+    p = _mm512_add_ps(_mm512_mul_ps(p, f), _mm512_set1_ps(1.0f / 720.0f));
+    p = _mm512_add_ps(_mm512_mul_ps(p, f), _mm512_set1_ps(1.0f / 120.0f));
+    p = _mm512_add_ps(_mm512_mul_ps(p, f), _mm512_set1_ps(1.0f / 24.0f));
+    p = _mm512_add_ps(_mm512_mul_ps(p, f), _mm512_set1_ps(1.0f / 6.0f));
+    p = _mm512_add_ps(_mm512_mul_ps(p, f), _mm512_set1_ps(0.5f));
+    p = _mm512_add_ps(_mm512_mul_ps(p, f), _mm512_set1_ps(1.0f));
+    p = _mm512_add_ps(_mm512_mul_ps(p, f), _mm512_set1_ps(1.0f));
+    const __m512 scale = _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(_mm512_cvttps_epi32(k), _mm512_set1_epi32(127)), 23));
+    return _mm512_mul_ps(p, scale);
+}
+
+KERNEL_TARGET("avx512f,avx512bw") KERNEL_NO_CONTRACT
+static inline __m512 Pow7Avx512(__m512 x)
+{
+    const __m512 x2 = _mm512_mul_ps(x, x);
+    const __m512 x4 = _mm512_mul_ps(x2, x2);
+    return _mm512_mul_ps(_mm512_mul_ps(x4, x2), x);
+}
+
+KERNEL_TARGET("avx512f,avx512bw") KERNEL_NO_CONTRACT
+static void DeltaE76F32Avx512(float* de, const float* const* lab, const float* const* ref, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m512 dl = _mm512_sub_ps(_mm512_loadu_ps(lab[0] + i), _mm512_loadu_ps(ref[0] + i));
+        const __m512 da = _mm512_sub_ps(_mm512_loadu_ps(lab[1] + i), _mm512_loadu_ps(ref[1] + i));
+        const __m512 db = _mm512_sub_ps(_mm512_loadu_ps(lab[2] + i), _mm512_loadu_ps(ref[2] + i));
+        _mm512_storeu_ps(de + i, _mm512_sqrt_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dl, dl), _mm512_mul_ps(da, da)), _mm512_mul_ps(db, db))));
+    }
+    DeltaE76F32Range(de, lab, ref, i, n);
+}
+
+KERNEL_TARGET("avx512f,avx512bw") KERNEL_NO_CONTRACT
+static void DeltaE94F32Avx512(float* de, const float* const* lab, const float* const* ref, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m512 l1 = _mm512_loadu_ps(ref[0] + i), a1 = _mm512_loadu_ps(ref[1] + i), b1 = _mm512_loadu_ps(ref[2] + i);
+        const __m512 l2 = _mm512_loadu_ps(lab[0] + i), a2 = _mm512_loadu_ps(lab[1] + i), b2 = _mm512_loadu_ps(lab[2] + i);
+        const __m512 c1 = _mm512_sqrt_ps(_mm512_add_ps(_mm512_mul_ps(a1, a1), _mm512_mul_ps(b1, b1)));
+        const __m512 c2 = _mm512_sqrt_ps(_mm512_add_ps(_mm512_mul_ps(a2, a2), _mm512_mul_ps(b2, b2)));
+        const __m512 dl = _mm512_sub_ps(l2, l1), da = _mm512_sub_ps(a2, a1), db = _mm512_sub_ps(b2, b1);
+        const __m512 dc = _mm512_sub_ps(c2, c1);
+        const __m512 dh2 = _mm512_max_ps(_mm512_sub_ps(_mm512_add_ps(_mm512_mul_ps(da, da), _mm512_mul_ps(db, db)), _mm512_mul_ps(dc, dc)), _mm512_setzero_ps());
+        const __m512 sc = _mm512_add_ps(_mm512_set1_ps(1.0f), _mm512_mul_ps(_mm512_set1_ps(0.045f), c1));
+        const __m512 sh = _mm512_add_ps(_mm512_set1_ps(1.0f), _mm512_mul_ps(_mm512_set1_ps(0.015f), c1));
+        const __m512 dcs = _mm512_div_ps(dc, sc);
+        _mm512_storeu_ps(de + i, _mm512_sqrt_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dl, dl), _mm512_mul_ps(dcs, dcs)), _mm512_div_ps(dh2, _mm512_mul_ps(sh, sh)))));
+    }
+    DeltaE94F32Range(de, lab, ref, i, n);
+}
+
+KERNEL_TARGET("avx512f,avx512bw") KERNEL_NO_CONTRACT
+static void DeltaE2000F32Avx512(float* de, const float* const* lab, const float* const* ref, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m512 l1 = _mm512_loadu_ps(ref[0] + i), a1 = _mm512_loadu_ps(ref[1] + i), b1 = _mm512_loadu_ps(ref[2] + i);
+        const __m512 l2 = _mm512_loadu_ps(lab[0] + i), a2 = _mm512_loadu_ps(lab[1] + i), b2 = _mm512_loadu_ps(lab[2] + i);
+        const __m512 c1 = _mm512_sqrt_ps(_mm512_add_ps(_mm512_mul_ps(a1, a1), _mm512_mul_ps(b1, b1)));
+        const __m512 c2 = _mm512_sqrt_ps(_mm512_add_ps(_mm512_mul_ps(a2, a2), _mm512_mul_ps(b2, b2)));
+        const __m512 cm7 = Pow7Avx512(_mm512_mul_ps(_mm512_add_ps(c1, c2), _mm512_set1_ps(0.5f)));
+        const __m512 g = _mm512_mul_ps(_mm512_set1_ps(0.5f), _mm512_sub_ps(_mm512_set1_ps(1.0f), _mm512_sqrt_ps(_mm512_div_ps(cm7, _mm512_add_ps(cm7, _mm512_set1_ps(DE_POW7_25))))));
+        const __m512 a1p = _mm512_mul_ps(a1, _mm512_add_ps(_mm512_set1_ps(1.0f), g));
+        const __m512 a2p = _mm512_mul_ps(a2, _mm512_add_ps(_mm512_set1_ps(1.0f), g));
+        const __m512 c1p = _mm512_sqrt_ps(_mm512_add_ps(_mm512_mul_ps(a1p, a1p), _mm512_mul_ps(b1, b1)));
+        const __m512 c2p = _mm512_sqrt_ps(_mm512_add_ps(_mm512_mul_ps(a2p, a2p), _mm512_mul_ps(b2, b2)));
+        const __m512 h1p = Atan2DegAvx512(b1, a1p);
+        const __m512 h2p = Atan2DegAvx512(b2, a2p);
+        const __m512 cprod = _mm512_mul_ps(c1p, c2p);
+        const __mmask16 chromatic = _mm512_cmp_ps_mask(cprod, _mm512_setzero_ps(), _CMP_NEQ_UQ);
+
+        __m512 dhp = _mm512_sub_ps(h2p, h1p);
+        dhp = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(dhp, _mm512_set1_ps(180.0f), _CMP_GT_OQ), dhp, _mm512_sub_ps(dhp, _mm512_set1_ps(360.0f)));
+        dhp = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(dhp, _mm512_set1_ps(-180.0f), _CMP_LT_OQ), dhp, _mm512_add_ps(dhp, _mm512_set1_ps(360.0f)));
+        dhp = _mm512_maskz_mov_ps(chromatic, dhp);
+        __m512 sin_half, cos_half;
+        SinCosDegAvx512(_mm512_mul_ps(dhp, _mm512_set1_ps(0.5f)), sin_half, cos_half);
+        const __m512 dh = _mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(2.0f), _mm512_sqrt_ps(cprod)), sin_half);
+        const __m512 hsum = _mm512_add_ps(h1p, h2p);
+        const __m512 hwrap = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(hsum, _mm512_set1_ps(360.0f), _CMP_LT_OQ), _mm512_mul_ps(_mm512_sub_ps(hsum, _mm512_set1_ps(360.0f)), _mm512_set1_ps(0.5f)), _mm512_mul_ps(_mm512_add_ps(hsum, _mm512_set1_ps(360.0f)), _mm512_set1_ps(0.5f)));
+        __m512 hm = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(_mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(_mm512_sub_ps(h1p, h2p)), _mm512_set1_epi32(0x7fffffff))), _mm512_set1_ps(180.0f), _CMP_GT_OQ), _mm512_mul_ps(hsum, _mm512_set1_ps(0.5f)), hwrap);
+        hm = _mm512_mask_blend_ps(chromatic, hsum, hm);
+
+        __m512 s, c;
+        SinCosDegAvx512(hm, s, c);
+        const __m512 c2h = _mm512_sub_ps(_mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(2.0f), c), c), _mm512_set1_ps(1.0f));
+        const __m512 s2h = _mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(2.0f), s), c);
+        const __m512 c3h = _mm512_mul_ps(_mm512_sub_ps(_mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(4.0f), c), c), _mm512_set1_ps(3.0f)), c);
+        const __m512 s3h = _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(3.0f), _mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(4.0f), s), s)), s);
+        const __m512 c4h = _mm512_sub_ps(_mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(2.0f), c2h), c2h), _mm512_set1_ps(1.0f));
+        const __m512 s4h = _mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(2.0f), s2h), c2h);
+        __m512 t = _mm512_sub_ps(_mm512_set1_ps(1.0f), _mm512_mul_ps(_mm512_set1_ps(0.17f), _mm512_add_ps(_mm512_mul_ps(c, _mm512_set1_ps(DE_COS_30)), _mm512_mul_ps(s, _mm512_set1_ps(DE_SIN_30)))));
+        t = _mm512_add_ps(t, _mm512_mul_ps(_mm512_set1_ps(0.24f), c2h));
+        t = _mm512_add_ps(t, _mm512_mul_ps(_mm512_set1_ps(0.32f), _mm512_sub_ps(_mm512_mul_ps(c3h, _mm512_set1_ps(DE_COS_6)), _mm512_mul_ps(s3h, _mm512_set1_ps(DE_SIN_6)))));
+        t = _mm512_sub_ps(t, _mm512_mul_ps(_mm512_set1_ps(0.20f), _mm512_add_ps(_mm512_mul_ps(c4h, _mm512_set1_ps(DE_COS_63)), _mm512_mul_ps(s4h, _mm512_set1_ps(DE_SIN_63)))));
+
+        const __m512 x = _mm512_mul_ps(_mm512_sub_ps(hm, _mm512_set1_ps(275.0f)), _mm512_set1_ps(1.0f / 25.0f));
+        const __m512 xx = _mm512_mul_ps(x, x);
+        const __m512 x2 = _mm512_min_ps(xx, _mm512_set1_ps(16.0f));
+        const __m512 dtheta = _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(xx, _mm512_set1_ps(16.0f), _CMP_LT_OQ), _mm512_mul_ps(_mm512_set1_ps(30.0f), ExpNegAvx512(_mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(x2), _mm512_set1_epi32((int)0x80000000))))));
+        const __m512 cpm = _mm512_mul_ps(_mm512_add_ps(c1p, c2p), _mm512_set1_ps(0.5f));
+        const __m512 cpm7 = Pow7Avx512(cpm);
+        const __m512 rc = _mm512_mul_ps(_mm512_set1_ps(2.0f), _mm512_sqrt_ps(_mm512_div_ps(cpm7, _mm512_add_ps(cpm7, _mm512_set1_ps(DE_POW7_25)))));
+        __m512 sin_2theta, cos_2theta;
+        SinCosDegAvx512(_mm512_mul_ps(_mm512_set1_ps(2.0f), dtheta), sin_2theta, cos_2theta);
+        const __m512 rt = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(_mm512_mul_ps(sin_2theta, rc)), _mm512_set1_epi32((int)0x80000000)));
+
+        const __m512 lm = _mm512_sub_ps(_mm512_mul_ps(_mm512_add_ps(l1, l2), _mm512_set1_ps(0.5f)), _mm512_set1_ps(50.0f));
+        const __m512 lm2 = _mm512_mul_ps(lm, lm);
+        const __m512 sl = _mm512_add_ps(_mm512_set1_ps(1.0f), _mm512_div_ps(_mm512_mul_ps(_mm512_set1_ps(0.015f), lm2), _mm512_sqrt_ps(_mm512_add_ps(_mm512_set1_ps(20.0f), lm2))));
+        const __m512 sc = _mm512_add_ps(_mm512_set1_ps(1.0f), _mm512_mul_ps(_mm512_set1_ps(0.045f), cpm));
+        const __m512 sh = _mm512_add_ps(_mm512_set1_ps(1.0f), _mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(0.015f), cpm), t));
+        const __m512 dls = _mm512_div_ps(_mm512_sub_ps(l2, l1), sl);
+        const __m512 dcs = _mm512_div_ps(_mm512_sub_ps(c2p, c1p), sc);
+        const __m512 dhs = _mm512_div_ps(dh, sh);
+        _mm512_storeu_ps(de + i, _mm512_sqrt_ps(_mm512_add_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dls, dls), _mm512_mul_ps(dcs, dcs)), _mm512_mul_ps(dhs, dhs)), _mm512_mul_ps(_mm512_mul_ps(rt, dcs), dhs))));
+    }
+    DeltaE2000F32Range(de, lab, ref, i, n);
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// Registry
+
+template<size_t N>
+static void RegisterProjectXyz(KernelTable<ProjectXyzF32Fn>& table)
+{
+    table.add(ISA_SCALAR, ProjectXyzF32Scalar<N>);
+#ifdef PIXELKERNELS_X86
+    table.add(ISA_SSE42, ProjectXyzF32Sse42<N>).add(ISA_AVX2, ProjectXyzF32Avx2<N>).add(ISA_AVX512, ProjectXyzF32Avx512<N>);
+#endif
+}
+
+template<size_t N>
+static void RegisterBlend(KernelTable<BlendF32Fn>& table)
+{
+    table.add(ISA_SCALAR, BlendF32Scalar<N>);
+#ifdef PIXELKERNELS_X86
+    table.add(ISA_SSE42, BlendF32Sse42<N>).add(ISA_AVX2, BlendF32Avx2<N>).add(ISA_AVX512, BlendF32Avx512<N>);
+#endif
+}
+
+static void RegisterKernels(PixelKernelRegistry& registry)
+{
+    RegisterProjectXyz<0>(registry.project_xyz_f32);
+    RegisterProjectXyz<13>(registry.project_xyz_f32_13);
+    RegisterProjectXyz<15>(registry.project_xyz_f32_15);
+    RegisterBlend<0>(registry.blend_f32);
+    RegisterBlend<2>(registry.blend_f32_2);
+    RegisterBlend<3>(registry.blend_f32_3);
+    RegisterBlend<4>(registry.blend_f32_4);
+    registry.xyz_to_lab_f32.add(ISA_SCALAR, XyzToLabF32Scalar);
+    registry.xyz_to_lab_f32_exact.add(ISA_SCALAR, XyzToLabF32Exact);
+    registry.encode_rgb_f32.add(ISA_SCALAR, EncodeRgbF32Scalar);
+    registry.delta_e76_f32.add(ISA_SCALAR, DeltaE76F32Scalar);
+    registry.delta_e94_f32.add(ISA_SCALAR, DeltaE94F32Scalar);
+    registry.delta_e2000_f32.add(ISA_SCALAR, DeltaE2000F32Scalar);
+    registry.subtract_clamped_u16.add(ISA_SCALAR, SubtractClampedU16Scalar);
+    registry.subtract_clamped_f32.add(ISA_SCALAR, SubtractClampedF32Scalar);
+    registry.subtract_clamped_f32_u16.add(ISA_SCALAR, SubtractClampedF32U16Scalar);
+    registry.divide_guarded_f32.add(ISA_SCALAR, DivideGuardedF32Scalar);
+    registry.ingest_u16.add(ISA_SCALAR, IngestU16Scalar);
+    registry.ingest_u16_f16.add(ISA_SCALAR, IngestU16F16Scalar);
+    registry.project_xyz_sets_f32.add(ISA_SCALAR, ProjectXyzSetsF32Scalar);
+    registry.accumulate_xyz_f32.add(ISA_SCALAR, AccumulateXyzF32Scalar);
+    registry.convert_f32_f16.add(ISA_SCALAR, ConvertF32F16Scalar);
+    registry.convert_f16_f32.add(ISA_SCALAR, ConvertF16F32Scalar);
+#ifdef PIXELKERNELS_X86
+    registry.subtract_clamped_u16.add(ISA_SSE42, SubtractClampedU16Sse42).add(ISA_AVX2, SubtractClampedU16Avx2).add(ISA_AVX512, SubtractClampedU16Avx512);
+    registry.subtract_clamped_f32.add(ISA_SSE42, SubtractClampedF32Sse42).add(ISA_AVX2, SubtractClampedF32Avx2).add(ISA_AVX512, SubtractClampedF32Avx512);
+    registry.subtract_clamped_f32_u16.add(ISA_SSE42, SubtractClampedF32U16Sse42).add(ISA_AVX2, SubtractClampedF32U16Avx2).add(ISA_AVX512, SubtractClampedF32U16Avx512);
+    registry.divide_guarded_f32.add(ISA_SSE42, DivideGuardedF32Sse42).add(ISA_AVX2, DivideGuardedF32Avx2).add(ISA_AVX512, DivideGuardedF32Avx512);
+    registry.ingest_u16.add(ISA_SSE42, IngestU16Sse42).add(ISA_AVX2, IngestU16Avx2).add(ISA_AVX512, IngestU16Avx512);
+    registry.ingest_u16_f16.add(ISA_AVX2, IngestU16F16Avx2).add(ISA_AVX512, IngestU16F16Avx512);
+    registry.project_xyz_sets_f32.add(ISA_SSE42, ProjectXyzSetsF32Sse42).add(ISA_AVX2, ProjectXyzSetsF32Avx2).add(ISA_AVX512, ProjectXyzSetsF32Avx512);
+    registry.accumulate_xyz_f32.add(ISA_SSE42, AccumulateXyzF32Sse42).add(ISA_AVX2, AccumulateXyzF32Avx2).add(ISA_AVX512, AccumulateXyzF32Avx512);
+    registry.xyz_to_lab_f32.add(ISA_SSE42, XyzToLabF32Sse42).add(ISA_AVX2, XyzToLabF32Avx2).add(ISA_AVX512, XyzToLabF32Avx512);
+    registry.encode_rgb_f32.add(ISA_AVX2, EncodeRgbF32Avx2).add(ISA_AVX512, EncodeRgbF32Avx512);
+    registry.delta_e76_f32.add(ISA_AVX2, DeltaE76F32Avx2).add(ISA_AVX512, DeltaE76F32Avx512);
+    registry.delta_e94_f32.add(ISA_AVX2, DeltaE94F32Avx2).add(ISA_AVX512, DeltaE94F32Avx512);
+    registry.delta_e2000_f32.add(ISA_AVX2, DeltaE2000F32Avx2).add(ISA_AVX512, DeltaE2000F32Avx512);
+    registry.convert_f32_f16.add(ISA_AVX2, ConvertF32F16Avx2).add(ISA_AVX512, ConvertF32F16Avx512);
+    registry.convert_f16_f32.add(ISA_AVX2, ConvertF16F32Avx2).add(ISA_AVX512, ConvertF16F32Avx512);
+#endif
+}
+
+PixelKernelRegistry& PixelKernels()
+{
+    static PixelKernelRegistry registry;
+    static bool registered = (RegisterKernels(registry), true);
+    (void)registered;
+    return registry;
+}
+
+void SubtractClamped(unsigned short* dst, const unsigned short* sub, size_t n)
+{
+    PixelKernels().subtract_clamped_u16.select()(dst, sub, n);
+}
+
+void SubtractClamped(float* dst, const float* sub, size_t n)
+{
+    PixelKernels().subtract_clamped_f32.select()(dst, sub, n);
+}
+
+void SubtractClamped(float* dst, const unsigned short* sub, size_t n)
+{
+    PixelKernels().subtract_clamped_f32_u16.select()(dst, sub, n);
+}
+
+void DivideGuarded(float* dst, const float* divisor, size_t n)
+{
+    PixelKernels().divide_guarded_f32.select()(dst, divisor, n);
+}
+
+void Ingest(float* dst, const unsigned short* raw, const unsigned short* bias, const float* inv_flat, float gain, size_t n)
+{
+    PixelKernels().ingest_u16.select()(dst, raw, bias, inv_flat, gain, n);
+}
+
+void IngestFp16(float* dst, const unsigned short* raw, const unsigned short* bias, const unsigned short* inv_flat_fp16, float gain, size_t n)
+{
+    PixelKernels().ingest_u16_f16.select()(dst, raw, bias, inv_flat_fp16, gain, n);
+}
+
+ProjectXyzF32Fn SelectProjectXyz(size_t nsrc)
+{
+    PixelKernelRegistry& registry = PixelKernels();
+    switch (nsrc) {
+    case 13: return registry.project_xyz_f32_13.select();
+    case 15: return registry.project_xyz_f32_15.select();
+    default: return registry.project_xyz_f32.select();
+    }
+}
+
+void ProjectXyz(float* const* dst, const float* const* src, const float* weights, size_t nsrc, size_t n)
+{
+    SelectProjectXyz(nsrc)(dst, src, weights, nsrc, n);
+}
+
+void ProjectXyzSets(float* const* dst, const float* const* src, const float* weights, size_t nsrc, size_t nsets, size_t n)
+{
+    PixelKernels().project_xyz_sets_f32.select()(dst, src, weights, nsrc, nsets, n);
+}
+
+void AccumulateXyz(float* const* dst, const float* src, const float* weights, size_t n)
+{
+    PixelKernels().accumulate_xyz_f32.select()(dst, src, weights, n);
+}
+
+BlendF32Fn SelectBlend(size_t nsrc)
+{
+    PixelKernelRegistry& registry = PixelKernels();
+    switch (nsrc) {
+    case 2: return registry.blend_f32_2.select();
+    case 3: return registry.blend_f32_3.select();
+    case 4: return registry.blend_f32_4.select();
+    default: return registry.blend_f32.select();
+    }
+}
+
+void Blend(float* dst, const float* const* src, const float* weights, size_t nsrc, size_t n)
+{
+    SelectBlend(nsrc)(dst, src, weights, nsrc, n);
+}
+
+void XyzToLab(float* const* lab, const float* const* xyz, size_t n)
+{
+    PixelKernels().xyz_to_lab_f32.select()(lab, xyz, n);
+}
+
+void XyzToLabExact(float* const* lab, const float* const* xyz, size_t n)
+{
+    PixelKernels().xyz_to_lab_f32_exact.select()(lab, xyz, n);
+}
+
+void BuildCurveLut(float* lut, const std::function<double(double)>& curve)
+{
+    const size_t samples = (CURVE_LUT_OCTAVES * CURVE_LUT_STEPS) + 1;
+    for (size_t k = 0; k < samples; ++k) {
+        const double v = std::ldexp(1.0 + (double)(k % CURVE_LUT_STEPS) / CURVE_LUT_STEPS, (int)(k / CURVE_LUT_STEPS) - CURVE_LUT_OCTAVES);
+        lut[k] = (float)curve(v);
+    }
+    lut[samples] = lut[samples - 1];
+    lut[CURVE_LUT_TOE] = lut[0] / CURVE_LUT_MIN;
+}
+
+void EncodeRgb(float* const* rgb, const float* const* xyz, const float* matrix, const float* curve, size_t n)
+{
+    PixelKernels().encode_rgb_f32.select()(rgb, xyz, matrix, curve, n);
+}
+
+void DeltaE76(float* de, const float* const* lab, const float* const* ref, size_t n)
+{
+    PixelKernels().delta_e76_f32.select()(de, lab, ref, n);
+}
+
+void DeltaE94(float* de, const float* const* lab, const float* const* ref, size_t n)
+{
+    PixelKernels().delta_e94_f32.select()(de, lab, ref, n);
+}
+
+void DeltaE2000(float* de, const float* const* lab, const float* const* ref, size_t n)
+{
+    PixelKernels().delta_e2000_f32.select()(de, lab, ref, n);
+}
+
+void HalfToFloat(float* dst, const unsigned short* src, size_t n)
+{
+    PixelKernels().convert_f16_f32.select()(dst, src, n);
+}
+
+void FloatToHalf(unsigned short* dst, const float* src, size_t n)
+{
+    PixelKernels().convert_f32_f16.select()(dst, src, n);
+}
+
+void ParallelRows(size_t height, size_t min_rows, const std::function<void(size_t, size_t)>& fn)
+{
+    size_t nthreads = std::thread::hardware_concurrency();
+    nthreads = std::max((size_t)1, std::min(nthreads, height / std::max(min_rows, (size_t)1)));
+    const size_t rows_per_thread = (height + nthreads - 1) / nthreads;
+
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < nthreads; ++t) {
+        const size_t first = std::min(t * rows_per_thread, height);
+        threads.push_back(std::thread(fn, first, std::min(first + rows_per_thread, height)));
+    }
+    fn(0, std::min(rows_per_thread, height));
+    for (size_t t = 0; t < threads.size(); ++t) {
+        threads[t].join();
+    }
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+// PixelKernels: row kernels with SSE4.2, AVX2 and AVX-512 implementations picked at runtime.
+//
+// Every kernel has a scalar implementation that defines its exact result; the SIMD versions are
+// branch-free and produce bit-identical output. Kernels are registered in a KernelTable, one per
+// kernel, and the table hands out the best implementation the CPU (and OS) supports.
+// New kernels add a KernelTable member to PixelKernelRegistry and register their variants in
+// PixelKernels.cpp.
+
+enum KernelIsa {
+    ISA_SCALAR = 0,
+    ISA_SSE42,
+    ISA_AVX2,       // AVX2 + F16C
+    ISA_AVX512,     // AVX-512 F + BW
+    ISA_COUNT
+};
+
+// Best instruction set supported by this machine, capped by SetMaxKernelIsa.
+KernelIsa ActiveKernelIsa();
+// Limits dispatch to isa and below, e.g. ISA_SCALAR to compare against the reference implementation.
+void SetMaxKernelIsa(KernelIsa isa);
+const char* KernelIsaName(KernelIsa isa);
+
+template<typename Fn>
+class KernelTable
+{
+public:
+    KernelTable()
+    {
+        for (int isa = 0; isa < ISA_COUNT; ++isa) {
+            impls_[isa] = NULL;
+        }
+    }
+    KernelTable& add(KernelIsa isa, Fn fn)
+    {
+        impls_[isa] = fn;
+        return *this;
+    }
+    // Best registered implementation not above ActiveKernelIsa(). Every table registers ISA_SCALAR.
+    Fn select() const
+    {
+        for (int isa = ActiveKernelIsa(); isa > ISA_SCALAR; --isa) {
+            if (impls_[isa]) {
+                return impls_[isa];
+            }
+        }
+        return impls_[ISA_SCALAR];
+    }
+    Fn get(KernelIsa isa) const { return impls_[isa]; }
+
+private:
+    Fn impls_[ISA_COUNT];
+};
+
+// Row kernel signatures. n is the number of pixels; dst and src may have any alignment.
+typedef void (*SubtractClampedU16Fn)(unsigned short* dst, const unsigned short* sub, size_t n);
+typedef void (*SubtractClampedF32Fn)(float* dst, const float* sub, size_t n);
+typedef void (*SubtractClampedF32U16Fn)(float* dst, const unsigned short* sub, size_t n);
+typedef void (*DivideGuardedF32Fn)(float* dst, const float* divisor, size_t n);
+typedef void (*IngestU16Fn)(float* dst, const unsigned short* raw, const unsigned short* bias, const float* inv_flat, float gain, size_t n);
+typedef void (*IngestU16F16Fn)(float* dst, const unsigned short* raw, const unsigned short* bias, const unsigned short* inv_flat_fp16, float gain, size_t n);
+typedef void (*ProjectXyzF32Fn)(float* const* dst, const float* const* src, const float* weights, size_t nsrc, size_t n);
+typedef void (*ProjectXyzSetsF32Fn)(float* const* dst, const float* const* src, const float* weights, size_t nsrc, size_t nsets, size_t n);
+typedef void (*AccumulateXyzF32Fn)(float* const* dst, const float* src, const float* weights, size_t n);
+typedef void (*BlendF32Fn)(float* dst, const float* const* src, const float* weights, size_t nsrc, size_t n);
+typedef void (*XyzToLabF32Fn)(float* const* lab, const float* const* xyz, size_t n);
+typedef void (*EncodeRgbF32Fn)(float* const* rgb, const float* const* xyz, const float* matrix, const float* curve, size_t n);
+typedef void (*DeltaEF32Fn)(float* de, const float* const* lab, const float* const* ref, size_t n);
+typedef void (*ConvertF32F16Fn)(unsigned short* dst, const float* src, size_t n);
+typedef void (*ConvertF16F32Fn)(float* dst, const unsigned short* src, size_t n);
+
+struct PixelKernelRegistry
+{
+    KernelTable<SubtractClampedU16Fn> subtract_clamped_u16;
+    KernelTable<SubtractClampedF32Fn> subtract_clamped_f32;
+    KernelTable<SubtractClampedF32U16Fn> subtract_clamped_f32_u16;
+    KernelTable<DivideGuardedF32Fn> divide_guarded_f32;
+    KernelTable<IngestU16Fn> ingest_u16;
+    KernelTable<IngestU16F16Fn> ingest_u16_f16;
+    KernelTable<ProjectXyzF32Fn> project_xyz_f32;
+    KernelTable<ProjectXyzF32Fn> project_xyz_f32_13;    // filterconfig_51414
+    KernelTable<ProjectXyzF32Fn> project_xyz_f32_15;    // filterconfig_43014
+    KernelTable<ProjectXyzSetsF32Fn> project_xyz_sets_f32;
+    KernelTable<AccumulateXyzF32Fn> accumulate_xyz_f32;
+    KernelTable<BlendF32Fn> blend_f32;
+    KernelTable<BlendF32Fn> blend_f32_2;
+    KernelTable<BlendF32Fn> blend_f32_3;
+    KernelTable<BlendF32Fn> blend_f32_4;
+    KernelTable<XyzToLabF32Fn> xyz_to_lab_f32;
+    KernelTable<XyzToLabF32Fn> xyz_to_lab_f32_exact;   // scalar only
+    KernelTable<EncodeRgbF32Fn> encode_rgb_f32;         // no SSE4.2 variant (needs gathers)
+    KernelTable<DeltaEF32Fn> delta_e76_f32;             // delta E kernels: AVX2 and AVX-512 only
+    KernelTable<DeltaEF32Fn> delta_e94_f32;
+    KernelTable<DeltaEF32Fn> delta_e2000_f32;
+    KernelTable<ConvertF32F16Fn> convert_f32_f16;       // half float rows: AVX2 (F16C) and AVX-512 only
+    KernelTable<ConvertF16F32Fn> convert_f16_f32;
+};
+
+PixelKernelRegistry& PixelKernels();
+
+// dst[i] = dst[i] > sub[i] ? dst[i] - sub[i] : 0
+void SubtractClamped(unsigned short* dst, const unsigned short* sub, size_t n);
+void SubtractClamped(float* dst, const float* sub, size_t n);
+void SubtractClamped(float* dst, const unsigned short* sub, size_t n);
+
+// Scalar fallback for pixel types without a kernel.
+template<typename T, typename S>
+inline void SubtractClamped(T* dst, const S* sub, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        if (dst[i] > sub[i]) {
+            dst[i] -= sub[i];
+        } else {
+            dst[i] = 0;
+        }
+    }
+}
+
+// dst[i] = divisor[i] == 0 ? 0 : dst[i] / divisor[i]
+void DivideGuarded(float* dst, const float* divisor, size_t n);
+
+template<typename T, typename S>
+inline void DivideGuarded(T* dst, const S* divisor, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        if (divisor[i] == 0) {
+            dst[i] = 0;
+        } else {
+            dst[i] /= divisor[i];
+        }
+    }
+}
+
+// Frame ingest, bias subtraction, flat-field correction and gain in one pass:
+// dst[i] = (raw[i] > bias[i] ? raw[i] - bias[i] : 0) * inv_flat[i] * gain
+// inv_flat holds reciprocal flat-field values (0 where the flat field is 0, see DivideGuarded).
+void Ingest(float* dst, const unsigned short* raw, const unsigned short* bias, const float* inv_flat, float gain, size_t n);
+// Same as Ingest, with the reciprocal flat field stored as IEEE half floats.
+void IngestFp16(float* dst, const unsigned short* raw, const unsigned short* bias, const unsigned short* inv_flat_fp16, float gain, size_t n);
+
+// Spectral to XYZ projection of one row of nsrc bands:
+// dst[c][i] = sum over f of src[f][i] * weights[f * 3 + c], for c = 0, 1, 2, summed in band order.
+// dst[c] may be src[c]: every band of a pixel is read before the pixel is written.
+// 13 and 15 bands (the production filter layouts) have kernels specialized for that count.
+void ProjectXyz(float* const* dst, const float* const* src, const float* weights, size_t nsrc, size_t n);
+// Kernel ProjectXyz uses for nsrc bands, to look it up once per image rather than once per row.
+ProjectXyzF32Fn SelectProjectXyz(size_t nsrc);
+// nsets projections of the same row at once (several illuminants or observers), with weights of nsrc rows of
+// 3 * nsets: dst[s * 3 + c][i] = sum over f of src[f][i] * weights[f * 3 * nsets + s * 3 + c], summed in band order,
+// so every set comes out exactly as ProjectXyz with that set's weights. The bands of a block of pixels are read
+// from memory once and projected for every set from cache. dst rows must not be src rows.
+void ProjectXyzSets(float* const* dst, const float* const* src, const float* weights, size_t nsrc, size_t nsets, size_t n);
+// One band at a time: dst[c][i] += src[i] * weights[c], for c = 0, 1, 2.
+void AccumulateXyz(float* const* dst, const float* src, const float* weights, size_t n);
+// Weighted sum of nsrc rows: dst[i] = sum over l of src[l][i] * weights[l], summed in order.
+// dst may be one of the src rows (dst[i] += ... with weight 1 for it).
+// 2, 3 and 4 sources have specialized kernels.
+void Blend(float* dst, const float* const* src, const float* weights, size_t nsrc, size_t n);
+BlendF32Fn SelectBlend(size_t nsrc);
+
+// CIE XYZ (white point normalized, Y = 1 for white) to L*a*b* for one row: lab[c] may be xyz[c].
+// XyzToLab takes the cube root with a bit-level first guess and two Halley steps, relative error below 2^-21
+// (about 3 ulp; checked for every float above 216/24389), and picks the linear segment with a compare mask.
+// XyzToLabExact uses cbrt.
+void XyzToLab(float* const* lab, const float* const* xyz, size_t n);
+void XyzToLabExact(float* const* lab, const float* const* xyz, size_t n);
+
+// Transfer curve table for EncodeRgb, CURVE_LUT_SIZE floats filled by BuildCurveLut. The curve is sampled
+// CURVE_LUT_STEPS times per octave from 2^-CURVE_LUT_OCTAVES up to 1 and interpolated linearly in between, so
+// the table is as fine near black, where power curves are steep, as near white. Below the first sample the curve
+// is taken as the line through 0 and that sample.
+static const int CURVE_LUT_OCTAVES = 24;
+static const int CURVE_LUT_STEPS = 128;
+static const size_t CURVE_LUT_SIZE = (CURVE_LUT_OCTAVES * CURVE_LUT_STEPS) + 3;
+// curve maps [0, 1] onto [0, 1].
+void BuildCurveLut(float* lut, const std::function<double(double)>& curve);
+// Output encoding of one row: linear = sum over k of matrix[c * 3 + k] * xyz[k][i] (summed in order), clamped to
+// [0, 1] with NaN taken as 0, then rgb[c][i] = curve(linear) from a BuildCurveLut table. rgb[c] may be xyz[c].
+void EncodeRgb(float* const* rgb, const float* const* xyz, const float* matrix, const float* curve, size_t n);
+
+// Color difference between rows of L*a*b* samples and references: de[i] = delta E (lab[.][i], ref[.][i]).
+// DeltaE94 uses the graphic arts weights (kL = 1, K1 = 0.045, K2 = 0.015) and the reference's chroma.
+// DeltaE2000 follows CIE 142-2001 (Sharma's formulation) in single precision. Its hue angles and trigonometric
+// terms come from polynomial atan, sin, cos and exp with errors of a few ulp, and the hue arc tests compare
+// those angles. All 34 pairs of Sharma's test data agree with the published values to 5e-5.
+void DeltaE76(float* de, const float* const* lab, const float* const* ref, size_t n);
+void DeltaE94(float* de, const float* const* lab, const float* const* ref, size_t n);
+void DeltaE2000(float* de, const float* const* lab, const float* const* ref, size_t n);
+
+// Runs fn(first, last) over bands of rows covering [0, height), one band per thread, up to the number of cores
+// and with at least min_rows rows per band. Returns when every band is done.
+void ParallelRows(size_t height, size_t min_rows, const std::function<void(size_t, size_t)>& fn);
+
+// IEEE 754 half <-> float conversion. FloatToHalf rounds to nearest even; HalfToFloat is exact.
+float HalfToFloat(unsigned short h);
+unsigned short FloatToHalf(float value);
+// The same conversions for rows of n values.
+void HalfToFloat(float* dst, const unsigned short* src, size_t n);
+void FloatToHalf(unsigned short* dst, const float* src, size_t n);
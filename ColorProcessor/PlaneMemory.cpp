@@ -0,0 +1,218 @@
+#include "PlaneMemory.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+static std::atomic<int> default_storage(STORAGE_PACKED);
+
+int DefaultPlaneStorage()
+{
+    return default_storage.load();
+}
+
+void SetDefaultPlaneStorage(int storage)
+{
+    default_storage.store(storage);
+}
+
+#ifdef _WIN32
+// Large pages need SeLockMemoryPrivilege; without it VirtualAlloc fails and we fall back to normal pages.
+// Either way the block comes from VirtualAlloc, so FreePlaneMemory can always release it with VirtualFree.
+static void* AllocateHugePages(size_t bytes)
+{
+    SIZE_T large_page = GetLargePageMinimum();
+    void* block = NULL;
+    if (large_page) {
+        SIZE_T rounded = (bytes + large_page - 1) / large_page * large_page;
+        block = VirtualAlloc(NULL, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    }
+    if (!block) {
+        block = VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    }
+    return block;
+}
+#else
+// Anonymous mappings are page aligned; MADV_HUGEPAGE asks for transparent huge pages where available.
+static void* AllocateHugePages(size_t bytes)
+{
+    void* block = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (block == MAP_FAILED) {
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(block, bytes, MADV_HUGEPAGE);
+#endif
+    return block;
+}
+#endif
+
+// Allocation and release of blocks that are not pooled.
+static void* AllocateBlock(size_t bytes, int storage)
+{
+    void* block = NULL;
+    if (storage & STORAGE_HUGE_PAGES) {
+        block = AllocateHugePages(bytes);
+    } else {
+#ifdef _WIN32
+        block = _aligned_malloc(bytes, PLANE_ALIGNMENT);
+#else
+        if (posix_memalign(&block, PLANE_ALIGNMENT, bytes) != 0) {
+            block = NULL;
+        }
+#endif
+    }
+    if (!block) {
+        throw std::bad_alloc();
+    }
+    return block;
+}
+
+static void FreeBlock(void* block, size_t bytes, int storage)
+{
+    if (storage & STORAGE_HUGE_PAGES) {
+#ifdef _WIN32
+        VirtualFree(block, 0, MEM_RELEASE);
+#else
+        munmap(block, bytes);
+#endif
+    } else {
+#ifdef _WIN32
+        _aligned_free(block);
+#else
+        free(block);
+#endif
+    }
+}
+
+size_t PlaneBlockSize(size_t bytes, int storage)
+{
+    if (bytes == 0) {
+        return 0;
+    }
+    return (storage & STORAGE_POOLED) ? PlanePool::sizeClass(bytes) : bytes;
+}
+
+void* AllocatePlaneMemory(size_t bytes, int storage)
+{
+    if (bytes == 0) {
+        return NULL;
+    }
+    if (storage & STORAGE_POOLED) {
+        return PlanePool::instance().acquire(bytes, storage);
+    }
+    return AllocateBlock(bytes, storage);
+}
+
+void FreePlaneMemory(void* block, size_t bytes, int storage)
+{
+    if (!block) {
+        return;
+    }
+    if (storage & STORAGE_POOLED) {
+        PlanePool::instance().release(block, bytes, storage);
+    } else {
+        FreeBlock(block, bytes, storage);
+    }
+}
+
+// PlanePool
+
+PlanePool& PlanePool::instance()
+{
+    static PlanePool pool;
+    return pool;
+}
+
+PlanePool::PlanePool() : capacity_(size_t(2) << 30), cached_bytes_(0)
+{ }
+
+size_t PlanePool::sizeClass(size_t bytes)
+{
+    const size_t min_class = 4096;
+    if (bytes <= min_class) {
+        return min_class;
+    }
+    size_t power = min_class;
+    while (power < bytes) {
+        power <<= 1;
+    }
+    // bytes lies in (power / 2, power]; round up to one of the four classes power/2 + k * power/8
+    return RoundUpToAlignment(bytes, power / 8);
+}
+
+void* PlanePool::acquire(size_t bytes, int storage)
+{
+    const size_t block_bytes = sizeClass(bytes);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::map<PoolKey, std::vector<void*>>::iterator it = free_blocks_.find(PoolKey(block_bytes, storage & STORAGE_HUGE_PAGES));
+        if (it != free_blocks_.end() && !it->second.empty()) {
+            void* block = it->second.back();
+            it->second.pop_back();
+            cached_bytes_ -= block_bytes;
+            return block;
+        }
+    }
+    return AllocateBlock(block_bytes, storage);
+}
+
+void PlanePool::release(void* block, size_t bytes, int storage)
+{
+    const size_t block_bytes = sizeClass(bytes);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cached_bytes_ + block_bytes <= capacity_) {
+            free_blocks_[PoolKey(block_bytes, storage & STORAGE_HUGE_PAGES)].push_back(block);
+            cached_bytes_ += block_bytes;
+            return;
+        }
+    }
+    FreeBlock(block, block_bytes, storage);
+}
+
+void PlanePool::setCapacity(size_t bytes)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        capacity_ = bytes;
+        if (cached_bytes_ <= capacity_) {
+            return;
+        }
+    }
+    trim();
+}
+
+size_t PlanePool::capacity() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return capacity_;
+}
+
+size_t PlanePool::cachedBytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cached_bytes_;
+}
+
+void PlanePool::trim()
+{
+    std::map<PoolKey, std::vector<void*>> blocks;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        blocks.swap(free_blocks_);
+        cached_bytes_ = 0;
+    }
+    for (std::map<PoolKey, std::vector<void*>>::iterator it = blocks.begin(); it != blocks.end(); ++it) {
+        for (size_t i = 0; i < it->second.size(); ++i) {
+            FreeBlock(it->second[i], it->first.first, it->first.second);
+        }
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// PlaneMemory: allocation helpers for RawImage plane storage.
+// Every RawImage keeps all of its planes in a single block aligned to PLANE_ALIGNMENT bytes,
+// with each plane starting on an aligned boundary.
+
+static const size_t PLANE_ALIGNMENT = 64;
+
+// Storage flags, combined with |
+enum PlaneStorage {
+    STORAGE_PACKED = 0,         // row stride == width, planes back to back
+    STORAGE_PADDED_ROWS = 1,    // every row padded to a multiple of PLANE_ALIGNMENT bytes
+    STORAGE_HUGE_PAGES = 2,     // back the block with huge/large pages where the OS allows it
+    STORAGE_POOLED = 4          // draw the block from PlanePool::instance() and return it there when freed
+};
+
+// Rounds bytes up to the next multiple of alignment (alignment must be a power of two).
+inline size_t RoundUpToAlignment(size_t bytes, size_t alignment = PLANE_ALIGNMENT)
+{
+    return (bytes + alignment - 1) & ~(alignment - 1);
+}
+
+// Number of bytes actually reserved for a request of bytes bytes (pooled blocks are rounded up to their size class).
+size_t PlaneBlockSize(size_t bytes, int storage);
+
+// Returns a block of at least bytes bytes aligned to PLANE_ALIGNMENT, or NULL if bytes is 0.
+// Release it with FreePlaneMemory using the same bytes and storage values.
+// Pooled callers should pass PlaneBlockSize(bytes, storage) so the block can be recycled.
+void* AllocatePlaneMemory(size_t bytes, int storage);
+void FreePlaneMemory(void* block, size_t bytes, int storage);
+
+// Storage flags used by RawImage when none are passed to its constructor.
+int DefaultPlaneStorage();
+void SetDefaultPlaneStorage(int storage);
+
+// PlanePool: process-wide cache of plane blocks, keyed by size class and page type.
+// Size classes split every power of two into four steps, so a block is never more than 25% larger
+// than the request. Freed blocks are kept (already faulted in) until the cache reaches its capacity,
+// which lets back-to-back captures of the same size run without touching the heap.
+class PlanePool
+{
+public:
+    static PlanePool& instance();
+
+    static size_t sizeClass(size_t bytes);
+
+    void* acquire(size_t bytes, int storage);
+    void release(void* block, size_t bytes, int storage);
+
+    // Upper bound on the bytes kept in the cache. Blocks released beyond it are freed immediately.
+    void setCapacity(size_t bytes);
+    size_t capacity() const;
+    size_t cachedBytes() const;
+    // Frees every cached block.
+    void trim();
+
+private:
+    PlanePool();
+    PlanePool(const PlanePool&);
+    PlanePool& operator=(const PlanePool&);
+
+    typedef std::pair<size_t, int> PoolKey;     // (size class, STORAGE_HUGE_PAGES or 0)
+
+    mutable std::mutex mutex_;
+    std::map<PoolKey, std::vector<void*>> free_blocks_;
+    size_t capacity_;
+    size_t cached_bytes_;
+};
@@ -0,0 +1,86 @@
+#include "PreviewPyramid.h"
+#include "BlendEngine.h"
+
+#include <algorithm>
+#include <opencv2/imgproc/imgproc.hpp>
+
+// cv::Mat header over channel n of img.
+static cv::Mat ChannelMat(const XYZImage& img, int n)
+{
+    return cv::Mat((int)img.height(), (int)img.width(), CV_32F, (void*)img.filterData(n), img.stride() * sizeof(float));
+}
+
+void PreviewPyramid::Clear()
+{
+    levels_.clear();
+}
+
+void PreviewPyramid::Build(const std::vector<std::shared_ptr<XYZImage>>& lights)
+{
+    levels_.clear();
+    if (lights.empty()) {
+        return;
+    }
+    levels_.push_back(lights);
+    for (;;) {
+        const std::vector<std::shared_ptr<XYZImage>>& previous = levels_.back();
+        const int width = (int)previous[0]->width() / 2;
+        const int height = (int)previous[0]->height() / 2;
+        if (std::min(width, height) < MIN_LEVEL_SIZE) {
+            break;
+        }
+        std::vector<std::shared_ptr<XYZImage>> level(previous.size());
+        for (size_t light = 0; light < previous.size(); ++light) {
+            level[light] = std::shared_ptr<XYZImage>(new XYZImage(width, height));
+            for (int xyz_index = 0; xyz_index < 3; ++xyz_index) {
+                cv::Mat dst = ChannelMat(*level[light], xyz_index);
+                cv::resize(ChannelMat(*previous[light], xyz_index), dst, dst.size(), 0, 0, cv::INTER_AREA);
+            }
+        }
+        levels_.push_back(level);
+    }
+}
+
+cv::Size PreviewPyramid::levelSize(int level) const
+{
+    const XYZImage& img = *levels_[level][0];
+    return cv::Size((int)img.width(), (int)img.height());
+}
+
+int PreviewPyramid::levelFor(int width) const
+{
+    int level = 0;
+    while (level + 1 < levels() && levelSize(level + 1).width >= width) {
+        ++level;
+    }
+    return level;
+}
+
+std::shared_ptr<XYZImage> PreviewPyramid::Render(const std::vector<float>& weights, const cv::Size& dest_size) const
+{
+    if (empty() || weights.size() != nlights() || dest_size.width <= 0) {
+        return std::shared_ptr<XYZImage>();
+    }
+    const cv::Size full_size = levelSize(0);
+    const float scale = (float)dest_size.width / (float)full_size.width;
+    const cv::Size render_size(std::max((int)(full_size.width * scale), 1), std::max((int)(full_size.height * scale), 1));
+
+    const int level = levelFor(render_size.width);
+    std::vector<const XYZImage*> sources(nlights());
+    for (size_t light = 0; light < sources.size(); ++light) {
+        sources[light] = levels_[level][light].get();
+    }
+    const cv::Size level_size = levelSize(level);
+    std::shared_ptr<XYZImage> blended(new XYZImage(level_size.width, level_size.height));
+    BlendXYZ(*blended, sources, weights);
+    if (level_size == render_size) {
+        return blended;
+    }
+    std::shared_ptr<XYZImage> preview(new XYZImage(render_size.width, render_size.height));
+    const int interpolation = (render_size.width < level_size.width) ? cv::INTER_AREA : cv::INTER_LINEAR;
+    for (int xyz_index = 0; xyz_index < 3; ++xyz_index) {
+        cv::Mat dst = ChannelMat(*preview, xyz_index);
+        cv::resize(ChannelMat(*blended, xyz_index), dst, render_size, 0, 0, interpolation);
+    }
+    return preview;
+}
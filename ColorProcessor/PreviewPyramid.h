@@ -0,0 +1,37 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include "ConversionFunctions.h"
+
+// PreviewPyramid: mip pyramid of every light's XYZ planes, for previews at display size.
+//
+// Level 0 is the full-resolution light images themselves (not copied); every further level is the previous one
+// halved with area averaging, down to MIN_LEVEL_SIZE pixels on the smaller side. A preview blends the lights at
+// the smallest level that is still at least as wide as the preview and resizes only the blended result, so
+// rendering costs one blend and one resize of roughly display-sized planes, whatever the weights or zoom.
+class PreviewPyramid
+{
+public:
+    static const int MIN_LEVEL_SIZE = 64;
+
+    PreviewPyramid() { }
+
+    // Builds the pyramid of lights (all of the same size). The lights must not change afterwards.
+    void Build(const std::vector<std::shared_ptr<XYZImage>>& lights);
+    void Clear();
+    bool empty() const { return levels_.empty(); }
+
+    int levels() const { return (int)levels_.size(); }
+    size_t nlights() const { return levels_.empty() ? 0 : levels_[0].size(); }
+    cv::Size levelSize(int level) const;
+    // Smallest level at least width pixels wide (level 0 if the full resolution is narrower).
+    int levelFor(int width) const;
+
+    // Weighted blend of the lights scaled to dest_size.width, keeping the aspect ratio of the capture.
+    std::shared_ptr<XYZImage> Render(const std::vector<float>& weights, const cv::Size& dest_size) const;
+
+private:
+    std::vector<std::vector<std::shared_ptr<XYZImage>>> levels_;    // [level][light]
+};
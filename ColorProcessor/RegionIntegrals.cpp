@@ -0,0 +1,94 @@
+#include "RegionIntegrals.h"
+#include "PixelKernels.h"
+
+#include <algorithm>
+#include <cmath>
+
+void RegionIntegrals::Reset(size_t num, size_t width, size_t height)
+{
+    num_ = num;
+    width_ = width;
+    height_ = height;
+    const size_t size = (width + 1) * (height + 1);
+    sums_.resize(num);
+    squares_.resize(num);
+    for (size_t n = 0; n < num; ++n) {
+        sums_[n].assign(size, 0.0);
+        squares_[n].assign(size, 0.0);
+    }
+}
+
+void RegionIntegrals::Build(const ImageView<const float>& planes)
+{
+    Reset(planes.num(), planes.width(), planes.height());
+    ParallelRows(planes.num(), 1, [&](size_t first, size_t last) {
+        for (size_t n = first; n < last; ++n) {
+            BuildPlane(n, planes.planes(n, 1));
+        }
+    });
+}
+
+// Row y of the tables is the table row above plus the running sums along row y - 1 of the plane.
+void RegionIntegrals::BuildPlane(size_t n, const ImageView<const float>& plane)
+{
+    const size_t table_width = width_ + 1;
+    double* sums = sums_[n].data();
+    double* squares = squares_[n].data();
+    for (size_t y = 0; y < height_; ++y) {
+        const float* row = plane.row(0, y);
+        const double* sums_above = sums + (y * table_width);
+        const double* squares_above = squares + (y * table_width);
+        double* sums_row = sums + ((y + 1) * table_width);
+        double* squares_row = squares + ((y + 1) * table_width);
+        double sum = 0, square = 0;
+        for (size_t x = 0; x < width_; ++x) {
+            const double value = row[x * plane.step()];
+            sum += value;
+            square += value * value;
+            sums_row[x + 1] = sums_above[x + 1] + sum;
+            squares_row[x + 1] = squares_above[x + 1] + square;
+        }
+    }
+}
+
+void RegionIntegrals::Clear()
+{
+    sums_.clear();
+    squares_.clear();
+    num_ = width_ = height_ = 0;
+}
+
+double RegionIntegrals::Sum(const std::vector<double>& table, const cv::Rect& region) const
+{
+    const size_t table_width = width_ + 1;
+    const size_t x0 = region.x, y0 = region.y;
+    const size_t x1 = x0 + region.width, y1 = y0 + region.height;
+    return (table[(y1 * table_width) + x1] - table[(y0 * table_width) + x1]) - (table[(y1 * table_width) + x0] - table[(y0 * table_width) + x0]);
+}
+
+size_t RegionIntegrals::Moments(const cv::Rect& region, double* mean, double* stddev) const
+{
+    const cv::Rect clipped = region & cv::Rect(0, 0, (int)width_, (int)height_);
+    const size_t count = (size_t)clipped.area();
+    for (size_t n = 0; n < num_; ++n) {
+        if (count == 0) {
+            mean[n] = stddev[n] = 0;
+            continue;
+        }
+        const double m = Sum(sums_[n], clipped) / count;
+        // Rounding can leave a slightly negative variance for flat regions
+        const double variance = (Sum(squares_[n], clipped) / count) - (m * m);
+        mean[n] = m;
+        stddev[n] = std::sqrt(std::max(variance, 0.0));
+    }
+    return count;
+}
+
+void RegionIntegrals::Moments(const std::vector<cv::Rect>& regions, std::vector<double>& mean, std::vector<double>& stddev) const
+{
+    mean.resize(regions.size() * num_);
+    stddev.resize(regions.size() * num_);
+    for (size_t r = 0; r < regions.size(); ++r) {
+        Moments(regions[r], mean.data() + (r * num_), stddev.data() + (r * num_));
+    }
+}
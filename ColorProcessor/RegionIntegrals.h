@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "ImageView.h"
+#include <opencv2/core/core.hpp>
+
+// RegionIntegrals: summed-area tables of image planes, for the mean and standard deviation of any rectangle
+// in constant time.
+//
+// Every plane gets two (width + 1) x (height + 1) tables of doubles, the running sums of its values and of their
+// squares, with a zero first row and column. The moments of a rectangle are then four lookups per table and
+// plane, whatever its size, so a chart of a few hundred patches is measured in microseconds once the tables are
+// built. Tables take 16 bytes per pixel and plane.
+class RegionIntegrals
+{
+public:
+    RegionIntegrals() : num_(0), width_(0), height_(0) { }
+
+    // Zeroed tables for num planes of width x height.
+    void Reset(size_t num, size_t width, size_t height);
+    // Tables of every plane of planes, one thread per plane (up to the number of cores).
+    void Build(const ImageView<const float>& planes);
+    // Tables of entry n from plane 0 of plane, which has the size given to Reset.
+    void BuildPlane(size_t n, const ImageView<const float>& plane);
+    void Clear();
+
+    bool empty() const { return num_ == 0; }
+    size_t num() const { return num_; }
+    size_t width() const { return width_; }
+    size_t height() const { return height_; }
+
+    // Mean and (population) standard deviation of every plane over region, clipped to the tables: num() values
+    // each. Returns the number of pixels; an empty region gives zeros.
+    size_t Moments(const cv::Rect& region, double* mean, double* stddev) const;
+    // Every region at once: plane n of region r is at [r * num() + n] of mean and stddev, which are resized.
+    void Moments(const std::vector<cv::Rect>& regions, std::vector<double>& mean, std::vector<double>& stddev) const;
+
+private:
+    double Sum(const std::vector<double>& table, const cv::Rect& region) const;
+
+    std::vector<std::vector<double>> sums_;
+    std::vector<std::vector<double>> squares_;
+    size_t num_;
+    size_t width_;
+    size_t height_;
+};
@@ -0,0 +1,262 @@
+#include "RegistrationEngine.h"
+
+#include <algorithm>
+#include <cmath>
+
+cv::Mat RegistrationResult::affine() const
+{
+    cv::Mat matrix(2, 3, CV_64F);
+    matrix.at<double>(0, 0) = scale;
+    matrix.at<double>(0, 1) = 0;
+    matrix.at<double>(0, 2) = translation.x;
+    matrix.at<double>(1, 0) = 0;
+    matrix.at<double>(1, 1) = scale;
+    matrix.at<double>(1, 2) = translation.y;
+    return matrix;
+}
+
+// cv::Mat header over plane n of a read-only view; only ever used as a source.
+static cv::Mat ConstPlaneMat(const ImageView<const float>& view, size_t n)
+{
+    return cv::Mat((int)view.height(), (int)view.width(), CV_32F, (void*)view.plane(n), view.stride() * sizeof(float));
+}
+
+RegistrationEngine::RegistrationEngine(int preprocess) : preprocess_(preprocess), interpolation_(cv::INTER_LINEAR), pyramid_levels_(0), coarse_size_(64), reference_levels_(0), ready_(false)
+{ }
+
+void RegistrationEngine::setPyramid(int levels, int coarse_size)
+{
+    pyramid_levels_ = std::max(levels, 0);
+    coarse_size_ = std::max(coarse_size, 8);
+}
+
+void RegistrationEngine::setReference(const ImageView<const float>& reference, const cv::Rect& target0, const cv::Rect& target1)
+{
+    const cv::Rect bounds(0, 0, (int)reference.width(), (int)reference.height());
+    const cv::Rect rects[2] = { target0 & bounds, target1 & bounds };
+    ready_ = false;
+    reference_levels_ = pyramid_levels_;
+    for (int n = 0; n < 2; ++n) {
+        if (!PrepareTarget(targets_[n], reference, rects[n], rects[n].size())) {
+            return;
+        }
+        if (pyramid_levels_ > 0) {
+            // Coarse region: coarse_size_ << levels pixels (at least the target) around the target center
+            const int factor = 1 << pyramid_levels_;
+            const int region_width = std::max(coarse_size_ * factor, rects[n].width);
+            const int region_height = std::max(coarse_size_ * factor, rects[n].height);
+            const cv::Point center(rects[n].x + rects[n].width / 2, rects[n].y + rects[n].height / 2);
+            const cv::Rect region = cv::Rect(center.x - region_width / 2, center.y - region_height / 2, region_width, region_height) & bounds;
+            if (!PrepareTarget(coarse_[n], reference, region, cv::Size(std::max(region.width / factor, 2), std::max(region.height / factor, 2)))) {
+                return;
+            }
+        }
+    }
+    ready_ = true;
+}
+
+// Prepares the reference window rect, resampled to size, for correlation.
+bool RegistrationEngine::PrepareTarget(Target& target, const ImageView<const float>& reference, const cv::Rect& rect, const cv::Size& size) const
+{
+    target.rect = rect;
+    target.size = size;
+    if (rect.width < 2 || rect.height < 2) {
+        return false;
+    }
+    target.dft_size = cv::Size(cv::getOptimalDFTSize(size.width), cv::getOptimalDFTSize(size.height));
+    ViewRect clipped;
+    const ImageView<const float> view = reference.crop(rect.x, rect.y, rect.width, rect.height, &clipped);
+    if ((int)clipped.width != rect.width || (int)clipped.height != rect.height) {
+        return false;
+    }
+    cv::createHanningWindow(target.hanning, size, CV_32F);
+    cv::Mat window = ConstPlaneMat(view, 0);
+    if (window.size() != size) {
+        cv::Mat resampled;
+        cv::resize(window, resampled, size, 0, 0, cv::INTER_AREA);
+        window = resampled;
+    }
+    target.prepared = Prepare(window, target);
+    target.spectrum = Spectrum(target.prepared, target);
+    return true;
+}
+
+// Preprocessed, windowed copy of window. The source pixels are never modified.
+cv::Mat RegistrationEngine::Prepare(const cv::Mat& window, const Target& target) const
+{
+    cv::Mat prepared;
+    if (preprocess_ & REG_PREPROCESS_THRESHOLD) {
+        double min, max;
+        cv::minMaxLoc(window, &min, &max);
+        cv::Mat window8;
+        window.convertTo(window8, CV_8U, (max > 0) ? 255 / max : 0);
+        cv::adaptiveThreshold(window8, window8, 255, cv::ADAPTIVE_THRESH_GAUSSIAN_C, cv::THRESH_BINARY, 11, 2);
+        window8.convertTo(prepared, CV_32F, 1.0 / 255);
+    } else {
+        window.convertTo(prepared, CV_32F);
+    }
+    // Without the mean, the window itself would correlate into a peak at zero shift
+    cv::subtract(prepared, cv::mean(prepared), prepared);
+    cv::multiply(prepared, target.hanning, prepared);
+    return prepared;
+}
+
+cv::Mat RegistrationEngine::Spectrum(const cv::Mat& prepared, const Target& target) const
+{
+    cv::Mat padded;
+    cv::copyMakeBorder(prepared, padded, 0, target.dft_size.height - prepared.rows, 0, target.dft_size.width - prepared.cols, cv::BORDER_CONSTANT, cv::Scalar::all(0));
+    cv::Mat spectrum;
+    cv::dft(padded, spectrum, cv::DFT_COMPLEX_OUTPUT);
+    return spectrum;
+}
+
+// Normalized cross-power spectrum -> correlation surface -> peak with a 5x5 weighted centroid.
+cv::Point2d RegistrationEngine::PhaseCorrelate(const cv::Mat& spectrum, const Target& target, double* response) const
+{
+    cv::Mat cross;
+    cv::mulSpectrums(spectrum, target.spectrum, cross, 0, true);
+    for (int y = 0; y < cross.rows; ++y) {
+        float* row = cross.ptr<float>(y);
+        for (int x = 0; x < cross.cols; ++x) {
+            const float magnitude = std::sqrt(row[2*x] * row[2*x] + row[2*x+1] * row[2*x+1]);
+            if (magnitude > 1e-12f) {
+                row[2*x] /= magnitude;
+                row[2*x+1] /= magnitude;
+            } else {
+                row[2*x] = row[2*x+1] = 0;
+            }
+        }
+    }
+    cv::Mat surface;
+    cv::idft(cross, surface, cv::DFT_REAL_OUTPUT | cv::DFT_SCALE);
+
+    cv::Point peak;
+    cv::minMaxLoc(surface, NULL, NULL, NULL, &peak);
+
+    // The surface is periodic; the centroid window wraps around the edges.
+    double sum = 0, sum_x = 0, sum_y = 0;
+    for (int dy = -2; dy <= 2; ++dy) {
+        const int y = (peak.y + dy + surface.rows) % surface.rows;
+        for (int dx = -2; dx <= 2; ++dx) {
+            const int x = (peak.x + dx + surface.cols) % surface.cols;
+            const double value = surface.at<float>(y, x);
+            sum += value;
+            sum_x += value * dx;
+            sum_y += value * dy;
+        }
+    }
+    cv::Point2d shift(peak.x, peak.y);
+    if (sum > 0) {
+        shift.x += sum_x / sum;
+        shift.y += sum_y / sum;
+    }
+    // Peaks past the middle are negative shifts. The peak sits at minus the plane's shift, as in cv::phaseCorrelate.
+    if (shift.x >= surface.cols / 2) {
+        shift.x -= surface.cols;
+    }
+    if (shift.y >= surface.rows / 2) {
+        shift.y -= surface.rows;
+    }
+    if (response) {
+        *response = std::min(std::max(sum, 0.0), 1.0);
+    }
+    return -shift;
+}
+
+cv::Point2d RegistrationEngine::correlate(const cv::Mat& window, int n, double* response) const
+{
+    const Target& target = targets_[n];
+    cv::Mat source;
+    if (window.size() == target.size) {
+        source = window;
+    } else {
+        cv::resize(window, source, target.size, 0, 0, cv::INTER_AREA);
+    }
+    return PhaseCorrelate(Spectrum(Prepare(source, target), target), target, response);
+}
+
+// Shift of window rect of plane against target, in plane pixels. A window that does not lie within the plane
+// (e.g. a plane smaller than the reference) gives no shift and a response of 0.
+cv::Point2d RegistrationEngine::Correlate(const ImageView<const float>& plane, const cv::Rect& rect, const Target& target, double* response) const
+{
+    ViewRect clipped = { 0, 0, 0, 0 };
+    ImageView<const float> view;
+    if (rect.x >= 0 && rect.y >= 0) {
+        view = plane.crop(rect.x, rect.y, rect.width, rect.height, &clipped);
+    }
+    if ((int)clipped.width != rect.width || (int)clipped.height != rect.height) {
+        if (response) {
+            *response = 0;
+        }
+        return cv::Point2d(0, 0);
+    }
+    cv::Mat window = ConstPlaneMat(view, 0);
+    cv::Mat source;
+    if (window.size() == target.size) {
+        source = window;
+    } else {
+        cv::resize(window, source, target.size, 0, 0, cv::INTER_AREA);
+    }
+    const cv::Point2d shift = PhaseCorrelate(Spectrum(Prepare(source, target), target), target, response);
+    return cv::Point2d(shift.x * rect.width / target.size.width, shift.y * rect.height / target.size.height);
+}
+
+cv::Point2d RegistrationEngine::offset(const ImageView<const float>& plane, int n, double* response) const
+{
+    const cv::Rect& rect = targets_[n].rect;
+    if (reference_levels_ == 0) {
+        return Correlate(plane, rect, targets_[n], response);
+    }
+    double coarse_response, fine_response;
+    const cv::Point2d coarse_offset = Correlate(plane, coarse_[n].rect, coarse_[n], &coarse_response);
+
+    // Refine with the target window moved onto the coarse estimate (plane pixel p matches reference pixel p + offset),
+    // kept inside the plane
+    cv::Rect moved(rect.x - cvRound(coarse_offset.x), rect.y - cvRound(coarse_offset.y), rect.width, rect.height);
+    moved.x = std::min(std::max(moved.x, 0), (int)plane.width() - rect.width);
+    moved.y = std::min(std::max(moved.y, 0), (int)plane.height() - rect.height);
+    const cv::Point2d residual = Correlate(plane, moved, targets_[n], &fine_response);
+    if (response) {
+        *response = std::min(coarse_response, fine_response);
+    }
+    return cv::Point2d(rect.x - moved.x, rect.y - moved.y) + residual;
+}
+
+RegistrationResult RegistrationEngine::estimate(const ImageView<const float>& plane) const
+{
+    RegistrationResult result;
+    if (!ready_) {
+        return result;
+    }
+    double response_center, response_corner, response_translation;
+    const cv::Point2d offset_center = offset(plane, 0, &response_center);
+    const cv::Point2d offset_corner = offset(plane, 1, &response_corner);
+
+    // Scale: change in distance between the two targets
+    const cv::Point2d center0(targets_[0].rect.x + targets_[0].rect.width / 2.0, targets_[0].rect.y + targets_[0].rect.height / 2.0);
+    const cv::Point2d center1(targets_[1].rect.x + targets_[1].rect.width / 2.0, targets_[1].rect.y + targets_[1].rect.height / 2.0);
+    const cv::Point2d distance = center1 - center0;
+    const cv::Point2d delta = offset_corner - offset_center;
+    const double r = std::sqrt(distance.dot(distance));
+    const double r_prime = std::sqrt((distance + delta).dot(distance + delta));
+    result.scale = (r > 0) ? r_prime / r : 1;
+    // Translation: least squares fit of the two target correspondences (plane point c matches reference point c + offset)
+    result.translation = ((center0 + offset_center) + (center1 + offset_corner)) * 0.5 - (center0 + center1) * (0.5 * result.scale);
+
+    // Residual translation: resample only target 0 of the transformed plane. Shifting the warp by the window origin
+    // makes warpAffine write window pixel (u, v) from transformed plane pixel (x + u, y + v).
+    const cv::Rect& rect = targets_[0].rect;
+    RegistrationResult window_transform = result;
+    window_transform.translation -= cv::Point2d(rect.x, rect.y);
+    cv::Mat scaled_target;
+    cv::warpAffine(ConstPlaneMat(plane, 0), scaled_target, window_transform.affine(), rect.size(), interpolation_);
+    result.translation += correlate(scaled_target, 0, &response_translation);
+
+    result.confidence = std::min(std::min(response_center, response_corner), response_translation);
+    return result;
+}
+
+void RegistrationEngine::apply(const cv::Mat& src, cv::Mat& dst, const RegistrationResult& result) const
+{
+    cv::warpAffine(src, dst, result.affine(), src.size(), interpolation_, cv::BORDER_CONSTANT, cv::Scalar::all(0));
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "ImageView.h"
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+// RegistrationEngine: two-target phase correlation against a fixed reference plane.
+//
+// setReference prepares each target window of the reference once: the window is (optionally) contrast
+// stretched and adaptive-thresholded, multiplied by a Hanning window, zero padded to a fast DFT size and
+// transformed. The spectra and windows are kept, so registering a plane only transforms that plane's
+// windows. The engine is not modified by offset()/correlate(), so one engine can serve several threads.
+//
+// Offsets use the cv::phaseCorrelate(plane, reference) convention.
+//
+// Pyramid mode (setPyramid) handles drifts larger than the target windows without larger FFTs: each target
+// is first correlated over a region 2^levels times larger, resampled down to a coarse window of fixed size,
+// and the result is refined at full resolution with the target window displaced by the coarse estimate.
+
+enum RegistrationPreprocess {
+    REG_PREPROCESS_NONE = 0,        // correlate the windows as they are
+    REG_PREPROCESS_THRESHOLD = 1    // stretch to 8 bit and adaptive-threshold first (concentric circle targets)
+};
+
+// Similarity transform mapping a plane onto the reference: x' = scale * x + translation.
+struct RegistrationResult
+{
+    double scale;
+    cv::Point2d translation;
+    double confidence;      // lowest phase correlation peak of the estimate, 0..1
+
+    RegistrationResult() : scale(1), translation(0, 0), confidence(0) { }
+    // 2x3 CV_64F matrix for cv::warpAffine.
+    cv::Mat affine() const;
+};
+
+class RegistrationEngine
+{
+public:
+    explicit RegistrationEngine(int preprocess = REG_PREPROCESS_THRESHOLD);
+
+    // reference is a single plane; target0/1 are the registration windows in plane coordinates (clipped to the plane).
+    void setReference(const ImageView<const float>& reference, const cv::Rect& target0, const cv::Rect& target1);
+    bool ready() const { return ready_; }
+    const cv::Rect& target(int n) const { return targets_[n].rect; }
+
+    // Shift of target window n of plane relative to the reference. response receives the correlation peak (0..1).
+    cv::Point2d offset(const ImageView<const float>& plane, int n, double* response = NULL) const;
+    // Same, for a window already cut out of a plane; window must be the size of target(n).
+    cv::Point2d correlate(const cv::Mat& window, int n, double* response = NULL) const;
+
+    // Scale from the distance between the two target offsets and translation from both targets, then the residual
+    // translation from target 0 resampled with that transform. Only the target windows are resampled; the plane is not warped.
+    RegistrationResult estimate(const ImageView<const float>& plane) const;
+    // Resamples src into dst with a single warp. Give dst its own buffer: if it shares src's data, OpenCV copies src first.
+    void apply(const cv::Mat& src, cv::Mat& dst, const RegistrationResult& result) const;
+
+    // Coarse-to-fine search over 2^levels times the target size, with coarse windows of coarse_size pixels.
+    // levels = 0 (default) correlates at full resolution only. Takes effect at the next setReference.
+    void setPyramid(int levels, int coarse_size = 64);
+    int pyramidLevels() const { return pyramid_levels_; }
+
+    // cv::INTER_NEAREST, INTER_LINEAR (default), INTER_CUBIC or INTER_LANCZOS4.
+    void setInterpolation(int interpolation) { interpolation_ = interpolation; }
+    int interpolation() const { return interpolation_; }
+
+private:
+    struct Target
+    {
+        cv::Rect rect;          // window in plane coordinates
+        cv::Size size;          // size it is correlated at: rect.size(), smaller for coarse targets
+        cv::Size dft_size;
+        cv::Mat hanning;        // CV_32F, size
+        cv::Mat prepared;       // preprocessed, windowed reference window
+        cv::Mat spectrum;       // CV_32FC2, dft_size
+    };
+
+    bool PrepareTarget(Target& target, const ImageView<const float>& reference, const cv::Rect& rect, const cv::Size& size) const;
+    cv::Mat Prepare(const cv::Mat& window, const Target& target) const;
+    cv::Mat Spectrum(const cv::Mat& prepared, const Target& target) const;
+    cv::Point2d PhaseCorrelate(const cv::Mat& spectrum, const Target& target, double* response) const;
+    cv::Point2d Correlate(const ImageView<const float>& plane, const cv::Rect& rect, const Target& target, double* response) const;
+
+    Target targets_[2];
+    Target coarse_[2];          // pyramid mode only
+    int preprocess_;
+    int interpolation_;
+    int pyramid_levels_;
+    int coarse_size_;
+    int reference_levels_;      // pyramid_levels_ when the targets were prepared
+    bool ready_;
+};
@@ -0,0 +1,209 @@
+#include "RoiStatistics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+RoiStatistics::RoiStatistics() : first_bin_(1), last_bin_(0), origin_(0), bin_width_(1), exact_(true), count_(0), mean_(0), median_(0), min_(0), max_(0)
+{ }
+
+// Clears the bins used by the previous call and makes room for bins bins.
+void RoiStatistics::Reset(size_t bins)
+{
+    for (size_t bin = first_bin_; bin <= last_bin_ && bin < histogram_.size(); ++bin) {
+        histogram_[bin] = 0;
+    }
+    if (histogram_.size() < bins) {
+        histogram_.resize(bins, 0);
+    }
+    first_bin_ = 1;
+    last_bin_ = 0;
+    count_ = 0;
+    mean_ = median_ = min_ = max_ = 0;
+}
+
+// Bin holding the element of the given rank; *below receives the number of elements in lower bins.
+size_t RoiStatistics::RankBin(size_t rank, size_t* below) const
+{
+    size_t cumulative = 0;
+    size_t bin = first_bin_;
+    for (; bin < last_bin_; ++bin) {
+        if (cumulative + histogram_[bin] > rank) {
+            break;
+        }
+        cumulative += histogram_[bin];
+    }
+    *below = cumulative;
+    return bin;
+}
+
+float RoiStatistics::BinValue(size_t bin, double fraction) const
+{
+    if (exact_) {
+        return (float)bin;
+    }
+    const float value = (float)(origin_ + (bin + fraction) * bin_width_);
+    return std::min(std::max(value, min_), max_);
+}
+
+void RoiStatistics::Compute(const ImageView<const unsigned short>& roi, size_t n)
+{
+    Reset(65536);
+    exact_ = true;
+    origin_ = 0;
+    bin_width_ = 1;
+    if (roi.empty() || n >= roi.num()) {
+        return;
+    }
+    unsigned long long sum = 0;
+    unsigned short lowest = 0xffff, highest = 0;
+    for (size_t y = 0; y < roi.height(); ++y) {
+        const unsigned short* row = roi.row(n, y);
+        for (size_t x = 0; x < roi.width(); ++x) {
+            const unsigned short value = row[x * roi.step()];
+            ++histogram_[value];
+            sum += value;
+            lowest = std::min(lowest, value);
+            highest = std::max(highest, value);
+        }
+    }
+    count_ = roi.width() * roi.height();
+    first_bin_ = lowest;
+    last_bin_ = highest;
+    min_ = lowest;
+    max_ = highest;
+    mean_ = (float)((double)sum / count_);
+    size_t below;
+    median_ = (float)RankBin(count_ / 2, &below);
+}
+
+void RoiStatistics::Compute(const ImageView<const float>& roi, size_t n)
+{
+    Reset(0);
+    exact_ = false;
+    if (roi.empty() || n >= roi.num()) {
+        return;
+    }
+    // First pass: range and mean of the finite values
+    double sum = 0;
+    size_t count = 0;
+    float lowest = 0, highest = 0;
+    for (size_t y = 0; y < roi.height(); ++y) {
+        const float* row = roi.row(n, y);
+        for (size_t x = 0; x < roi.width(); ++x) {
+            const float value = row[x * roi.step()];
+            if (!std::isfinite(value)) {
+                continue;
+            }
+            if (count == 0) {
+                lowest = highest = value;
+            }
+            lowest = std::min(lowest, value);
+            highest = std::max(highest, value);
+            sum += value;
+            ++count;
+        }
+    }
+    if (count == 0) {
+        return;
+    }
+    // Second pass: histogram. Binning is monotonic, so the element of a given rank lies in the bin found by counting.
+    const size_t bins = std::min(std::max(count, (size_t)1024), MAX_FLOAT_BINS);
+    Reset(bins);
+    count_ = count;
+    min_ = lowest;
+    max_ = highest;
+    mean_ = (float)(sum / count);
+    origin_ = lowest;
+    bin_width_ = (highest > lowest) ? (highest - lowest) / bins : 0;
+    const float scale = (highest > lowest) ? bins / (highest - lowest) : 0;
+    for (size_t y = 0; y < roi.height(); ++y) {
+        const float* row = roi.row(n, y);
+        for (size_t x = 0; x < roi.width(); ++x) {
+            const float value = row[x * roi.step()];
+            if (std::isfinite(value)) {
+                ++histogram_[std::min((size_t)((value - lowest) * scale), bins - 1)];
+            }
+        }
+    }
+    first_bin_ = 0;
+    last_bin_ = bins - 1;
+
+    // Exact median: select among the values of the median bin only
+    size_t below;
+    const size_t median_bin = RankBin(count_ / 2, &below);
+    bin_values_.clear();
+    for (size_t y = 0; y < roi.height(); ++y) {
+        const float* row = roi.row(n, y);
+        for (size_t x = 0; x < roi.width(); ++x) {
+            const float value = row[x * roi.step()];
+            if (std::isfinite(value) && std::min((size_t)((value - lowest) * scale), bins - 1) == median_bin) {
+                bin_values_.push_back(value);
+            }
+        }
+    }
+    std::nth_element(bin_values_.begin(), bin_values_.begin() + (count_ / 2 - below), bin_values_.end());
+    median_ = bin_values_[count_ / 2 - below];
+}
+
+float RoiStatistics::percentile(double p) const
+{
+    if (count_ == 0) {
+        return 0;
+    }
+    size_t rank = (size_t)std::max(0.0, std::floor(p / 100.0 * count_));
+    if (rank >= count_) {
+        rank = count_ - 1;
+    }
+    if (rank == count_ / 2) {
+        return median_;
+    }
+    size_t below;
+    const size_t bin = RankBin(rank, &below);
+    return BinValue(bin, (rank - below + 0.5) / histogram_[bin]);
+}
+
+float RoiStatistics::mad() const
+{
+    if (count_ == 0) {
+        return 0;
+    }
+    // Deviations are counted in bins outward from the median's bin; for uint16 input every bin is one value.
+    size_t below;
+    const size_t center = exact_ ? (size_t)median_ : RankBin(count_ / 2, &below);
+    const size_t rank = count_ / 2;
+    size_t cumulative = histogram_[center];
+    size_t distance = 0;
+    while (cumulative <= rank) {
+        ++distance;
+        if (center + distance <= last_bin_) {
+            cumulative += histogram_[center + distance];
+        }
+        if (center >= first_bin_ + distance) {
+            cumulative += histogram_[center - distance];
+        }
+    }
+    return distance * bin_width_;
+}
+
+void ComputeRoiStatistics(const ImageView<const float>& roi, std::vector<RoiStatistics>& stats)
+{
+    const size_t num = roi.num();
+    stats.resize(num);
+    size_t nthreads = std::thread::hardware_concurrency();
+    nthreads = std::max((size_t)1, std::min(nthreads, num));
+
+    auto worker = [&](size_t first) {
+        for (size_t n = first; n < num; n += nthreads) {
+            stats[n].Compute(roi, n);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < nthreads; ++t) {
+        threads.push_back(std::thread(worker, t));
+    }
+    worker(0);
+    for (size_t t = 0; t < threads.size(); ++t) {
+        threads[t].join();
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "ImageView.h"
+
+// RoiStatistics: median, percentiles, mean and MAD of an image region from a histogram.
+//
+// Values are binned into a histogram kept between calls, so repeated use (one object per filter, or
+// one per frame loop) does not allocate. Cost is linear in the ROI size plus the number of bins in use.
+//  - uint16 input: one bin per value; every statistic is exact.
+//  - float input: up to MAX_FLOAT_BINS equal bins between the ROI minimum and maximum. The median is
+//    exact (the values of its bin are selected directly); percentile() and mad() are within
+//    resolution() of the exact value. Non-finite values are ignored.
+// Ranks follow nth_element at index count * p: percentile(50) == median() == the element at count / 2.
+class RoiStatistics
+{
+public:
+    static const size_t MAX_FLOAT_BINS = 65536;
+
+    RoiStatistics();
+
+    // Statistics of plane n of roi.
+    void Compute(const ImageView<const unsigned short>& roi, size_t n = 0);
+    void Compute(const ImageView<const float>& roi, size_t n = 0);
+
+    size_t count() const { return count_; }
+    float mean() const { return mean_; }
+    float median() const { return median_; }
+    float min() const { return min_; }
+    float max() const { return max_; }
+    // Value below which p percent of the ROI lies, p in [0, 100].
+    float percentile(double p) const;
+    // Median absolute deviation from the median.
+    float mad() const;
+    // Width of one histogram bin: 1 for uint16 input, the error bound of percentile() and mad() for float input.
+    float resolution() const { return bin_width_; }
+
+private:
+    void Reset(size_t bins);
+    size_t RankBin(size_t rank, size_t* below) const;
+    float BinValue(size_t bin, double fraction) const;
+
+    std::vector<unsigned int> histogram_;   // bins [first_bin_, last_bin_] may be non-zero
+    std::vector<float> bin_values_;         // scratch for the exact float median
+    size_t first_bin_;
+    size_t last_bin_;
+    float origin_;                          // value at the lower edge of bin 0
+    float bin_width_;
+    bool exact_;
+    size_t count_;
+    float mean_;
+    float median_;
+    float min_;
+    float max_;
+};
+
+// Statistics of every plane of roi, one thread per plane (up to the number of cores).
+// stats is resized to roi.num(); passing the same vector again reuses its histograms.
+void ComputeRoiStatistics(const ImageView<const float>& roi, std::vector<RoiStatistics>& stats);
@@ -0,0 +1,98 @@
+#include "SpectralBasis.h"
+
+#include <opencv2/core/core.hpp>
+
+SpectralBasis::SpectralBasis(const std::vector<float>& vectors, size_t nfilters) : vectors_(vectors), nfilters_(nfilters)
+{
+    vectors_.resize(nfilters_ ? (vectors_.size() / nfilters_) * nfilters_ : 0);
+    if (!filterconfig::orthonormalizeBasis(vectors_, (int)nfilters_)) {
+        vectors_.clear();
+    }
+}
+
+SpectralBasis::SpectralBasis(const filterconfig* filter) : vectors_(filter->spectralBasis()), nfilters_(filter->nfilters())
+{ }
+
+SpectralBasis SpectralBasis::Learn(const ImageView<const float>& spectral, size_t ncomponents, size_t step, double* energy)
+{
+    const size_t nfilters = spectral.num();
+    if (step == 0) {
+        step = 1;
+    }
+    // Second moments of the sampled spectra, summed in double
+    cv::Mat moments = cv::Mat::zeros((int)nfilters, (int)nfilters, CV_64F);
+    std::vector<double> bands(nfilters);
+    for (size_t y = 0; y < spectral.height(); y += step) {
+        for (size_t x = 0; x < spectral.width(); x += step) {
+            for (size_t f = 0; f < nfilters; ++f) {
+                bands[f] = spectral.at(f, x, y);
+            }
+            for (size_t i = 0; i < nfilters; ++i) {
+                double* row = moments.ptr<double>((int)i);
+                for (size_t j = i; j < nfilters; ++j) {
+                    row[j] += bands[i] * bands[j];
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < nfilters; ++i) {
+        for (size_t j = 0; j < i; ++j) {
+            moments.at<double>((int)i, (int)j) = moments.at<double>((int)j, (int)i);
+        }
+    }
+
+    // Eigenvectors come out as rows, largest eigenvalue first
+    cv::Mat eigenvalues, eigenvectors;
+    cv::eigen(moments, eigenvalues, eigenvectors);
+    if (ncomponents > nfilters) {
+        ncomponents = nfilters;
+    }
+    std::vector<float> vectors(ncomponents * nfilters);
+    double kept = 0, total = 0;
+    for (size_t k = 0; k < nfilters; ++k) {
+        const double value = eigenvalues.at<double>((int)k);
+        total += value;
+        if (k >= ncomponents) {
+            continue;
+        }
+        kept += value;
+        // Sign chosen so that the components sum to a positive value (the first one is then the positive mean spectrum)
+        double sum = 0;
+        for (size_t f = 0; f < nfilters; ++f) {
+            sum += eigenvectors.at<double>((int)k, (int)f);
+        }
+        const double sign = (sum < 0) ? -1.0 : 1.0;
+        for (size_t f = 0; f < nfilters; ++f) {
+            vectors[(k * nfilters) + f] = (float)(sign * eigenvectors.at<double>((int)k, (int)f));
+        }
+    }
+    if (energy) {
+        *energy = (total > 0) ? kept / total : 1.0;
+    }
+    return SpectralBasis(vectors, nfilters);
+}
+
+SpectralProjection SpectralBasis::Transform(const SpectralProjection& projection) const
+{
+    const size_t ncomponents = this->ncomponents();
+    const size_t row = 3 * projection.nsets();
+    std::vector<float> weights(ncomponents * row, 0.0f);
+    if (projection.nfilters() != nfilters_) {
+        return SpectralProjection(weights, projection.nsets());
+    }
+    for (size_t k = 0; k < ncomponents; ++k) {
+        for (size_t j = 0; j < row; ++j) {
+            double sum = 0;
+            for (size_t f = 0; f < nfilters_; ++f) {
+                sum += (double)component(k, f) * projection.weights()[(f * row) + j];
+            }
+            weights[(k * row) + j] = (float)sum;
+        }
+    }
+    return SpectralProjection(weights, projection.nsets());
+}
+
+void SpectralBasis::Save(filterconfig* filter) const
+{
+    filter->setSpectralBasis(vectors_, (int)ncomponents());
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "ImageView.h"
+#include "SpectralProjection.h"
+#include "../filterconfig.h"
+
+// SpectralBasis: a few orthonormal spectra that span the spectra of a capture, for storing coefficients instead of bands.
+//
+// Reflectance spectra are smooth and strongly correlated between neighboring filters, so six or so components
+// hold nearly all of their energy. A pixel's coefficients are the dot products of its bands with the components,
+// and any projection of the bands (XYZ for an illuminant, see SpectralProjection) is the same projection of
+// the coefficients with weights components x projection, so rendering reads ncomponents planes instead of nfilters.
+// Learn takes the leading eigenvectors of the uncentered second moment matrix of the spectra (principal
+// components without mean removal), so the mapping stays linear and needs no offset.
+class SpectralBasis
+{
+public:
+    SpectralBasis() : nfilters_(0) { }
+    // ncomponents rows of nfilters values, orthonormalized in order (filterconfig::orthonormalizeBasis). Empty if
+    // a row is zero or nearly a combination of the rows before it.
+    SpectralBasis(const std::vector<float>& vectors, size_t nfilters);
+    // The basis stored in filter (filterconfig::spectralBasis), empty if it has none.
+    explicit SpectralBasis(const filterconfig* filter);
+
+    // Leading ncomponents components of the spectra of every step-th pixel (in x and y) of spectral, one plane per filter.
+    // energy receives the fraction of the sampled spectral energy they hold, if not NULL.
+    static SpectralBasis Learn(const ImageView<const float>& spectral, size_t ncomponents, size_t step = 4, double* energy = NULL);
+
+    bool empty() const { return vectors_.empty(); }
+    size_t nfilters() const { return nfilters_; }
+    size_t ncomponents() const { return nfilters_ ? vectors_.size() / nfilters_ : 0; }
+    const std::vector<float>& vectors() const { return vectors_; }
+    float component(size_t k, size_t filter) const { return vectors_[(k * nfilters_) + filter]; }
+
+    // projection (nfilters bands) applied to coefficients: ncomponents bands, the same sets.
+    SpectralProjection Transform(const SpectralProjection& projection) const;
+    // Stores the basis in filter (filterconfig::setSpectralBasis).
+    void Save(filterconfig* filter) const;
+
+private:
+    std::vector<float> vectors_;
+    size_t nfilters_;
+};
@@ -0,0 +1,299 @@
+#include "SpectralCube.h"
+#include "PixelKernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+// Rows per thread below which Project stays on the calling thread.
+static const size_t MIN_ROWS_PER_THREAD = 64;
+// Pixels projected at a time, so that the widened bands of a block stay in cache.
+static const size_t COLUMN_BLOCK = 1024;
+
+void SpectralCube::Reset(size_t nlights, size_t nfilters, size_t width, size_t height, int storage)
+{
+    Clear();
+    nlights_ = nlights;
+    nfilters_ = nplanes_ = nfilters;
+    width_ = width;
+    height_ = height;
+    storage_ = storage;
+    const int plane_storage = STORAGE_PACKED | STORAGE_POOLED | (DefaultPlaneStorage() & STORAGE_HUGE_PAGES);
+    for (size_t light = 0; light < nlights; ++light) {
+        if (storage_ == CUBE_FLOAT16) {
+            half_planes_.push_back(std::unique_ptr<RawImage<unsigned short>>(new RawImage<unsigned short>(nfilters, width, height, true, NULL, plane_storage)));
+        } else {
+            float_planes_.push_back(std::unique_ptr<RawImage<float>>(new RawImage<float>(nfilters, width, height, true, NULL, plane_storage)));
+        }
+    }
+}
+
+void SpectralCube::Reset(size_t nlights, const SpectralBasis& basis, size_t width, size_t height)
+{
+    Reset(nlights, basis.ncomponents(), width, height, CUBE_FLOAT16);
+    storage_ = CUBE_BASIS;
+    basis_ = basis;
+    nfilters_ = basis.nfilters();
+    // Half planes are zero until a light is complete; the float accumulators are drawn when its first frame arrives
+    for (size_t light = 0; light < nlights; ++light) {
+        for (size_t k = 0; k < nplanes_; ++k) {
+            std::fill(half_planes_[light]->filterData((int)k), half_planes_[light]->filterData((int)k) + (width * height), (unsigned short)0);
+        }
+    }
+    float_planes_.resize(nlights);
+    const BasisTotals none = { 0, 0, 0, 0 };
+    basis_totals_.assign(nlights, none);
+}
+
+void SpectralCube::Clear()
+{
+    float_planes_.clear();
+    half_planes_.clear();
+    basis_totals_.clear();
+    basis_ = SpectralBasis();
+    nlights_ = nfilters_ = nplanes_ = width_ = height_ = 0;
+}
+
+size_t SpectralCube::bytes() const
+{
+    if (storage_ == CUBE_BASIS) {
+        std::lock_guard<std::mutex> lock(accumulator_mutex_);
+        const size_t accumulators = (size_t)std::count_if(float_planes_.begin(), float_planes_.end(), [](const std::unique_ptr<RawImage<float>>& planes) { return planes != NULL; });
+        return ((nlights_ * nplanes_ * sizeof(unsigned short)) + (accumulators * (nplanes_ + 1) * sizeof(float))) * width_ * height_;
+    }
+    return nlights_ * nplanes_ * width_ * height_ * ((storage_ == CUBE_FLOAT16) ? sizeof(unsigned short) : sizeof(float));
+}
+
+void SpectralCube::Store(size_t light, size_t filter, const ImageView<const float>& frame)
+{
+    Store(light, filter, frame, 0, frame.height());
+}
+
+void SpectralCube::Store(size_t light, size_t filter, const ImageView<const float>& frame, size_t first_row, size_t last_row)
+{
+    if (light >= nlights_ || filter >= nfilters_ || !frame.contiguousRows()) {
+        return;
+    }
+    const size_t width = std::min(frame.width(), width_);
+    const size_t height = std::min(std::min(frame.height(), height_), last_row);
+    if (storage_ == CUBE_BASIS) {
+        if (first_row < height) {
+            StoreBasis(light, filter, frame, first_row, height, width);
+        }
+        return;
+    }
+    for (size_t y = first_row; y < height; ++y) {
+        if (storage_ == CUBE_FLOAT16) {
+            RawImage<unsigned short>& planes = *half_planes_[light];
+            FloatToHalf(&planes.filterData(filter)[y * planes.stride()], frame.row(0, y), width);
+        } else {
+            RawImage<float>& planes = *float_planes_[light];
+            std::copy(frame.row(0, y), frame.row(0, y) + width, &planes.filterData(filter)[y * planes.stride()]);
+        }
+    }
+}
+
+void SpectralCube::StoreBasis(size_t light, size_t filter, const ImageView<const float>& frame, size_t first_row, size_t last_row, size_t width)
+{
+    RawImage<float>* accumulator;
+    {
+        std::lock_guard<std::mutex> lock(accumulator_mutex_);
+        if (!float_planes_[light]) {
+            if (basis_totals_[light].rows >= height_) {
+                return;
+            }
+            // Coefficients and energies are sums over the filters
+            const int plane_storage = STORAGE_PACKED | STORAGE_POOLED | (DefaultPlaneStorage() & STORAGE_HUGE_PAGES);
+            float_planes_[light].reset(new RawImage<float>(nplanes_ + 1, width_, height_, true, NULL, plane_storage));
+            for (size_t k = 0; k <= nplanes_; ++k) {
+                std::fill(float_planes_[light]->filterData((int)k), float_planes_[light]->filterData((int)k) + (width_ * height_), 0.0f);
+            }
+        }
+        accumulator = float_planes_[light].get();
+    }
+    const size_t stride = accumulator->stride();
+    std::vector<float> unused(width);
+    for (size_t y = first_row; y < last_row; ++y) {
+        const float* src = frame.row(0, y);
+        float* energy = &accumulator->filterData((int)nplanes_)[y * stride];
+        for (size_t x = 0; x < width; ++x) {
+            energy[x] += src[x] * src[x];
+        }
+        // Three coefficients per pass; missing ones of the last group go to a scratch row with weight 0
+        for (size_t k0 = 0; k0 < nplanes_; k0 += 3) {
+            float* dst[3];
+            float weights[3];
+            for (size_t c = 0; c < 3; ++c) {
+                const size_t k = k0 + c;
+                dst[c] = (k < nplanes_) ? &accumulator->filterData((int)k)[y * stride] : unused.data();
+                weights[c] = (k < nplanes_) ? basis_.component(k, filter) : 0.0f;
+            }
+            AccumulateXyz(dst, src, weights, width);
+        }
+    }
+    if (filter + 1 < nfilters_) {
+        return;
+    }
+
+    // Last filter: the rows are final. Narrow them and take their error against the narrowed coefficients.
+    RawImage<unsigned short>& halves = *half_planes_[light];
+    std::vector<float> narrowed(width);
+    std::vector<double> kept(width), rounding(width);
+    BasisTotals totals = { 0, 0, 0, last_row - first_row };
+    for (size_t y = first_row; y < last_row; ++y) {
+        std::fill(kept.begin(), kept.end(), 0.0);
+        std::fill(rounding.begin(), rounding.end(), 0.0);
+        for (size_t k = 0; k < nplanes_; ++k) {
+            const float* coefficients = &accumulator->filterData((int)k)[y * stride];
+            unsigned short* half = &halves.filterData((int)k)[y * halves.stride()];
+            FloatToHalf(half, coefficients, width);
+            HalfToFloat(narrowed.data(), half, width);
+            for (size_t x = 0; x < width; ++x) {
+                const double c = coefficients[x];
+                const double d = c - narrowed[x];
+                kept[x] += c * c;
+                rounding[x] += d * d;
+            }
+        }
+        const float* energy = &accumulator->filterData((int)nplanes_)[y * stride];
+        for (size_t x = 0; x < width; ++x) {
+            const double r = std::max(energy[x] - kept[x], 0.0) + rounding[x];
+            totals.residual += r;
+            totals.energy += energy[x];
+            totals.max_residual = std::max(totals.max_residual, r);
+        }
+    }
+    std::lock_guard<std::mutex> lock(accumulator_mutex_);
+    BasisTotals& light_totals = basis_totals_[light];
+    light_totals.residual += totals.residual;
+    light_totals.energy += totals.energy;
+    light_totals.max_residual = std::max(light_totals.max_residual, totals.max_residual);
+    light_totals.rows += totals.rows;
+    if (light_totals.rows >= height_) {
+        float_planes_[light].reset();
+    }
+}
+
+BasisError SpectralCube::reconstructionError() const
+{
+    BasisError error = { 0, 0, 0 };
+    if (storage_ != CUBE_BASIS || empty()) {
+        return error;
+    }
+    double residual = 0, energy = 0, max_residual = 0;
+    std::mutex merge;
+    for (size_t light = 0; light < nlights_; ++light) {
+        if (!float_planes_[light]) {
+            residual += basis_totals_[light].residual;
+            energy += basis_totals_[light].energy;
+            max_residual = std::max(max_residual, basis_totals_[light].max_residual);
+            continue;
+        }
+        // A light whose capture did not finish: from its accumulators, without rounding
+        const RawImage<float>& planes = *float_planes_[light];
+        ParallelRows(height_, MIN_ROWS_PER_THREAD, [&](size_t first, size_t last) {
+            double band_residual = 0, band_energy = 0, band_max = 0;
+            for (size_t y = first; y < last; ++y) {
+                for (size_t x = 0; x < width_; ++x) {
+                    const double e = planes.filterData((int)nplanes_)[(y * planes.stride()) + x];
+                    double kept = 0;
+                    for (size_t k = 0; k < nplanes_; ++k) {
+                        const double c = planes.filterData((int)k)[(y * planes.stride()) + x];
+                        kept += c * c;
+                    }
+                    const double r = std::max(e - kept, 0.0);
+                    band_residual += r;
+                    band_energy += e;
+                    band_max = std::max(band_max, r);
+                }
+            }
+            std::lock_guard<std::mutex> lock(merge);
+            residual += band_residual;
+            energy += band_energy;
+            max_residual = std::max(max_residual, band_max);
+        });
+    }
+    const double count = (double)nlights_ * width_ * height_ * nfilters_;
+    error.rms = std::sqrt(residual / count);
+    error.relative = (energy > 0) ? std::sqrt(residual / energy) : 0;
+    error.max = std::sqrt(max_residual / nfilters_);
+    return error;
+}
+
+ImageView<const float> SpectralCube::light(size_t light) const
+{
+    if (light >= float_planes_.size() || !float_planes_[light]) {
+        return ImageView<const float>();
+    }
+    return ImageView<const float>(*float_planes_[light]).planes((size_t)0, nplanes_);
+}
+
+void SpectralCube::Project(const SpectralProjection& projection, const std::vector<float>& light_weights, const ImageView<float>& xyz) const
+{
+    std::vector<ImageView<float>> sets;
+    for (size_t set = 0; set < projection.nsets(); ++set) {
+        sets.push_back(xyz.planes(set * 3, 3));
+    }
+    Project(projection, light_weights, sets);
+}
+
+void SpectralCube::Project(const SpectralProjection& filter_projection, const std::vector<float>& light_weights, const std::vector<ImageView<float>>& xyz) const
+{
+    const size_t nsets = filter_projection.nsets();
+    if (empty() || filter_projection.nfilters() != nfilters_ || light_weights.size() < nlights_ || xyz.size() < nsets) {
+        return;
+    }
+    const SpectralProjection projection = (storage_ == CUBE_BASIS) ? basis_.Transform(filter_projection) : filter_projection;
+    size_t width = width_, height = height_;
+    for (size_t set = 0; set < nsets; ++set) {
+        if (xyz[set].num() < 3 || !xyz[set].contiguousRows()) {
+            return;
+        }
+        width = std::min(width, xyz[set].width());
+        height = std::min(height, xyz[set].height());
+    }
+    // Band (l, f) of the combined stack has weights light_weights[l] * projection weights of f
+    const size_t nbands = nlights_ * nplanes_;
+    const size_t row_weights = nplanes_ * 3 * nsets;
+    std::vector<float> weights(nlights_ * row_weights);
+    for (size_t light = 0; light < nlights_; ++light) {
+        for (size_t k = 0; k < row_weights; ++k) {
+            weights[(light * row_weights) + k] = light_weights[light] * projection.weights()[k];
+        }
+    }
+    const ProjectXyzF32Fn project = SelectProjectXyz(nbands);
+    ParallelRows(height, MIN_ROWS_PER_THREAD, [&](size_t first, size_t last) {
+        std::vector<const float*> src(nbands);
+        std::vector<float> widened((storage_ != CUBE_FLOAT32) ? nbands * COLUMN_BLOCK : 0);
+        std::vector<float*> dst(3 * nsets);
+        for (size_t y = first; y < last; ++y) {
+            for (size_t x = 0; x < width; x += COLUMN_BLOCK) {
+                const size_t n = std::min(COLUMN_BLOCK, width - x);
+                for (size_t light = 0; light < nlights_; ++light) {
+                    // Float planes when the light has them (CUBE_FLOAT32, CUBE_BASIS lights still being stored)
+                    const RawImage<float>* floats = (light < float_planes_.size()) ? float_planes_[light].get() : NULL;
+                    for (size_t f = 0; f < nplanes_; ++f) {
+                        const size_t band = (light * nplanes_) + f;
+                        if (floats) {
+                            src[band] = &floats->filterData(f)[(y * floats->stride()) + x];
+                        } else {
+                            const RawImage<unsigned short>& planes = *half_planes_[light];
+                            HalfToFloat(&widened[band * COLUMN_BLOCK], &planes.filterData(f)[(y * planes.stride()) + x], n);
+                            src[band] = &widened[band * COLUMN_BLOCK];
+                        }
+                    }
+                }
+                for (size_t set = 0; set < nsets; ++set) {
+                    for (size_t c = 0; c < 3; ++c) {
+                        dst[(set * 3) + c] = xyz[set].row(c, y) + x;
+                    }
+                }
+                if (nsets == 1) {
+                    project(dst.data(), src.data(), weights.data(), nbands, n);
+                } else {
+                    ProjectXyzSets(dst.data(), src.data(), weights.data(), nbands, nsets, n);
+                }
+            }
+        }
+    });
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Image.h"
+#include "ImageView.h"
+#include "SpectralProjection.h"
+#include "SpectralBasis.h"
+
+// SpectralCube: the registered, normalized filter planes of every light of a capture, kept for re-rendering.
+//
+// A capture projects each plane into XYZ for one illuminant and moves on; with the cube kept, XYZ for any other
+// illuminant and observer is one more projection instead of a recapture. CUBE_FLOAT16 storage halves the
+// memory: planes are white normalized, so half floats keep 11 significant bits over the whole range.
+// Project treats the bands of all lights as one stack, with the light weights folded into the projection
+// weights, so a blended XYZ image takes a single pass over the cube; half float rows are widened band by band
+// into a per-thread scratch row first (HalfToFloat). Projections with several sets (illuminants) render all of
+// them from that same pass.
+//
+// CUBE_BASIS storage keeps the coefficients of a SpectralBasis instead of the bands: each frame is added into
+// float coefficient planes of its light as it arrives (AccumulateXyz, three components at a time), next to the
+// energy of every pixel's spectrum. Once the last filter of a row range is in, those rows are narrowed to half
+// floats, and with every row of the light done its float planes go back to the pool, so only lights still being
+// captured hold floats. The reconstruction error of the basis is summed at the narrowing, while the exact
+// coefficients are at hand: for an orthonormal basis the residual energy is the spectral energy minus that of the
+// coefficients, plus the half float rounding of the coefficients. Projections are transformed into coefficient
+// space (SpectralBasis::Transform), so rendering reads ncomponents half planes per light.
+enum SpectralCubeStorage {
+    CUBE_FLOAT32 = 0,
+    CUBE_FLOAT16,
+    CUBE_BASIS          // half float coefficients of a SpectralBasis, float accumulators while a light is stored
+};
+
+// Reconstruction error of a CUBE_BASIS cube, in the units of the planes (1 = white).
+struct BasisError
+{
+    double rms;         // root mean square error per band over every pixel of every light
+    double relative;    // root of residual energy over spectral energy
+    double max;         // largest per-pixel root mean square error
+};
+
+class SpectralCube
+{
+public:
+    SpectralCube() : nlights_(0), nfilters_(0), nplanes_(0), width_(0), height_(0), storage_(CUBE_FLOAT32) { }
+
+    // Planes for nlights x nfilters frames of width x height. Planes are drawn from the plane pool.
+    void Reset(size_t nlights, size_t nfilters, size_t width, size_t height, int storage = CUBE_FLOAT16);
+    // CUBE_BASIS planes for basis.ncomponents() coefficients of basis.nfilters() filters per light.
+    void Reset(size_t nlights, const SpectralBasis& basis, size_t width, size_t height);
+    void Clear();
+
+    bool empty() const { return nlights_ == 0; }
+    size_t nlights() const { return nlights_; }
+    size_t nfilters() const { return nfilters_; }
+    // Planes per light: nfilters(), or the number of coefficients for CUBE_BASIS.
+    size_t nplanes() const { return nplanes_; }
+    const SpectralBasis& basis() const { return basis_; }
+    size_t width() const { return width_; }
+    size_t height() const { return height_; }
+    int storage() const { return storage_; }
+    size_t bytes() const;
+
+    // Stores plane 0 of frame as filter filter of light light. CUBE_BASIS adds it into the coefficients, so every
+    // filter of a light is stored once, the last one (nfilters() - 1) last.
+    void Store(size_t light, size_t filter, const ImageView<const float>& frame);
+    // Rows first to last (exclusive) of frame only. Disjoint row ranges of one light may be stored from different threads.
+    void Store(size_t light, size_t filter, const ImageView<const float>& frame, size_t first_row, size_t last_row);
+    // Filter planes of light, or the float coefficient planes of a CUBE_BASIS light still being stored; empty
+    // otherwise (CUBE_FLOAT16, complete CUBE_BASIS lights).
+    ImageView<const float> light(size_t light) const;
+    // Error of the basis over the stored spectra; zero unless the storage is CUBE_BASIS.
+    BasisError reconstructionError() const;
+
+    // xyz = sum over lights of light_weights[l] * projection of light l (projection.nfilters() == nfilters()),
+    // into the first 3 * projection.nsets() planes of xyz (the size of the cube, contiguous rows). Store may free
+    // float planes, so Project, light() and reconstructionError must not overlap Store, Reset or Clear.
+    void Project(const SpectralProjection& projection, const std::vector<float>& light_weights, const ImageView<float>& xyz) const;
+    // Set s of projection into the first three planes of xyz[s].
+    void Project(const SpectralProjection& projection, const std::vector<float>& light_weights, const std::vector<ImageView<float>>& xyz) const;
+
+private:
+    // CUBE_BASIS: error sums of the rows of a light already narrowed to half floats.
+    struct BasisTotals
+    {
+        double residual;
+        double energy;
+        double max_residual;
+        size_t rows;
+    };
+
+    void StoreBasis(size_t light, size_t filter, const ImageView<const float>& frame, size_t first_row, size_t last_row, size_t width);
+
+    // One image of nplanes() planes per light. CUBE_BASIS: the accumulators of the lights being stored, with
+    // the spectral energy as plane nplanes(), NULL otherwise.
+    std::vector<std::unique_ptr<RawImage<float>>> float_planes_;
+    std::vector<std::unique_ptr<RawImage<unsigned short>>> half_planes_;
+    std::vector<BasisTotals> basis_totals_;
+    mutable std::mutex accumulator_mutex_;      // CUBE_BASIS: float_planes_ and basis_totals_ during Store
+    SpectralBasis basis_;
+    size_t nlights_;
+    size_t nfilters_;
+    size_t nplanes_;
+    size_t width_;
+    size_t height_;
+    int storage_;
+};
@@ -0,0 +1,138 @@
+#include "SpectralProjection.h"
+#include "PixelKernels.h"
+
+#include <algorithm>
+
+// Rows per thread below which Project stays on the calling thread.
+static const size_t MIN_ROWS_PER_THREAD = 64;
+
+SpectralProjection::SpectralProjection(const filterconfig* filter) : nsets_(1)
+{
+    const size_t nfilters = filter->nfilters();
+    weights_.resize(nfilters * 3);
+    double scalar_constant[3] = {0, 0, 0};
+    for (size_t filter_index = 0; filter_index < nfilters; ++filter_index) {
+        const int wavelength = filter->wavelengthAtPos(filter_index);
+        const std::vector<float>& cmf = filter->cmfValues(wavelength);
+        const float illuminant = filter->illuminantValue(wavelength);
+        for (size_t xyz_index = 0; xyz_index < 3; ++xyz_index) {
+            weights_[(filter_index * 3) + xyz_index] = cmf[xyz_index] * illuminant;
+            scalar_constant[xyz_index] += cmf[xyz_index] * illuminant;
+        }
+    }
+    for (size_t filter_index = 0; filter_index < nfilters; ++filter_index) {
+        for (size_t xyz_index = 0; xyz_index < 3; ++xyz_index) {
+            float& weight = weights_[(filter_index * 3) + xyz_index];
+            weight = (scalar_constant[xyz_index] != 0) ? (float)(weight / scalar_constant[xyz_index]) : 0.0f;
+        }
+    }
+}
+
+SpectralProjection::SpectralProjection(const std::vector<const filterconfig*>& filters) : nsets_(1)
+{
+    if (filters.empty() || (filters[0] == NULL)) {
+        return;
+    }
+    const size_t nfilters = filters[0]->nfilters();
+    for (size_t set = 1; set < filters.size(); ++set) {
+        if ((filters[set] == NULL) || (filters[set]->nfilters() != nfilters)) {
+            return;
+        }
+    }
+    nsets_ = filters.size();
+    weights_.resize(nfilters * 3 * nsets_);
+    for (size_t set = 0; set < nsets_; ++set) {
+        const SpectralProjection single(filters[set]);
+        for (size_t filter_index = 0; filter_index < nfilters; ++filter_index) {
+            for (size_t xyz_index = 0; xyz_index < 3; ++xyz_index) {
+                weights_[(filter_index * 3 * nsets_) + (set * 3) + xyz_index] = single.weight(filter_index, xyz_index);
+            }
+        }
+    }
+}
+
+SpectralProjection::SpectralProjection(const std::vector<float>& weights, size_t nsets) : weights_(weights), nsets_(nsets ? nsets : 1)
+{
+    weights_.resize((weights_.size() / (3 * nsets_)) * 3 * nsets_);
+}
+
+void SpectralProjection::ProjectRows(const ImageView<const float>& spectral, const std::vector<ImageView<float>>& xyz, size_t first, size_t last) const
+{
+    const size_t nsrc = nfilters();
+    size_t width = spectral.width();
+    for (size_t set = 0; set < nsets_; ++set) {
+        width = std::min(width, xyz[set].width());
+    }
+    const ProjectXyzF32Fn project = SelectProjectXyz(nsrc);     // specialized for the 13 and 15 band layouts
+    const float* src[ImageView<const float>::MAX_PLANES];
+    std::vector<float*> dst(3 * nsets_);
+    // Decimated views are gathered into contiguous rows for the kernel
+    std::vector<float> gathered(spectral.contiguousRows() ? 0 : nsrc * width);
+    for (size_t y = first; y < last; ++y) {
+        for (size_t f = 0; f < nsrc; ++f) {
+            const float* row = spectral.row(f, y);
+            if (!spectral.contiguousRows()) {
+                float* packed = &gathered[f * width];
+                for (size_t x = 0; x < width; ++x) {
+                    packed[x] = row[x * spectral.step()];
+                }
+                row = packed;
+            }
+            src[f] = row;
+        }
+        for (size_t set = 0; set < nsets_; ++set) {
+            for (size_t c = 0; c < 3; ++c) {
+                dst[(set * 3) + c] = xyz[set].row(c, y);
+            }
+        }
+        if (nsets_ == 1) {
+            project(dst.data(), src, weights_.data(), nsrc, width);
+        } else {
+            ProjectXyzSets(dst.data(), src, weights_.data(), nsrc, nsets_, width);
+        }
+    }
+}
+
+void SpectralProjection::Project(const ImageView<const float>& spectral, const ImageView<float>& xyz) const
+{
+    std::vector<ImageView<float>> sets;
+    for (size_t set = 0; set < nsets_; ++set) {
+        sets.push_back(xyz.planes(set * 3, 3));
+    }
+    Project(spectral, sets);
+}
+
+void SpectralProjection::Project(const ImageView<const float>& spectral, const std::vector<ImageView<float>>& xyz) const
+{
+    if (xyz.size() < nsets_ || spectral.num() < nfilters()) {
+        return;
+    }
+    size_t height = spectral.height();
+    for (size_t set = 0; set < nsets_; ++set) {
+        if (xyz[set].empty() || xyz[set].num() < 3) {
+            return;
+        }
+        height = std::min(height, xyz[set].height());
+    }
+    ParallelRows(height, MIN_ROWS_PER_THREAD, [&](size_t first, size_t last) {
+        ProjectRows(spectral, xyz, first, last);
+    });
+}
+
+void SpectralProjection::Accumulate(const ImageView<const float>& frame, size_t filter, const ImageView<float>& xyz, size_t n) const
+{
+    if (filter >= nfilters() || n >= frame.num() || xyz.num() < 3 * nsets_ || !frame.contiguousRows()) {
+        return;
+    }
+    const size_t width = std::min(frame.width(), xyz.width());
+    const size_t height = std::min(frame.height(), xyz.height());
+    float* dst[3];
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t set = 0; set < nsets_; ++set) {
+            for (size_t c = 0; c < 3; ++c) {
+                dst[c] = xyz.row((set * 3) + c, y);
+            }
+            AccumulateXyz(dst, frame.row(n, y), &weights_[(filter * 3 * nsets_) + (set * 3)], width);
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "ImageView.h"
+#include "../filterconfig.h"
+
+// SpectralProjection: spectral planes to CIE XYZ as a single nfilters x 3 matrix product per pixel.
+//
+// Weight (f, c) is cmf_c * illuminant at the wavelength of filter f, divided by the sum of those products over
+// all filters, so the white point normalization is part of the matrix and needs no pass of its own.
+// Project reads every spectral pixel once and writes every XYZ pixel once: the rows are split into bands, one
+// per thread, and the row kernel (ProjectXyz) keeps the sums of a block of pixels in registers while it walks
+// the filters. Accumulate is for data arriving one filter at a time, as during a capture.
+//
+// A projection can hold several sets of weights, one per illuminant (or observer): the matrix is then
+// nfilters x 3 * nsets(), and Project writes every set's XYZ from one read of the spectral planes (ProjectXyzSets).
+class SpectralProjection
+{
+public:
+    SpectralProjection() : nsets_(1) { }
+    explicit SpectralProjection(const filterconfig* filter);
+    // One set per filterconfig, from its color matching functions and illuminant. The configurations must have
+    // the same number of filters: an empty list, a NULL entry or a mismatch gives an empty projection (nfilters() 0).
+    explicit SpectralProjection(const std::vector<const filterconfig*>& filters);
+    // Normalized weights given directly, nfilters rows of 3 * nsets.
+    explicit SpectralProjection(const std::vector<float>& weights, size_t nsets = 1);
+
+    size_t nfilters() const { return weights_.size() / (3 * nsets_); }
+    size_t nsets() const { return nsets_; }
+    const float* weights() const { return weights_.data(); }
+    float weight(size_t filter, size_t component, size_t set = 0) const { return weights_[(filter * 3 * nsets_) + (set * 3) + component]; }
+
+    // Projection of the first nfilters() planes of spectral into the first 3 * nsets() planes of xyz (same size,
+    // contiguous rows), set s in planes 3s to 3s + 2. With one set, xyz may share its planes with spectral.
+    void Project(const ImageView<const float>& spectral, const ImageView<float>& xyz) const;
+    // Set s into the first three planes of xyz[s]; xyz has nsets() views.
+    void Project(const ImageView<const float>& spectral, const std::vector<ImageView<float>>& xyz) const;
+    // xyz += contribution of plane n of frame, taken as filter filter, for every set (planes as in Project).
+    // frame must have contiguous rows.
+    void Accumulate(const ImageView<const float>& frame, size_t filter, const ImageView<float>& xyz, size_t n = 0) const;
+
+private:
+    void ProjectRows(const ImageView<const float>& spectral, const std::vector<ImageView<float>>& xyz, size_t first, size_t last) const;
+
+    std::vector<float> weights_;
+    size_t nsets_;
+};
@@ -1,14 +1,45 @@
 #include "calibratedimage.h"
 
+#include <stdexcept>
+
 CalibratedImage::CalibratedImage(const RawImage<unsigned short>& raw_img, const FlatFieldImage& flat_img) : RawImage<float>(raw_img.num_, raw_img.width_, raw_img.height_)
 {
-    const size_t img_size = width_ * height_;
     for (size_t n = 0; n < num_; ++n) {
-        for (size_t i = 0; i < img_size; ++i) {
-            if (flat_img.img_data_[n][i] == 0) {
-                img_data_[n][i] = 0; // Temporary fix to prevent dividing by 0. Maybe change this in the future to guess a value?
+        for (size_t y = 0; y < height_; ++y) {
+            const unsigned short* raw_row = &raw_img.img_data_[n][y * raw_img.stride_];
+            const auto* flat_row = &flat_img.img_data_[n][y * flat_img.stride_];
+            float* row = &img_data_[n][y * stride_];
+            for (size_t x = 0; x < width_; ++x) {
+                if (flat_row[x] == 0) {
+                    row[x] = 0; // Temporary fix to prevent dividing by 0. Maybe change this in the future to guess a value?
+                } else {
+                    row[x] = float(raw_row[x]) / float(flat_row[x]);
+                }
+            }
+        }
+    }
+}
+
+CalibratedImage::CalibratedImage(const RawImage<unsigned short>& raw_img, const CalibrationStore& store, int light) : RawImage<float>(raw_img.num_, raw_img.width_, raw_img.height_)
+{
+    // A store of another camera mode or filter set would be read past the end of its mapping
+    if (store.width() != width_ || store.height() != height_ || light < 0 || light >= store.nlights() || num_ > (size_t)store.nfilters()) {
+        throw std::invalid_argument("CalibratedImage: calibration store does not match the image");
+    }
+    std::vector<unsigned short> zero_bias;
+    const unsigned short* bias = store.bias();
+    if (!bias) {
+        zero_bias.resize(store.width() * store.height(), 0);
+        bias = zero_bias.data();
+    }
+    for (size_t n = 0; n < num_; ++n) {
+        for (size_t y = 0; y < height_; ++y) {
+            const unsigned short* raw_row = &raw_img.img_data_[n][y * raw_img.stride_];
+            float* row = &img_data_[n][y * stride_];
+            if (store.isFp16()) {
+                IngestFp16(row, raw_row, &bias[y * store.stride()], &store.gainFp16(light, n)[y * store.stride()], 1.0f, width_);
             } else {
-                img_data_[n][i] = float(raw_img.img_data_[n][i]) / float(flat_img.img_data_[n][i]);
+                Ingest(row, raw_row, &bias[y * store.stride()], &store.gain(light, n)[y * store.stride()], 1.0f, width_);
             }
         }
     }
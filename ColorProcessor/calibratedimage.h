@@ -3,11 +3,15 @@
 
 #include "Image.h"
 #include "FlatFieldImage.h"
+#include "CalibrationStore.h"
 
 class CalibratedImage : public RawImage<float>
 {
 public:
     CalibratedImage(const RawImage<unsigned short>& raw_img, const FlatFieldImage& flat_img);
+    // raw_img holds one plane per filter taken under light; the store's bias frame is subtracted if it has one.
+    // Throws std::invalid_argument unless the store has the size of raw_img, the light and a plane per filter.
+    CalibratedImage(const RawImage<unsigned short>& raw_img, const CalibrationStore& store, int light);
 };
 
 
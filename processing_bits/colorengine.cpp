@@ -1,230 +1,401 @@
 #include "colorengine.h"
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+
+// Rows below which an accumulation lane is not split further.
+static const int MIN_ACCUMULATION_ROWS = 64;
+
+static cv::Rect QRectToCvRect(const QRect& rect)
+{
+    return cv::Rect(rect.x(), rect.y(), rect.width(), rect.height());
+}
 
 void colorengine::threadFunc()
 {
-    std::unique_ptr<float> regdata(new float[width_*height_]);
+    // Frame buffers are reused for every frame of the capture and come from the shared plane pool,
+    // so back-to-back captures neither allocate nor page-fault fresh buffers. They are kept packed (stride == width).
+    // A frame holds one of them from ingest until it has been written, so the pool also bounds the frames in
+    // flight between the stages. Every registration worker keeps one more to resample into, traded for the frame's.
+    const int frame_storage = STORAGE_POOLED | (DefaultPlaneStorage() & STORAGE_HUGE_PAGES);
+    const int nframes = filter_->nfilters() * nlights_;
+    const bool register_frames = (regtargets.size() == 2);
+    const size_t nbuffers = std::max(frame_buffers_, size_t(ingest_workers_ + registration_workers_ + accumulation_workers_ + 2));
+    std::vector<std::unique_ptr<RawImage<float>>> frame_buffers;
+    for (size_t n = 0; n < nbuffers + (register_frames ? registration_workers_ : 0); ++n) {
+        frame_buffers.push_back(std::unique_ptr<RawImage<float>>(new RawImage<float>(1, width_, height_, true, NULL, frame_storage)));
+    }
+    // The stage queues belong to this capture; the last stopAsync may have left them closed.
+    free_frames_.clear();
+    registration_queue_.clear();
+    accumulation_queue_.clear();
+    write_queue_.clear();
+    for (size_t n = 0; n < nbuffers; ++n) {
+        free_frames_.push(frame_buffers[n].get());
+    }
+    registration_queue_.setCapacity(nbuffers);
+    accumulation_queue_.setCapacity(nbuffers);
+    write_queue_.setCapacity(nbuffers);
+
+    // Without a bias frame the ingest kernel subtracts zeros.
+    std::vector<unsigned short> zero_bias;
+    const unsigned short* bias = calibration_ ? calibration_->bias() : bias_data.get();
+    if (!bias) {
+        zero_bias.resize(width_ * height_, 0);
+        bias = zero_bias.data();
+    }
 
-    std::vector<float> scalar_constant(3);
-    scalar_constant.push_back(0);
-    scalar_constant.push_back(0);
-    scalar_constant.push_back(0);
+    // Normalized XYZ weights: frames are added straight into the per-light XYZ planes, with no scaling pass at the end
+    const SpectralProjection projection(filter_);
 
     _XTIFFInitialize();
     rawdata_tiff = TIFFOpen(raw_tiff_path.c_str(), "w");
     TIFFSetField(rawdata_tiff, TIFFTAG_NFILTERS, filter_->nfilters());
     TIFFSetField(rawdata_tiff, TIFFTAG_NLIGHTS, nlights_);
 
-    for (auto filter_index = 0; filter_index < filter_->nfilters(); ++filter_index) {
-        std::vector<float> cmf = filter_->cmfValues(filter_->wavelengthAtPos(filter_index));
-        float illuminant = filter_->illuminantValue(filter_->wavelengthAtPos(filter_index));
-        for (auto xyz_index = 0; xyz_index < 3; ++xyz_index) {
-            scalar_constant[xyz_index] += cmf[xyz_index] * illuminant;
+    // Registration against the first filter: the reference spectra are prepared from the frame of the first filter
+    // and last light, as the serial engine did, and are read-only afterwards so every registration worker shares them.
+    RegistrationEngine registration(REG_PREPROCESS_THRESHOLD);
+    registration.setInterpolation(reg_interpolation_);
+    registration.setPyramid(reg_pyramid_levels_);
+    {
+        std::lock_guard<std::mutex> lock(confidence_mutex_);
+        reg_confidence_.assign(filter_->nfilters() * nlights_, 1.0f);
+    }
+
+    // White reference ROI, measured by every ingest worker into its own buffer
+    const int wtpt_x = wtpt_rect_.x();
+    const int wtpt_width = wtpt_rect_.size().width();
+    const int wtpt_height = wtpt_rect_.size().height();
+
+    // Every filter band is averaged over the lights in bandbuffer and its summed-area tables built from there
+    std::unique_ptr<RawImage<float>> bandbuffer;
+    if (spectral_statistics_) {
+        bandbuffer.reset(new RawImage<float>(1, width_, height_, true, NULL, frame_storage));
+        spectral_integrals_.Reset(filter_->nfilters(), width_, height_);
+    } else {
+        spectral_integrals_.Clear();
+    }
+    const float light_weight = 1.0f / float(nlights_);
+
+    // The cube is stored into without a lock from here on, so renders are refused until the lanes are done
+    const SpectralBasis basis(filter_);
+    {
+        std::lock_guard<std::mutex> lock(cube_mutex_);
+        cube_capturing_ = true;
+        if (retain_cube_ && cube_storage_ == CUBE_BASIS && !basis.empty()) {
+            cube_.Reset(nlights_, basis, width_, height_);
+        } else if (retain_cube_) {
+            cube_.Reset(nlights_, filter_->nfilters(), width_, height_, (cube_storage_ == CUBE_BASIS) ? CUBE_FLOAT16 : cube_storage_);
+        } else {
+            cube_.Clear();
         }
     }
-    int page_index = 0;
-    for (int filter_index = 0; filter_index < filter_->nfilters(); ++filter_index) {  
-        for (int light_index = 0; light_index < nlights_; ++light_index) {
-            std::shared_ptr<unsigned short> data = data_queue_.pop();
-            if (cancel_) {
-                return;
-            }
-            std::unique_ptr<float> floatdata(new float[width_*height_]);
 
-            for (auto y = 0; y < height_; ++y) {
-                for (auto x = 0; x < width_; ++x) {
-                    if (data.get()[y*width_+x] - bias_data.get()[y*width_+x] < 0) {
-                        data.get()[y*width_+x] = 0;
-                    } else {
-                        data.get()[y*width_+x] -= bias_data.get()[y*width_+x];
-                    }
-                }
+    // Every frame is added into the per-light XYZ planes, and pooled planes come back with whatever they last held.
+    // blend_ reads them when the weights change, so they are cleared under its lock.
+    std::unique_lock<std::mutex> results_lock(results_mutex_);
+    for (size_t light = 0; light < xyz_data.size(); ++light) {
+        XYZImage& xyz = *xyz_data[light];
+        ParallelRows(height_, MIN_ACCUMULATION_ROWS, [&](size_t first, size_t last) {
+            for (int c = 0; c < 3; ++c) {
+                std::fill(&xyz.filterData(c)[first * xyz.stride()], &xyz.filterData(c)[last * xyz.stride()], 0.0f);
             }
-            for (auto y = 0; y < height_; ++y) {
-                for (auto x = 0; x <width_; ++x) {
-                    if (flat_data[light_index]->filterData(filter_index)[y*width_+x] == 0) {
-                        floatdata.get()[y*width_+x] = 0;
-                    } else {
-                        floatdata.get()[y*width_+x] = (float)data.get()[y*width_+x] / (float)flat_data[light_index]->filterData(filter_index)[y*width_+x];
+        });
+    }
+    results_lock.unlock();
+
+    // Ingest stage: bias subtraction, flat-field correction and white normalization. Frames are numbered in arrival
+    // order (filter-major) and take their buffer under one lock, so the oldest frame in flight always has a buffer
+    // and the in-order stages further down can never wait on a frame that cannot be ingested.
+    std::mutex sequence_mutex;
+    int next_sequence = 0;
+    std::atomic<int> ingest_running(ingest_workers_);
+    auto ingest_stage = [&]() {
+        std::vector<float> wtpt_values(wtpt_width * wtpt_height);
+        RoiStatistics wtpt_stats;
+        for (;;) {
+            PipelineFramePtr frame(new PipelineFrame());
+            {
+                std::lock_guard<std::mutex> lock(sequence_mutex);
+                if (next_sequence == nframes || cancel_ || !data_queue_.pop(frame->raw) || !free_frames_.pop(frame->buffer) || cancel_) {
+                    break;
+                }
+                frame->sequence = next_sequence++;
+                frame->filter_index = frame->sequence / nlights_;
+                frame->light_index = frame->sequence % nlights_;
+                if (calibration_ && frame->light_index == 0) {
+                    // Page in the calibration planes for the next filter position while this one is captured,
+                    // and drop the ones that are no longer needed.
+                    if (frame->filter_index == 0) {
+                        calibration_->Prefetch(0);
                     }
+                    calibration_->Prefetch(frame->filter_index + 1);
+                    calibration_->Release(frame->filter_index - 1);
                 }
             }
-            // subtract bias, divide flat field
-            cv::Mat floatdatamat(height_, width_, CV_32F, floatdata.get());
-            // Normalize data to a white reference
-
-            std::vector<float> values;
-
-            for (auto y = wtpt_rect_.y(); y < wtpt_rect_.y() + wtpt_rect_.size().height(); ++y) {
-                for (auto x = wtpt_rect_.x(); x < wtpt_rect_.x() + wtpt_rect_.size().width(); ++x) {
-                    values.push_back(floatdata.get()[y*width_+x]);
+            const int filter_index = frame->filter_index;
+            const int light_index = frame->light_index;
+
+            // Fused ingest: bias subtraction, flat-field correction and white normalization in a single sweep
+            // of the frame. The white reference median only needs the ROI, so it is measured first on the ROI rows alone.
+            const unsigned short* raw = frame->raw.get();
+            const float* inv_flat = NULL;
+            const unsigned short* inv_flat_fp16 = NULL;
+            size_t inv_flat_stride;
+            if (calibration_) {
+                inv_flat = calibration_->gain(light_index, filter_index);
+                inv_flat_fp16 = calibration_->gainFp16(light_index, filter_index);
+                inv_flat_stride = calibration_->stride();
+            } else {
+                inv_flat = inv_flat_data[light_index]->filterData(filter_index);
+                inv_flat_stride = inv_flat_data[light_index]->stride();
+            }
+            auto ingest = [&](float* dst, int x, int y, int n, float gain) {
+                if (inv_flat_fp16) {
+                    IngestFp16(dst, &raw[y*width_+x], &bias[y*width_+x], &inv_flat_fp16[y*inv_flat_stride+x], gain, n);
+                } else {
+                    Ingest(dst, &raw[y*width_+x], &bias[y*width_+x], &inv_flat[y*inv_flat_stride+x], gain, n);
                 }
+            };
+
+            for (auto y = 0; y < wtpt_height; ++y) {
+                ingest(&wtpt_values[y*wtpt_width], wtpt_x, wtpt_rect_.y() + y, wtpt_width, 1.0f);
             }
-            std::nth_element(values.begin(), values.begin()+(values.size()/2), values.end()); // median sort in constant time
-            float measured_wtpt = values[values.size()/2];
+            wtpt_stats.Compute(ImageView<const float>(wtpt_values.data(), wtpt_width, wtpt_height, wtpt_width));
+            frame->measured_wtpt = wtpt_stats.median();
+            const float wtpt_gain = absolute_wtpt_values_[filter_index] / frame->measured_wtpt;
 
+            float* floatdata = frame->buffer->filterData(0);
             for (auto y = 0; y < height_; ++y) {
-                for (auto x = 0; x < width_; ++x) {
-                    floatdata.get()[y*width_+x] /= (measured_wtpt / absolute_wtpt_values_[filter_index]);
-                }
+                ingest(&floatdata[y*width_], 0, y, width_, wtpt_gain);
             }
-
-            if (filter_index == 0) { // use first filter as registration target
-                for (auto y = 0; y < height_; ++y) {
-                    for (auto x = 0; x < width_; ++x) {
-                        regdata.get()[y*width_+x] = floatdata.get()[y*width_+x];
-                    }
+            // The raw frame goes back to the acquisition side as soon as it has been read
+            frame->raw.reset();
+            registration_queue_.push(frame);
+        }
+        if (--ingest_running == 0) {
+            registration_queue_.close();
+        }
+    };
+
+    // Registration stage. Frames of the other filters that arrive before the reference has been prepared are held
+    // back and registered by the worker that prepares it, rather than blocking a worker each.
+    std::mutex reference_mutex;
+    bool reference_ready = !register_frames;
+    std::vector<PipelineFramePtr> held_frames;
+    std::atomic<int> registration_running(registration_workers_);
+    auto registration_stage = [&](RawImage<float>* warpbuffer) {
+        // Phase-correlate based registration algorithm to align image planes based on two concentric circle targets
+        // Concentric targets are used because of their non-repeating nature; phase correlate gets tripped up by repeating patterns as the peaks can be matched at errant points
+
+        // Scale and translation are estimated on the target windows only (the reference windows were
+        // prepared once by setReference), then the frame is resampled once into warpbuffer, which trades places with the frame's buffer.
+        auto register_frame = [&](PipelineFrame& frame) {
+            if (!registration.ready()) {
+                return;
+            }
+            float* floatdata = frame.buffer->filterData(0);
+            RegistrationResult transform = registration.estimate(ImageView<const float>(floatdata, width_, height_, width_));
+            {
+                std::lock_guard<std::mutex> lock(confidence_mutex_);
+                reg_confidence_[frame.filter_index * nlights_ + frame.light_index] = (float)transform.confidence;
+            }
+            cv::Mat warped(height_, width_, CV_32F, warpbuffer->filterData(0));
+            registration.apply(cv::Mat(height_, width_, CV_32F, floatdata), warped, transform);
+            std::swap(frame.buffer, warpbuffer);
+        };
+
+        PipelineFramePtr frame;
+        while (registration_queue_.pop(frame) && !cancel_) {
+            if (frame->filter_index == 0) {
+                std::vector<PipelineFramePtr> released;
+                if (register_frames && frame->light_index == nlights_ - 1) {
+                    registration.setReference(ImageView<const float>(*frame->buffer), QRectToCvRect(regtargets[0]), QRectToCvRect(regtargets[1]));
+                    std::lock_guard<std::mutex> lock(reference_mutex);
+                    reference_ready = true;
+                    released.swap(held_frames);
                 }
-                cv::Mat regdatamat(height_, width_, CV_32F, regdata.get());
-
-            } else {                // Register image to regtarget_data
-                // Phase-correlate based registration algorithm to align image planes based on two concentric circle targets
-                // Concentric targets are used because of their non-repeating nature; phase correlate gets tripped up by repeating patterns as the peaks can be matched at errant points
-
-                //cv::mat construction is efficient and does not copy data.  Initialize registration target from our regdata
-
-
-                cv::Mat registerTo(height_, width_, CV_32F, regdata.get());
-                cv::Mat reg0_source, reg0_target, reg1_source, reg1_target;
-                cv::Mat reg0_sourcef, reg0_targetf, reg1_sourcef, reg1_targetf;
-
-                // These cv::Mats' are our registration targets; selected by the user in the main application.
-
-                //reg0_source = registration target 0 on the image that is going to be registered
-                //reg0_target = registration target 1 on the image that is going to be registered to
-                reg0_sourcef = floatdatamat(cv::Range(regtargets[0].y(), regtargets[0].y() + regtargets[0].size().height()), cv::Range(regtargets[0].x(), regtargets[0].x() + regtargets[0].size().width()));
-                reg0_targetf = registerTo(cv::Range(regtargets[0].y(), regtargets[0].y() + regtargets[0].size().height()), cv::Range(regtargets[0].x(), regtargets[0].x() + regtargets[0].size().width()));// - (reg_size/2), regtargets[0].y + (reg_size/2)), cv::Range(regtargets[0].x - (reg_size/2), regtargets[0].x + (reg_size/2)));
-                reg1_sourcef = floatdatamat(cv::Range(regtargets[1].y(), regtargets[1].y() + regtargets[1].size().height()), cv::Range(regtargets[1].x(), regtargets[1].x() + regtargets[1].size().width()));// - (reg_size/2), regtargets[1].y + (reg_size/2)), cv::Range(regtargets[1].x - (reg_size/2), regtargets[1].x + (reg_size/2)));
-                reg1_targetf = registerTo(cv::Range(regtargets[1].y(), regtargets[1].y() + regtargets[1].size().height()), cv::Range(regtargets[1].x(), regtargets[1].x() + regtargets[1].size().width()));// - (reg_size/2), regtargets[1].y + (reg_size/2)), cv::Range(regtargets[1].x - (reg_size/2), regtargets[1].x + (reg_size/2)));
-
-                double min, max;
-                cv::Point minLoc, maxLoc;
-
-                cv::minMaxLoc(reg0_sourcef, &min, &max, &minLoc, &maxLoc);
-                reg0_sourcef *= 255/max;
-                cv::minMaxLoc(reg1_sourcef, &min, &max, &minLoc, &maxLoc);
-                reg1_sourcef *= 255/max;
-                cv::minMaxLoc(reg0_targetf, &min, &max, &minLoc, &maxLoc);
-                reg0_targetf *= 255/max;
-                cv::minMaxLoc(reg1_targetf, &min, &max, &minLoc, &maxLoc);
-                reg1_targetf *= 255/max;
-
-                reg0_sourcef.convertTo(reg0_source, CV_8U);
-                reg0_targetf.convertTo(reg0_target, CV_8U);
-                reg1_sourcef.convertTo(reg1_source, CV_8U);
-                reg1_targetf.convertTo(reg1_target, CV_8U);
-
-                cv::adaptiveThreshold(reg0_source, reg0_source, 255, cv::ADAPTIVE_THRESH_GAUSSIAN_C, cv::THRESH_BINARY, 11, 2);
-                cv::adaptiveThreshold(reg0_target, reg0_target, 255, cv::ADAPTIVE_THRESH_GAUSSIAN_C, cv::THRESH_BINARY, 11, 2);
-                cv::adaptiveThreshold(reg1_source, reg1_source, 255, cv::ADAPTIVE_THRESH_GAUSSIAN_C, cv::THRESH_BINARY, 11, 2);
-                cv::adaptiveThreshold(reg1_target, reg1_target, 255, cv::ADAPTIVE_THRESH_GAUSSIAN_C, cv::THRESH_BINARY, 11, 2);
-
-                reg0_source.convertTo(reg0_source, CV_32F);
-                reg1_source.convertTo(reg1_source, CV_32F);
-                reg0_target.convertTo(reg0_target, CV_32F);
-                reg1_target.convertTo(reg1_target, CV_32F);
-
-                reg0_sourcef /= 255;
-                reg0_targetf /= 255;
-                reg1_sourcef /= 255;
-                reg1_targetf /= 255;
-
-                cv::Point2d offset_center = cv::phaseCorrelate(reg0_source, reg0_target);
-                cv::Point2d offset_corner = cv::phaseCorrelate(reg1_source, reg1_target);
-
-                float r, r_prime, deltaX, deltaY;
-
-                deltaX = offset_corner.x - offset_center.x;
-                deltaY = offset_corner.y - offset_center.y;
-
-                r = pow((regtargets[1].center().x() - regtargets[0].center().x()), 2) + pow((regtargets[1].center().y() - regtargets[0].center().y()), 2);
-                r = sqrt(r);
-
-                r_prime = pow((regtargets[1].center().x() - regtargets[0].center().x() + deltaX), 2) + pow((regtargets[1].center().y() - regtargets[0].center().y() + deltaY), 2);
-                r_prime = sqrt(r_prime);
-
-
-                float scale = r_prime / r;
-                float trans_x = (floatdatamat.size().width  / 2) * (1-scale);
-                float trans_y = (floatdatamat.size().height / 2) * (1-scale);
-
-                std::vector<float> matrix_data(6);
-                matrix_data[0] = scale;
-                matrix_data[1] = 0;
-                matrix_data[2] = trans_x;
-                matrix_data[3] = 0;
-                matrix_data[4] = scale;
-                matrix_data[5] = trans_y;
-
-                cv::Mat affine(2, 3, CV_32F, matrix_data.data());
-                cv::Mat scaled;
-                cv::warpAffine(floatdatamat, scaled, affine, floatdatamat.size());
-
-                cv::Mat scaled_target = scaled(cv::Range(regtargets[0].y(), regtargets[0].y() + regtargets[0].size().height()), cv::Range(regtargets[0].x(), regtargets[0].x() + regtargets[0].size().width()));
-                cv::Point2d translation_offset = cv::phaseCorrelate(scaled_target, reg0_target);
-
-
-                matrix_data[2] += translation_offset.x;
-                matrix_data[5] += translation_offset.y;
-
-                cv::warpAffine(floatdatamat, floatdatamat, affine, floatdatamat.size());
+                accumulation_queue_.push(frame);
+                for (auto held = released.begin(); held != released.end(); ++held) {
+                    register_frame(**held);
+                    accumulation_queue_.push(*held);
+                }
+                continue;
             }
-            if (raw_tiff_path.size() > 0) {
-                TIFFSetField(rawdata_tiff, TIFFTAG_IMAGEWIDTH, width_);
-                TIFFSetField(rawdata_tiff, TIFFTAG_IMAGELENGTH, height_);
-                TIFFSetField(rawdata_tiff, TIFFTAG_BITSPERSAMPLE, sizeof(float) * 8);
-                TIFFSetField(rawdata_tiff, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_IEEEFP);
-                TIFFSetField(rawdata_tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-                TIFFSetField(rawdata_tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
-                TIFFSetField(rawdata_tiff, TIFFTAG_SAMPLESPERPIXEL, 1);
-                TIFFSetField(rawdata_tiff, TIFFTAG_SUBFILETYPE, FILETYPE_PAGE);
-                TIFFSetField(rawdata_tiff, TIFFTAG_WTPTVAL, absolute_wtpt_values_[filter_index]);
-                TIFFSetField(rawdata_tiff, TIFFTAG_WTPTMEASURED, measured_wtpt);
-                TIFFSetField(rawdata_tiff, TIFFTAG_PAGENUMBER, page_index);
-
-                for (auto row = 0; row < height_; ++row) {
-                    TIFFWriteScanline(rawdata_tiff, &floatdata.get()[row*width_], row);
+            {
+                std::lock_guard<std::mutex> lock(reference_mutex);
+                if (!reference_ready) {
+                    held_frames.push_back(frame);
+                    continue;
                 }
-                TIFFWriteDirectory(rawdata_tiff);
-                ++page_index;
             }
-
-            int wavelength = filter_->wavelengthAtPos(filter_index);
-            std::vector<float> cmf = filter_->cmfValues(wavelength);
-            float illuminant = filter_->illuminantValue(wavelength);
-            for (auto y = 0; y < height_; ++y) {
-                for (auto x = 0; x < width_; ++x) {
-                    for (auto xyz_index = 0; xyz_index < 3; ++xyz_index) {
-                        xyz_data[light_index].get()->filterData(xyz_index)[y*width_+x] += floatdata.get()[y*width_+x] * cmf[xyz_index] * illuminant;
+            register_frame(*frame);
+            accumulation_queue_.push(frame);
+        }
+        if (--registration_running == 0) {
+            accumulation_queue_.close();
+        }
+    };
+
+    // Accumulation stage. The XYZ (and cube) planes of every light are split into row bands, and each
+    // (light, band) lane is the partial sum of one accumulation worker: it adds those rows of that light's
+    // frames, in filter order. Lanes never overlap and the band split never changes the order in which a pixel
+    // sums its filters, so the planes are bit for bit those of a single worker, whatever the worker count.
+    // The lights are reduced into the master at the end, in light order, by blend_. The lanes of a frame
+    // finish in any order; the last one hands the frame on to the writer.
+    const int row_bands = std::max(1, std::min((accumulation_workers_ + nlights_ - 1) / nlights_, height_ / MIN_ACCUMULATION_ROWS));
+    typedef std::pair<PipelineFramePtr, int> LaneWork;     // frame and row band
+    std::vector<std::unique_ptr<threadqueue<LaneWork>>> lane_queues;
+    for (int n = 0; n < accumulation_workers_; ++n) {
+        lane_queues.push_back(std::unique_ptr<threadqueue<LaneWork>>(new threadqueue<LaneWork>()));
+    }
+    auto finish_part = [&](const PipelineFramePtr& frame) {
+        if (--frame->pending_parts == 0) {
+            write_queue_.push(frame);
+        }
+    };
+    auto accumulation_stage = [&](threadqueue<LaneWork>* lanes) {
+        LaneWork work;
+        while (lanes->pop(work) && !cancel_) {
+            const PipelineFrame& frame = *work.first;
+            const int first = (work.second * height_) / row_bands;
+            const int rows = (((work.second + 1) * height_) / row_bands) - first;
+            const ImageView<const float> plane(frame.buffer->filterData(0), width_, height_, width_);
+            projection.Accumulate(plane.crop(0, first, width_, rows), frame.filter_index, ImageView<float>(*xyz_data[frame.light_index]).crop(0, first, width_, rows));
+            cube_.Store(frame.light_index, frame.filter_index, plane, first, first + rows);
+            finish_part(work.first);
+        }
+    };
+
+    // Writer stage: raw TIFF pages in capture order, after which the frame buffer is free for the next frame.
+    auto write_stage = [&]() {
+        int next_page = 0;
+        std::map<int, PipelineFramePtr> pages;
+        PipelineFramePtr frame;
+        while (write_queue_.pop(frame)) {
+            pages[frame->sequence] = frame;
+            while (!pages.empty() && pages.begin()->first == next_page) {
+                frame = pages.begin()->second;
+                pages.erase(pages.begin());
+                if (raw_tiff_path.size() > 0 && !cancel_) {
+                    float* floatdata = frame->buffer->filterData(0);
+                    TIFFSetField(rawdata_tiff, TIFFTAG_IMAGEWIDTH, width_);
+                    TIFFSetField(rawdata_tiff, TIFFTAG_IMAGELENGTH, height_);
+                    TIFFSetField(rawdata_tiff, TIFFTAG_BITSPERSAMPLE, sizeof(float) * 8);
+                    TIFFSetField(rawdata_tiff, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_IEEEFP);
+                    TIFFSetField(rawdata_tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+                    TIFFSetField(rawdata_tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+                    TIFFSetField(rawdata_tiff, TIFFTAG_SAMPLESPERPIXEL, 1);
+                    TIFFSetField(rawdata_tiff, TIFFTAG_SUBFILETYPE, FILETYPE_PAGE);
+                    TIFFSetField(rawdata_tiff, TIFFTAG_WTPTVAL, absolute_wtpt_values_[frame->filter_index]);
+                    TIFFSetField(rawdata_tiff, TIFFTAG_WTPTMEASURED, frame->measured_wtpt);
+                    TIFFSetField(rawdata_tiff, TIFFTAG_PAGENUMBER, frame->sequence);
+
+                    for (auto row = 0; row < height_; ++row) {
+                        TIFFWriteScanline(rawdata_tiff, &floatdata[row*width_], row);
                     }
+                    TIFFWriteDirectory(rawdata_tiff);
                 }
+                free_frames_.push(frame->buffer);
+                ++next_page;
             }
         }
+    };
+
+    std::vector<std::thread> workers;
+    for (int n = 0; n < ingest_workers_; ++n) {
+        workers.push_back(std::thread(ingest_stage));
     }
-    if (raw_tiff_path.size() > 0) {
-        TIFFClose(rawdata_tiff);
+    for (int n = 0; n < registration_workers_; ++n) {
+        workers.push_back(std::thread(registration_stage, register_frames ? frame_buffers[nbuffers + n].get() : NULL));
     }
-    // Scale xyz data by scalar constant
-    for (auto light = 0; light < nlights_; ++light) {
-        for (auto y = 0; y < height_; ++y) {
-            for (auto x = 0; x < width_; ++x) {
-                for (auto xyz_index = 0; xyz_index < 3; ++xyz_index) {
-                     xyz_data[light].get()->filterData(xyz_index)[y*width_+x] /= scalar_constant[xyz_index];
+    std::vector<std::thread> accumulation_workers;
+    for (int n = 0; n < accumulation_workers_; ++n) {
+        accumulation_workers.push_back(std::thread(accumulation_stage, lane_queues[n].get()));
+    }
+    workers.push_back(std::thread(write_stage));
+
+    // Frames leave the parallel stages out of order and are put back in capture order here, on this thread, so
+    // that every lane sees its light's filters in order. The band averages need all lights of a filter in order
+    // as well, and are computed here while the lanes accumulate the same frame.
+    int next_frame = 0;
+    std::map<int, PipelineFramePtr> reordered;
+    PipelineFramePtr frame;
+    while (next_frame < nframes && accumulation_queue_.pop(frame) && !cancel_) {
+        reordered[frame->sequence] = frame;
+        while (!reordered.empty() && reordered.begin()->first == next_frame) {
+            frame = reordered.begin()->second;
+            reordered.erase(reordered.begin());
+            const int filter_index = frame->filter_index;
+            const int light_index = frame->light_index;
+
+            frame->pending_parts = row_bands + (bandbuffer ? 1 : 0);
+            for (int band = 0; band < row_bands; ++band) {
+                lane_queues[((light_index * row_bands) + band) % accumulation_workers_]->push(LaneWork(frame, band));
+            }
+            if (bandbuffer) {
+                float* band = bandbuffer->filterData(0);
+                const float* src[2] = { frame->buffer->filterData(0), band };
+                const float band_weights[2] = { light_weight, 1.0f };
+                Blend(band, src, band_weights, (light_index == 0) ? 1 : 2, width_ * height_);
+                if (light_index == nlights_ - 1) {
+                    spectral_integrals_.BuildPlane(filter_index, ImageView<const float>(*bandbuffer));
                 }
+                finish_part(frame);
             }
+            ++next_frame;
         }
     }
+    reordered.clear();
+    frame.reset();
+    if (cancel_) {
+        closePipeline();
+    }
+    for (int n = 0; n < accumulation_workers_; ++n) {
+        lane_queues[n]->close();
+        accumulation_workers[n].join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(cube_mutex_);
+        cube_capturing_ = false;
+    }
+    write_queue_.close();
+    for (auto worker = workers.begin(); worker != workers.end(); ++worker) {
+        worker->join();
+    }
+    if (raw_tiff_path.size() > 0) {
+        TIFFClose(rawdata_tiff);
+    }
+    if (cancel_) {
+        return;
+    }
 
 
-    std::vector<XYZImage*> xyz_ptr;
-    for (auto i = 0; i < xyz_data.size(); ++i) {
-        xyz_ptr.push_back(xyz_data[i].get());
-    }
     std::vector<float> weights(nlights_);
     for (auto weight = 0; weight < weights.size(); ++weight) {
        weights[weight] = 1.0 / float(nlights_);
     }
 
-    master_xyz = std::shared_ptr<XYZImage>(new XYZImage(xyz_ptr, nlights_, weights));
+    // Published under the lock, so callers see either the previous capture's results or all of these
+    std::lock_guard<std::mutex> lock(results_mutex_);
+    // Dropping our reference first lets blend_ update its master in place rather than allocate a new one
+    master_xyz.reset();
+    blend_.setLights(xyz_data);
+    blend_.setWeights(weights);
+    master_xyz = blend_.master();
+    preview_.Build(xyz_data);
+    xyz_integrals_.Build(ImageView<const float>(*master_xyz));
+}
+void colorengine::closePipeline()
+{
+    data_queue_.close();
+    free_frames_.close();
+    registration_queue_.close();
+    accumulation_queue_.close();
+    write_queue_.close();
 }
 void colorengine::setBlckpt(const QRect& blkpt)
 {
@@ -233,11 +404,124 @@ void colorengine::setBlckpt(const QRect& blkpt)
 
 QPixmap colorengine::getQPixmap(const cv::Rect& crop)
 {
-    return RGBImage(*master_xyz.get(), crop).getQPixmap();
+    // A master held here is never updated in place (see BlendEngine), so it is read without the lock
+    std::shared_ptr<XYZImage> master;
+    {
+        std::lock_guard<std::mutex> lock(results_mutex_);
+        master = master_xyz;
+    }
+    const ImageView<const float> view = ImageView<const float>(*master).crop(crop.x, crop.y, crop.width, crop.height);
+    return QPixmap::fromImage(RenderQImage(view));
+}
+std::shared_ptr<LabImage> colorengine::getLabImage(const cv::Rect& crop) //cropping, light weights
+{
+    std::shared_ptr<XYZImage> master;
+    {
+        std::lock_guard<std::mutex> lock(results_mutex_);
+        master = master_xyz;
+    }
+    return std::make_shared<LabImage>(*master.get(), crop);
+}
+void colorengine::setSpectralStatistics(bool enable)
+{
+    spectral_statistics_ = enable;
+}
+void colorengine::setRetainSpectralCube(bool retain, int storage)
+{
+    retain_cube_ = retain;
+    cube_storage_ = storage;
+}
+std::shared_ptr<XYZImage> colorengine::renderIlluminant(const filterconfig* filter) const
+{
+    return renderIlluminant(SpectralProjection(filter));
 }
-LabImage* colorengine::getLabImage(const cv::Rect& crop) //cropping, light weights
+std::shared_ptr<XYZImage> colorengine::renderIlluminant(const SpectralProjection& projection) const
 {
-    return new LabImage(*master_xyz.get(), crop);
+    std::vector<float> weights;
+    {
+        std::lock_guard<std::mutex> lock(results_mutex_);
+        weights = blend_.weights();
+    }
+    std::lock_guard<std::mutex> lock(cube_mutex_);
+    if (cube_capturing_ || cube_.empty() || projection.nfilters() != cube_.nfilters()) {
+        return std::shared_ptr<XYZImage>();
+    }
+    if (weights.size() < cube_.nlights()) {
+        weights.assign(cube_.nlights(), 1.0f / float(cube_.nlights()));
+    }
+    std::shared_ptr<XYZImage> xyz(new XYZImage(width_, height_));
+    cube_.Project(projection, weights, ImageView<float>(*xyz));
+    return xyz;
+}
+std::vector<std::shared_ptr<XYZImage>> colorengine::renderIlluminants(const std::vector<const filterconfig*>& filters) const
+{
+    std::vector<std::shared_ptr<XYZImage>> images;
+    const SpectralProjection projection(filters);
+    std::vector<float> weights;
+    {
+        std::lock_guard<std::mutex> lock(results_mutex_);
+        weights = blend_.weights();
+    }
+    std::lock_guard<std::mutex> lock(cube_mutex_);
+    if (cube_capturing_ || cube_.empty() || projection.nfilters() == 0 || projection.nfilters() != cube_.nfilters()) {
+        return images;
+    }
+    if (weights.size() < cube_.nlights()) {
+        weights.assign(cube_.nlights(), 1.0f / float(cube_.nlights()));
+    }
+    std::vector<ImageView<float>> views;
+    for (size_t k = 0; k < filters.size(); ++k) {
+        images.push_back(std::shared_ptr<XYZImage>(new XYZImage(width_, height_)));
+        views.push_back(ImageView<float>(*images.back()));
+    }
+    cube_.Project(projection, weights, views);
+    return images;
+}
+std::vector<PatchMeasurement> colorengine::measurePatches(const std::vector<cv::Rect>& patches)
+{
+    std::vector<PatchMeasurement> measurements(patches.size());
+    std::lock_guard<std::mutex> lock(results_mutex_);
+    std::shared_ptr<XYZImage> master = blend_.master();
+    if (!master || patches.empty()) {
+        return measurements;
+    }
+    if (xyz_integrals_.empty()) {
+        xyz_integrals_.Build(ImageView<const float>(*master));
+    }
+
+    std::vector<double> mean, stddev;
+    xyz_integrals_.Moments(patches, mean, stddev);
+    // L*a*b* of the mean XYZ of every patch, converted in one batch
+    std::vector<float> xyz_mean(3 * patches.size()), lab_mean(3 * patches.size());
+    const cv::Rect bounds(0, 0, (int)xyz_integrals_.width(), (int)xyz_integrals_.height());
+    for (size_t p = 0; p < patches.size(); ++p) {
+        PatchMeasurement& patch = measurements[p];
+        patch.region = patches[p] & bounds;
+        patch.count = (size_t)patch.region.area();
+        for (int c = 0; c < 3; ++c) {
+            patch.xyz[c] = mean[(p * 3) + c];
+            patch.xyz_stddev[c] = stddev[(p * 3) + c];
+            xyz_mean[(c * patches.size()) + p] = (float)patch.xyz[c];
+        }
+    }
+    const float* xyz_rows[3] = { &xyz_mean[0], &xyz_mean[patches.size()], &xyz_mean[2 * patches.size()] };
+    float* lab_rows[3] = { &lab_mean[0], &lab_mean[patches.size()], &lab_mean[2 * patches.size()] };
+    XyzToLabExact(lab_rows, xyz_rows, patches.size());
+    for (size_t p = 0; p < patches.size(); ++p) {
+        for (int c = 0; c < 3; ++c) {
+            measurements[p].lab[c] = lab_mean[(c * patches.size()) + p];
+        }
+    }
+
+    if (!spectral_integrals_.empty()) {
+        const size_t nbands = spectral_integrals_.num();
+        spectral_integrals_.Moments(patches, mean, stddev);
+        for (size_t p = 0; p < patches.size(); ++p) {
+            measurements[p].spectrum.assign(mean.begin() + (p * nbands), mean.begin() + ((p + 1) * nbands));
+            measurements[p].spectrum_stddev.assign(stddev.begin() + (p * nbands), stddev.begin() + ((p + 1) * nbands));
+        }
+    }
+    return measurements;
 }
 
 void colorengine::waitForThreadFinish()
@@ -253,25 +537,66 @@ void colorengine::addDataToQueue(const std::shared_ptr<unsigned short>& data)
 {
     data_queue_.push(data);
 }
+bool colorengine::tryAddDataToQueue(const std::shared_ptr<unsigned short>& data)
+{
+    return data_queue_.try_push(data);
+}
+void colorengine::setPipelineWorkers(int ingest_workers, int registration_workers, int accumulation_workers)
+{
+    ingest_workers_ = std::max(ingest_workers, 1);
+    registration_workers_ = std::max(registration_workers, 1);
+    accumulation_workers_ = std::max(accumulation_workers, 1);
+}
+void colorengine::setPipelineDepth(size_t frames)
+{
+    data_queue_.setCapacity(frames);
+}
+void colorengine::setFrameBuffers(size_t buffers)
+{
+    frame_buffers_ = std::max(buffers, size_t(1));
+}
+PipelineStatus colorengine::pipelineStatus() const
+{
+    PipelineStatus status;
+    status.queued = data_queue_.size();
+    status.queue_capacity = data_queue_.capacity();
+    status.registration = registration_queue_.size();
+    status.accumulation = accumulation_queue_.size();
+    status.writing = write_queue_.size();
+    status.free_buffers = free_frames_.size();
+    return status;
+}
 colorengine::colorengine(int width, int height, filterconfig* filter, int nlights) : width_(width), height_(height), filter_(filter), nlights_(nlights)
 {
     for (auto light = 0; light < nlights_; ++light) {
-        xyz_data.push_back(std::shared_ptr<XYZImage>(new XYZImage(width_, height_)));
+        xyz_data.push_back(std::shared_ptr<XYZImage>(new XYZImage(width_, height_, DefaultPlaneStorage() | STORAGE_POOLED)));   // per-light planes are recycled through PlanePool
     }
+    blend_.setLights(xyz_data);
     absolute_wtpt_values_ = std::vector<float>(filter_->nfilters());
 
     for (auto i = 0; i < absolute_wtpt_values_.size(); ++i) {
         absolute_wtpt_values_[i] = 0.9666f;
     }
 
+    reg_interpolation_ = cv::INTER_LINEAR;
+    reg_pyramid_levels_ = 0;
+    spectral_statistics_ = false;
+    retain_cube_ = false;
+    cube_storage_ = CUBE_FLOAT16;
+    cube_capturing_ = false;
+    ingest_workers_ = 1;
+    registration_workers_ = 1;
+    accumulation_workers_ = 1;
+    frame_buffers_ = 4;
     cancel_ = false;
 }
 
 colorengine::colorengine(int width, int height, filterconfig* filter, int nlights, const std::string& capturename) : width_(width), height_(height), filter_(filter), nlights_(nlights)
 {
     for (auto light = 0; light < nlights_; ++light) {
-        xyz_data.push_back(std::shared_ptr<XYZImage>(new XYZImage(width_, height_)));
+        xyz_data.push_back(std::shared_ptr<XYZImage>(new XYZImage(width_, height_, DefaultPlaneStorage() | STORAGE_POOLED)));   // per-light planes are recycled through PlanePool
     }
+    blend_.setLights(xyz_data);
     absolute_wtpt_values_ = std::vector<float>(filter_->nfilters());
 
 
@@ -281,13 +606,23 @@ colorengine::colorengine(int width, int height, filterconfig* filter, int nlight
 
     raw_tiff_path = capturename;
 
+    reg_interpolation_ = cv::INTER_LINEAR;
+    reg_pyramid_levels_ = 0;
+    spectral_statistics_ = false;
+    retain_cube_ = false;
+    cube_storage_ = CUBE_FLOAT16;
+    cube_capturing_ = false;
+    ingest_workers_ = 1;
+    registration_workers_ = 1;
+    accumulation_workers_ = 1;
+    frame_buffers_ = 4;
     cancel_ = false;
 }
 void colorengine::stopAsync()
 {
     cancel_ = true;
-    // Push back one additional data object onto queue to unblock worker thread
-    data_queue_.push(std::shared_ptr<unsigned short>());
+    // Closing the queues unblocks every stage, including an acquisition thread waiting in addDataToQueue
+    closePipeline();
     // Wait for thread to return, then clear the queue
     if (colorthread_.joinable()) colorthread_.join();
     data_queue_.clear();
@@ -297,9 +632,40 @@ void colorengine::addBias(const std::shared_ptr<unsigned short>& bias)
 {
     bias_data = bias;
 }
+// Flat fields are stored as reciprocals so the per-frame ingest multiplies instead of divides.
 void colorengine::addFlatField(const std::shared_ptr<FlatFieldImage>& flatimg)
 {
-    flat_data.push_back(flatimg);
+    std::shared_ptr<RawImage<float>> inv_flat(new RawImage<float>(flatimg->num(), flatimg->width(), flatimg->height()));
+    for (size_t n = 0; n < flatimg->num(); ++n) {
+        for (size_t y = 0; y < flatimg->height(); ++y) {
+            float* dst = &inv_flat->filterData(n)[y*inv_flat->stride()];
+            std::fill(dst, dst + flatimg->width(), 1.0f);
+            DivideGuarded(dst, &flatimg->filterData(n)[y*flatimg->stride()], flatimg->width());
+        }
+    }
+    inv_flat_data.push_back(inv_flat);
+}
+bool colorengine::setCalibrationStore(const std::shared_ptr<CalibrationStore>& store)
+{
+    // The ingest reads width x height planes for every light and filter straight from the mapping
+    if (store && (store->width() != (size_t)width_ || store->height() != (size_t)height_ || store->nlights() != nlights_ || store->nfilters() != filter_->nfilters())) {
+        return false;
+    }
+    calibration_ = store;
+    return true;
+}
+void colorengine::setRegistrationInterpolation(int interpolation)
+{
+    reg_interpolation_ = interpolation;
+}
+void colorengine::setRegistrationPyramid(int levels)
+{
+    reg_pyramid_levels_ = levels;
+}
+std::vector<float> colorengine::registrationConfidence() const
+{
+    std::lock_guard<std::mutex> lock(confidence_mutex_);
+    return reg_confidence_;
 }
 void colorengine::setRegtargets(const std::vector<QRect>& targets)
 {
@@ -312,23 +678,36 @@ void colorengine::setWtpt(const QRect& wtpt)
 void colorengine::startAsync()
 {
     if (colorthread_.joinable()) colorthread_.join();
+    // xyz_data is about to be rewritten; previews fall back to full-resolution blends until the capture finishes
+    {
+        std::lock_guard<std::mutex> lock(results_mutex_);
+        preview_.Clear();
+        xyz_integrals_.Clear();
+    }
+    cancel_ = false;
     colorthread_ = std::thread(&colorengine::threadFunc, this);
 }
 void colorengine::setLightWeights(const std::vector<float> &weights)
 {
+    std::lock_guard<std::mutex> lock(results_mutex_);
     weights_ = weights;
 
-    std::vector<XYZImage*> xyz_ptr;
-    for (auto i = 0; i < xyz_data.size(); ++i) {
-        xyz_ptr.push_back(xyz_data[i].get());
-    }
-
-    master_xyz = std::shared_ptr<XYZImage>(new XYZImage(xyz_ptr, nlights_, weights));
+    // Dropping our reference first lets blend_ update its master in place; images still held by others are left as they are
+    master_xyz.reset();
+    blend_.setWeights(weights);
+    master_xyz = blend_.master();
+    // Rebuilt by the next measurePatches
+    xyz_integrals_.Clear();
 }
 void colorengine::setLightWeights(const std::vector<float>& weights, cv::Size master_dest_size)
 {
+    std::lock_guard<std::mutex> lock(results_mutex_);
     weights_ = weights;
 
+    if (!preview_.empty()) {
+        master_xyz = preview_.Render(weights, master_dest_size);
+        return;
+    }
     std::vector<XYZImage*> xyz_ptr;
     for (auto i = 0; i < xyz_data.size(); ++i) {
         xyz_ptr.push_back(xyz_data[i].get());
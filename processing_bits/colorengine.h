@@ -4,9 +4,19 @@
 #include "filterconfig.h"
 #include <thread>
 #include <memory>
+#include <atomic>
+#include <mutex>
 #include "ColorProcessor/Image.h"
 #include "ColorProcessor/ConversionFunctions.h"
 #include "ColorProcessor/FlatFieldImage.h"
+#include "ColorProcessor/CalibrationStore.h"
+#include "ColorProcessor/RoiStatistics.h"
+#include "ColorProcessor/RegistrationEngine.h"
+#include "ColorProcessor/SpectralProjection.h"
+#include "ColorProcessor/SpectralCube.h"
+#include "ColorProcessor/BlendEngine.h"
+#include "ColorProcessor/PreviewPyramid.h"
+#include "ColorProcessor/RegionIntegrals.h"
 #include <QRect>
 #include <QPixmap>
 #include "threadqueue.h"
@@ -19,6 +29,29 @@
 #include "ColorProcessor/libtiff/tiffio.h"
 #include "ColorProcessor/customtifftags.h"
 
+// Statistics of one chart patch, see colorengine::measurePatches.
+struct PatchMeasurement
+{
+    cv::Rect region;                        // the patch clipped to the capture
+    size_t count;                           // pixels in region
+    cv::Vec3d xyz;
+    cv::Vec3d xyz_stddev;
+    cv::Vec3d lab;                          // L*a*b* of the mean XYZ
+    std::vector<double> spectrum;           // mean of every filter band; empty without spectral statistics
+    std::vector<double> spectrum_stddev;
+};
+
+// Frames at each stage of the capture pipeline, see colorengine::pipelineStatus.
+struct PipelineStatus
+{
+    size_t queued;                          // raw frames accepted by addDataToQueue, not yet ingested
+    size_t queue_capacity;                  // addDataToQueue waits, and tryAddDataToQueue fails, once queued reaches it; 0 = unbounded
+    size_t registration;                    // calibrated frames waiting for a registration worker
+    size_t accumulation;                    // registered frames waiting for accumulation
+    size_t writing;                         // accumulated frames waiting for the TIFF writer
+    size_t free_buffers;                    // frame buffers no stage is using
+};
+
 // colorengine: worker class that supports asynchronus color image calculation using a thread-safe FIFO queue (dataqueue)
 // This enables color data to be processed parallel with image acquisition.
 //
@@ -27,9 +60,21 @@ class colorengine
 private:
     std::vector<std::shared_ptr<XYZImage>> xyz_data;
     std::shared_ptr<XYZImage> master_xyz;
+    BlendEngine blend_;                 // owns master_xyz for full-size blends, updated in place on weight changes
+    PreviewPyramid preview_;            // mip levels of xyz_data, built when a capture finishes
+    RegionIntegrals xyz_integrals_;     // of blend_.master(), built when a capture finishes; weight changes clear them and the next measurePatches rebuilds them
+    mutable std::mutex results_mutex_;  // master_xyz, blend_, preview_ and xyz_integrals_ between the capture thread and callers
+    RegionIntegrals spectral_integrals_;    // one plane per filter, light-averaged, built during a capture
+    bool spectral_statistics_;
+    SpectralCube cube_;                 // registered, normalized frames of the last capture, if retained
+    bool cube_capturing_;               // a capture is storing into cube_, which renders then refuse
+    mutable std::mutex cube_mutex_;     // cube_capturing_, and cube_ between the capture thread and renders
+    bool retain_cube_;
+    int cube_storage_;
 
     std::shared_ptr<unsigned short> bias_data;
-    std::vector<std::shared_ptr<FlatFieldImage>> flat_data;
+    std::vector<std::shared_ptr<RawImage<float>>> inv_flat_data;   // reciprocal flat fields, one per light
+    std::shared_ptr<CalibrationStore> calibration_;                 // replaces bias_data and inv_flat_data when set
     std::shared_ptr<unsigned short> regtarget_data;
 
     int width_, height_;
@@ -41,13 +86,39 @@ private:
     threadqueue< std::shared_ptr<unsigned short> > data_queue_;
     std::thread colorthread_;
 
+    // A frame on its way through the pipeline. buffer is taken from free_frames_ at ingest and returned after writing.
+    struct PipelineFrame
+    {
+        int sequence;                       // capture order: filter * nlights + light
+        int filter_index;
+        int light_index;
+        std::shared_ptr<unsigned short> raw;    // released once ingested
+        RawImage<float>* buffer;
+        float measured_wtpt;
+        std::atomic<int> pending_parts;     // accumulation lanes (and band average) still reading buffer
+    };
+    typedef std::shared_ptr<PipelineFrame> PipelineFramePtr;
+    threadqueue<PipelineFramePtr> registration_queue_;
+    threadqueue<PipelineFramePtr> accumulation_queue_;
+    threadqueue<PipelineFramePtr> write_queue_;
+    threadqueue<RawImage<float>*> free_frames_;
+    int ingest_workers_;
+    int registration_workers_;
+    int accumulation_workers_;
+    size_t frame_buffers_;
+
     std::vector<QRect> regtargets;
+    int reg_interpolation_;
+    int reg_pyramid_levels_;
+    std::vector<float> reg_confidence_;     // per frame, filter-major; written by the registration workers
+    mutable std::mutex confidence_mutex_;   // guards reg_confidence_
     std::vector<float> weights_;
     QRect wtpt_rect_;
     QRect bkpt_rect_;
     int nlights_;
-    bool cancel_;
+    std::atomic<bool> cancel_;
     void threadFunc();
+    void closePipeline();
 public:
     colorengine(int width, int height, filterconfig* filter, int nlights, const std::string& capturename);
     colorengine(int width, int height, filterconfig* filter, int nlights);
@@ -56,21 +127,72 @@ public:
 
     void addBias(const std::shared_ptr<unsigned short>& bias);
     void addFlatField(const std::shared_ptr<FlatFieldImage>& flatimg);
+    // Use a calibration store (see CalibrationStore::Open) instead of addBias/addFlatField. Returns false, and keeps
+    // the current store, if store was written for another frame size, number of lights or number of filters.
+    bool setCalibrationStore(const std::shared_ptr<CalibrationStore>& store);
     void setWtpt(const QRect& wtpt);
     void setBlckpt(const QRect& blkpt);
     void setRegtargets(const std::vector<QRect>& targets);
+    // Interpolation used to resample registered frames (cv::INTER_LINEAR by default).
+    void setRegistrationInterpolation(int interpolation);
+    // Coarse-to-fine registration over 2^levels times the target windows, for large drifts (0 = off, the default).
+    void setRegistrationPyramid(int levels);
+    // Registration confidence (0..1) of every frame of the last capture, indexed filter * nlights + light.
+    // Reference frames report 1. During a capture it is a snapshot of the current one, unregistered frames at 1.
+    std::vector<float> registrationConfidence() const;
     void setRawDataSavepath(const std::string& path);
-    // set light weights
+    // set light weights. Only the lights whose weight changed are re-blended into the current master.
     void setLightWeights(const std::vector<float>& weights);
+    // Preview of master_dest_size.width, blended from the nearest level of the preview pyramid once a capture has finished.
     void setLightWeights(const std::vector<float>& weights, cv::Size master_dest_size);
 
+    // Capture pipeline: ingest (bias, flat field and white normalization), registration, accumulation (XYZ, cube and
+    // band statistics) and raw TIFF writing each run on their own threads, connected by bounded queues, so a capture
+    // keeps the pace of its slowest stage rather than of all stages together. Every stage but the writer takes any
+    // number of workers (1 each by default). Accumulation workers own fixed (light, row band) lanes of the XYZ
+    // planes and see each lane's frames in capture order, so results are bit for bit the same for any worker
+    // counts. Takes effect at the next startAsync.
+    void setPipelineWorkers(int ingest_workers, int registration_workers, int accumulation_workers = 1);
+    // Raw frames addDataToQueue accepts ahead of the pipeline before it waits (tryAddDataToQueue fails instead).
+    // Unbounded (0) unless set, so acquisition is never held back by default.
+    void setPipelineDepth(size_t frames);
+    // Frame buffers in flight inside the pipeline, from ingest until written: 4 by default, never fewer than
+    // workers plus two. Takes effect at the next startAsync.
+    void setFrameBuffers(size_t buffers);
+    PipelineStatus pipelineStatus() const;
+
+    // Waits while the queue is full once setPipelineDepth has bounded it, so no more frames than that can then be
+    // queued before startAsync. tryAddDataToQueue returns false instead of waiting, for acquisition loops that must not block.
     void addDataToQueue(const std::shared_ptr<unsigned short>& data);
+    bool tryAddDataToQueue(const std::shared_ptr<unsigned short>& data);
     //void addDataPlane(const dataplane<unsigned short>& data);
     void startAsync();
     void stopAsync();
     void waitForThreadFinish();
 
     QPixmap getQPixmap(const cv::Rect& crop);
-    LabImage* getLabImage(const cv::Rect& crop);
+    std::shared_ptr<LabImage> getLabImage(const cv::Rect& crop);
+
+    // Keep summed-area tables of every filter band (the average of all lights) during the next captures, for
+    // the spectra of measurePatches. Costs 16 bytes per pixel and filter; off by default.
+    void setSpectralStatistics(bool enable);
+    // Mean and standard deviation of XYZ (full-size blend with the last setLightWeights(weights) weights), and of
+    // every filter band if enabled, over each patch of the last capture. Patches cost the same whatever their size.
+    std::vector<PatchMeasurement> measurePatches(const std::vector<cv::Rect>& patches);
+
+    // Keep the registered, normalized frames of the next captures (CUBE_FLOAT32 or CUBE_FLOAT16, see SpectralCube),
+    // so that they can be rendered again for other illuminants. Off by default. CUBE_BASIS keeps coefficients of
+    // the filterconfig's spectral basis instead (half floats if it has none); spectralCube().reconstructionError()
+    // reports how well the basis fits the capture. The cube, and every render from it, is only available between
+    // captures: renders return NULL (or nothing) while one is running.
+    void setRetainSpectralCube(bool retain, int storage = CUBE_FLOAT16);
+    const SpectralCube& spectralCube() const { return cube_; }
+    // XYZ of the last capture for the illuminant and color matching functions of filter (same filters as the
+    // capture), or for projection, blended with the current light weights. NULL without a retained cube or during a capture.
+    std::shared_ptr<XYZImage> renderIlluminant(const filterconfig* filter) const;
+    std::shared_ptr<XYZImage> renderIlluminant(const SpectralProjection& projection) const;
+    // One XYZ image per filterconfig from a single pass over the cube, e.g. D50, D65 and A for a metamerism report.
+    // Empty without a retained cube, during a capture, or unless every configuration has the cube's filters.
+    std::vector<std::shared_ptr<XYZImage>> renderIlluminants(const std::vector<const filterconfig*>& filters) const;
 };
 #endif // COLORENGINE_H
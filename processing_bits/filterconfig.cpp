@@ -1,9 +1,12 @@
 #include "filterconfig.h"
+#include <cmath>
 const int filterconfig::filterconfig_43014 = 0;
 const int filterconfig::filterconfig_51414 = 1;
+const double filterconfig::BASIS_DEPENDENCE_TOLERANCE = 1e-3;
 
 filterconfig::filterconfig(const std::string& cmfcsv_path, const std::string& illcsv_path, const int& configindex)
 {
+    basis_components_ = 0;
     std::ifstream cmf_ifs(cmfcsv_path);
     std::ifstream ill_ifs(illcsv_path);
     std::string row;
@@ -195,3 +198,108 @@ filterconfig::filterconfig(const std::string& cmfcsv_path, const std::string& il
         bandpass_width_ = 3;
     }
 }
+
+bool filterconfig::setSpectralBasis(const std::vector<float>& basis, int ncomponents)
+{
+    if (ncomponents < 0) {
+        return false;
+    }
+    std::vector<float> orthonormal(basis);
+    orthonormal.resize(ncomponents * nfilters());
+    if (!orthonormalizeBasis(orthonormal, nfilters())) {
+        return false;
+    }
+    basis_.swap(orthonormal);
+    basis_components_ = ncomponents;
+    return true;
+}
+
+bool filterconfig::orthonormalizeBasis(std::vector<float>& basis, int nfilters)
+{
+    if (nfilters <= 0) {
+        return basis.empty();
+    }
+    const size_t n = nfilters;
+    const size_t ncomponents = basis.size() / n;
+    std::vector<double> vectors(basis.begin(), basis.begin() + (ncomponents * n));
+    for (size_t k = 0; k < ncomponents; ++k) {
+        double* v = &vectors[k * n];
+        double length = 0;
+        for (size_t f = 0; f < n; ++f) {
+            length += v[f] * v[f];
+        }
+        length = std::sqrt(length);
+        // Modified Gram-Schmidt: each projection is taken from what is left of v
+        for (size_t j = 0; j < k; ++j) {
+            const double* u = &vectors[j * n];
+            double dot = 0;
+            for (size_t f = 0; f < n; ++f) {
+                dot += v[f] * u[f];
+            }
+            for (size_t f = 0; f < n; ++f) {
+                v[f] -= dot * u[f];
+            }
+        }
+        double residual = 0;
+        for (size_t f = 0; f < n; ++f) {
+            residual += v[f] * v[f];
+        }
+        residual = std::sqrt(residual);
+        // Also false for a zero row and for NaN
+        if (!(residual > length * BASIS_DEPENDENCE_TOLERANCE)) {
+            return false;
+        }
+        for (size_t f = 0; f < n; ++f) {
+            v[f] /= residual;
+        }
+    }
+    basis.assign(vectors.begin(), vectors.end());
+    return true;
+}
+
+bool filterconfig::loadSpectralBasis(const std::string& csv_path)
+{
+    std::ifstream basis_ifs(csv_path);
+    if (!basis_ifs) {
+        return false;
+    }
+    std::vector<float> basis;
+    int ncomponents = 0;
+    std::string row;
+    while (std::getline(basis_ifs, row))
+    {
+        std::string cell;
+        std::stringstream rowstream(row);
+        int i = 0;
+        while (std::getline(rowstream, cell, ',')) {
+            float value;
+            std::stringstream ss(cell);
+            ss >> value;
+            basis.push_back(value);
+            ++i;
+        }
+        if (i == 0) {
+            continue;
+        }
+        if (i != nfilters()) {
+            return false;
+        }
+        ++ncomponents;
+    }
+    return setSpectralBasis(basis, ncomponents);
+}
+
+bool filterconfig::saveSpectralBasis(const std::string& csv_path) const
+{
+    std::ofstream basis_ofs(csv_path);
+    if (!basis_ofs) {
+        return false;
+    }
+    basis_ofs.precision(9);
+    for (int component = 0; component < basis_components_; ++component) {
+        for (int filter = 0; filter < nfilters(); ++filter) {
+            basis_ofs << basis_[(component * nfilters()) + filter] << ((filter + 1 < nfilters()) ? "," : "\n");
+        }
+    }
+    return true;
+}
@@ -30,6 +30,8 @@ private:
     std::map<int, std::vector<float>> wavelength_cmf_;
     std::map<int, float> illuminant_;
     int bandpass_width_;
+    std::vector<float> basis_;          // basis_components_ rows of nfilters() values
+    int basis_components_;
 
 public:
     static const int filterconfig_43014;
@@ -72,6 +74,28 @@ public:
     {
         return bandpass_width_;
     }
+
+    // Spectral basis for compact spectral cubes (see SpectralBasis): ncomponents orthonormal vectors of nfilters()
+    // values, in filter order. Empty unless set or loaded. The vectors are orthonormalized when set; returns false,
+    // keeping the current basis, if one of them is zero or nearly a combination of the ones before it.
+    bool setSpectralBasis(const std::vector<float>& basis, int ncomponents);
+    // CSV with one component per row. Returns false if the file cannot be read, its rows are not nfilters() long
+    // or setSpectralBasis rejects them.
+    bool loadSpectralBasis(const std::string& csv_path);
+    bool saveSpectralBasis(const std::string& csv_path) const;
+    const std::vector<float>& spectralBasis() const
+    {
+        return basis_;
+    }
+    const int basisComponents() const
+    {
+        return basis_components_;
+    }
+    // Gram-Schmidt in double over the rows of basis (nfilters values each), in order. Returns false, leaving
+    // basis unchanged, if a row keeps less than BASIS_DEPENDENCE_TOLERANCE of its length after the projections
+    // on the rows before it are removed.
+    static bool orthonormalizeBasis(std::vector<float>& basis, int nfilters);
+    static const double BASIS_DEPENDENCE_TOLERANCE;
 };
 
 #endif
@@ -2,40 +2,114 @@
 #ifndef THREADQUEUE_H
 #define THREADQUEUE_H
 
+#include <cstddef>
 #include <queue>
 #include <mutex>
 #include <condition_variable>
 
 
 // threadqueue class: thread-safe FIFO queue
+//
+// A capacity (0 = unbounded, the default) makes push wait while the queue is full, and try_push fail instead,
+// so a consumer that falls behind holds its producer back. close() wakes every waiting thread: later pushes are
+// dropped, and pop hands out what is left before it reports the end. clear() empties and reopens the queue.
 template<typename T>
 class threadqueue {
 private:
-    std::mutex m;
-    std::condition_variable c;
+    mutable std::mutex m;
+    std::condition_variable c;          // an item arrived or the queue was closed
+    std::condition_variable space;      // an item left or the queue was closed
     std::queue<T> q;
+    size_t cap;
+    bool closed;
 public:
+    explicit threadqueue(size_t capacity = 0) : cap(capacity), closed(false) { }
+
+    // Next item; T() once the queue is closed and empty.
     T pop()
+    {
+        T item = T();
+        pop(item);
+        return item;
+    }
+    // Waits for the next item; false once the queue is closed and empty.
+    bool pop(T& item)
     {
         std::unique_lock<std::mutex> lock(m);
-        while (q.empty())
+        while (q.empty() && !closed)
         {
             c.wait(lock);
         }
-        T item = q.front();
+        if (q.empty()) {
+            return false;
+        }
+        item = q.front();
         q.pop();
-        return item;
+        lock.unlock();
+        space.notify_one();
+        return true;
     }
-    void push(const T& item)
+    // Waits for room; false if the queue is (or gets) closed.
+    bool push(const T& item)
     {
         std::unique_lock<std::mutex> lock(m);
+        while (cap > 0 && q.size() >= cap && !closed)
+        {
+            space.wait(lock);
+        }
+        if (closed) {
+            return false;
+        }
+        q.push(item);
+        lock.unlock();
+        c.notify_one();
+        return true;
+    }
+    // false if the queue is full or closed.
+    bool try_push(const T& item)
+    {
+        std::unique_lock<std::mutex> lock(m);
+        if (closed || (cap > 0 && q.size() >= cap)) {
+            return false;
+        }
         q.push(item);
         lock.unlock();
         c.notify_one();
+        return true;
+    }
+    void close()
+    {
+        std::unique_lock<std::mutex> lock(m);
+        closed = true;
+        lock.unlock();
+        c.notify_all();
+        space.notify_all();
     }
     void clear()
     {
+        std::unique_lock<std::mutex> lock(m);
         q = std::queue<T>();
+        closed = false;
+        lock.unlock();
+        space.notify_all();
+    }
+    size_t size() const
+    {
+        std::unique_lock<std::mutex> lock(m);
+        return q.size();
+    }
+    size_t capacity() const
+    {
+        std::unique_lock<std::mutex> lock(m);
+        return cap;
+    }
+    // Items already queued beyond a smaller capacity stay; pushes wait until the queue has drained below it.
+    void setCapacity(size_t capacity)
+    {
+        std::unique_lock<std::mutex> lock(m);
+        cap = capacity;
+        lock.unlock();
+        space.notify_all();
     }
 };
 